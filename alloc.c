@@ -0,0 +1,96 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "alloc.h"
+
+// Stored before every block, padded so the block stays aligned for any type
+typedef union {
+    size_t size;
+    max_align_t align;
+} AllocHeader;
+
+static _Atomic uint64_t allocations;
+static _Atomic uint64_t bytes_allocated;
+static _Atomic uint64_t live_bytes;
+static _Atomic uint64_t peak_bytes;
+
+static void count_allocation(size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&bytes_allocated, size, memory_order_relaxed);
+    uint64_t live =
+        atomic_fetch_add_explicit(&live_bytes, size, memory_order_relaxed) + size;
+    uint64_t peak = atomic_load_explicit(&peak_bytes, memory_order_relaxed);
+    while (live > peak &&
+           !atomic_compare_exchange_weak_explicit(&peak_bytes, &peak, live,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+void* raycast_malloc(size_t size) {
+    if (size > SIZE_MAX - sizeof(AllocHeader)) {
+        return NULL;
+    }
+    AllocHeader* header = malloc(sizeof(AllocHeader) + size);
+    if (header == NULL) {
+        return NULL;
+    }
+    header->size = size;
+    count_allocation(size);
+    return header + 1;
+}
+
+void* raycast_calloc(size_t count, size_t size) {
+    if (size != 0 && count > (SIZE_MAX - sizeof(AllocHeader)) / size) {
+        return NULL;
+    }
+    AllocHeader* header = calloc(1, sizeof(AllocHeader) + count * size);
+    if (header == NULL) {
+        return NULL;
+    }
+    header->size = count * size;
+    count_allocation(count * size);
+    return header + 1;
+}
+
+void* raycast_realloc(void* pointer, size_t size) {
+    if (pointer == NULL) {
+        return raycast_malloc(size);
+    }
+    if (size > SIZE_MAX - sizeof(AllocHeader)) {
+        return NULL;
+    }
+    AllocHeader* header = (AllocHeader*)pointer - 1;
+    size_t old_size = header->size;
+    header = realloc(header, sizeof(AllocHeader) + size);
+    if (header == NULL) {
+        return NULL;
+    }
+    header->size = size;
+    // Counted as freeing the old block and allocating the new one
+    atomic_fetch_sub_explicit(&live_bytes, old_size, memory_order_relaxed);
+    count_allocation(size);
+    return header + 1;
+}
+
+void raycast_free(void* pointer) {
+    if (pointer == NULL) {
+        return;
+    }
+    AllocHeader* header = (AllocHeader*)pointer - 1;
+    atomic_fetch_sub_explicit(&live_bytes, header->size, memory_order_relaxed);
+    free(header);
+}
+
+void raycast_alloc_stats(RaycastAllocStats* stats) {
+    stats->allocations = atomic_load(&allocations);
+    stats->bytes_allocated = atomic_load(&bytes_allocated);
+    stats->live_bytes = atomic_load(&live_bytes);
+    stats->peak_bytes = atomic_load(&peak_bytes);
+}
+
+void raycast_alloc_stats_reset(void) {
+    atomic_store(&allocations, 0);
+    atomic_store(&bytes_allocated, 0);
+    atomic_store(&peak_bytes, atomic_load(&live_bytes));
+}
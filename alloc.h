@@ -0,0 +1,57 @@
+#ifndef __ALLOC_H__
+#define __ALLOC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Allocation accounting.
+ *
+ * Images, prepared scenes, the engines' working buffers (per-thread frames,
+ * tiles, light lists), the PNG encoder and decoder, light files and the scene
+ * and light generators all allocate through these hooks, which keep
+ * process-wide counts of what is allocated and how much of it is live. Reset
+ * the counts before a render and read them after it to see what that render
+ * cost in memory, for example:
+ *
+ *   raycast_alloc_stats_reset();
+ *   RaycastAllocStats before;
+ *   raycast_alloc_stats(&before);
+ *   Image* out = raycast_prepared(prepared, engine, lights, count, threads);
+ *   RaycastAllocStats after;
+ *   raycast_alloc_stats(&after);
+ *   // after.peak_bytes - before.live_bytes: most memory the render added
+ *
+ * Memory from a hook must be released with `raycast_free` (or by the library
+ * function that owns it, such as `free_image`), never with `free`: each block
+ * starts with a size header that `free` does not know about. For the same
+ * reason, memory from `malloc` must not be handed to the library to free.
+ */
+
+typedef struct {
+    uint64_t allocations;     // allocations and reallocations made
+    uint64_t bytes_allocated; // bytes they requested
+    uint64_t live_bytes;      // bytes allocated and not yet freed
+    uint64_t peak_bytes;      // most bytes live at once
+} RaycastAllocStats;
+
+/*
+ * `malloc`, `calloc`, `realloc` and `free`, counted.
+ */
+void* raycast_malloc(size_t size);
+void* raycast_calloc(size_t count, size_t size);
+void* raycast_realloc(void* pointer, size_t size);
+void raycast_free(void* pointer);
+
+/*
+ * Copy the counts since the last `raycast_alloc_stats_reset` into `stats`.
+ * `live_bytes` is always the current total.
+ */
+void raycast_alloc_stats(RaycastAllocStats* stats);
+
+/*
+ * Zero the allocation counts, and restart the peak from what is live now.
+ */
+void raycast_alloc_stats_reset(void);
+
+#endif // __ALLOC_H__
@@ -0,0 +1,666 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "generate.h"
+#include "raycaster.h"
+#include "raycaster_util.h"
+
+/*
+ * Differential testing of the engines.
+ *
+ * Usage: difftest [options]
+ *
+ *   --engines LIST     engines to check against the reference
+ *                      (default sequential,lights,rows,region,progressive,cost)
+ *   --cases N          random cases to run (default 500)
+ *   --seed N           seed the cases are derived from (default 1)
+ *   --start N          index of the first case, to rerun one (default 0)
+ *   --max-size N       largest scene side in pixels (default 48)
+ *   --max-lights N     most lights in a case (default 6)
+ *   --max-threads N    most threads an engine is given (default 4)
+ *   --obstacles MODE   black: obstacles are all black, so engines that paint
+ *                      obstacles black agree on them; dark: obstacles are any
+ *                      color dark enough to block light, to check the colors
+ *                      engines keep on them (default black)
+ *
+ * Every case is a generated scene of random kind, size and density, recolored
+ * at random (open pixels bright, obstacles dark), with a random set of lights
+ * and thread count. Each engine renders it and is compared pixel by pixel with
+ * a reference render: the original sequential loop, which walks every ray
+ * with `step` through the scene's own pixels and uses none of the prepared
+ * scene's shortcuts, so an error in one of those shows up in every engine.
+ *
+ * For every engine it reports how many cases and pixels disagreed, the
+ * largest channel error, and where the first disagreement was. The first
+ * failing case of each engine is then shrunk: lights (alone, in pairs or with
+ * a thread), threads, rows and columns are removed and lights and pixels simplified for
+ * as long as the engine still disagrees, and the minimal case is printed as a
+ * map.
+ *
+ * Exits with 1 if any engine disagreed, and 0 otherwise.
+ */
+
+typedef Image* (*EngineRender)(const PreparedScene* prepared, Light* lights,
+                               int light_count, int threads);
+
+typedef struct {
+    const char* name;
+    EngineRender render;
+} Engine;
+
+typedef struct {
+    Image* scene;
+    Light* lights;
+    int light_count;
+    int threads;
+} Case;
+
+// How an engine's render differs from the reference
+typedef struct {
+    unsigned long mismatches;
+    int max_error;
+    // First mismatching pixel, scanning rows top to bottom
+    int x, y;
+    Color expected;
+    Color actual;
+} Diff;
+
+typedef struct {
+    int cases;
+    int failed_cases;
+    unsigned long mismatches;
+    int max_error;
+    // First failing case, kept for shrinking
+    int first_failure;
+    Case failure;
+    Diff failure_diff;
+} EngineReport;
+
+static Image* run_sequential(const PreparedScene* prepared, Light* lights,
+                             int light_count, int threads) {
+    (void)threads;
+    return raycast_prepared_sequential(prepared, lights, light_count);
+}
+
+static Image* run_lights(const PreparedScene* prepared, Light* lights,
+                         int light_count, int threads) {
+    return raycast_prepared_parallel_lights(prepared, lights, light_count, threads);
+}
+
+static Image* run_rows(const PreparedScene* prepared, Light* lights,
+                       int light_count, int threads) {
+    return raycast_prepared_parallel_rows(prepared, lights, light_count, threads);
+}
+
+static Image* run_region(const PreparedScene* prepared, Light* lights,
+                         int light_count, int threads) {
+    Image* scene = prepared_scene_image(prepared);
+    Image* out = new_image(scene->width, scene->height);
+    raycast_prepared_region(prepared, lights, light_count, 0, 0, scene->width,
+                            scene->height, out->pixels, scene->width, threads);
+    return out;
+}
+
+static Image* run_progressive(const PreparedScene* prepared, Light* lights,
+                              int light_count, int threads) {
+    return raycast_prepared_progressive(prepared, lights, light_count, threads,
+                                        NULL, NULL);
+}
+
+static Image* run_cost(const PreparedScene* prepared, Light* lights,
+                       int light_count, int threads) {
+    Image* scene = prepared_scene_image(prepared);
+    uint32_t* cost =
+        raycast_malloc(sizeof(uint32_t) * scene->width * scene->height);
+    Image* out = raycast_prepared_cost(prepared, lights, light_count, threads, cost);
+    raycast_free(cost);
+    return out;
+}
+
+static const Engine engines[] = {
+    { "sequential", run_sequential },
+    { "lights", run_lights },
+    { "rows", run_rows },
+    { "region", run_region },
+    { "progressive", run_progressive },
+    { "cost", run_cost },
+};
+
+#define ENGINE_TOTAL (int)(sizeof(engines) / sizeof(engines[0]))
+
+// xorshift64*
+static uint64_t next_random(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static int random_below(uint64_t* state, int bound) {
+    return next_random(state) % bound;
+}
+
+static Case copy_case(const Case* source) {
+    Case copy = *source;
+    copy.scene = new_image(source->scene->width, source->scene->height);
+    memcpy(copy.scene->pixels, source->scene->pixels,
+           sizeof(Color) * source->scene->width * source->scene->height);
+    copy.lights = raycast_malloc(sizeof(Light) * (source->light_count + 1));
+    memcpy(copy.lights, source->lights, sizeof(Light) * source->light_count);
+    return copy;
+}
+
+static void free_case(Case* test) {
+    free_image(test->scene);
+    raycast_free(test->lights);
+}
+
+/*
+ * Build case number `index` of the run seeded with `seed`. The same pair always
+ * builds the same case.
+ */
+static Case make_case(uint64_t seed, int index, int max_size, int max_lights,
+                      int max_threads, int dark_obstacles) {
+    uint64_t state = seed * 0x9E3779B97F4A7C15ULL + index * 0xBF58476D1CE4E5B9ULL + 1;
+    int width = 1 + random_below(&state, max_size);
+    int height = 1 + random_below(&state, max_size);
+    SceneKind kind = random_below(&state, SCENE_KIND_COUNT);
+    double density = random_below(&state, 60) / 100.0;
+    Case test;
+    test.scene = generate_scene(kind, width, height, density, next_random(&state));
+
+    // Open pixels stay bright enough to be open; obstacles are dark, but only
+    // sometimes black, since engines may differ in what color obstacles keep
+    for (int i = 0; i < width * height; i++) {
+        Color* pixel = &test.scene->pixels[i];
+        if (is_obstacle(*pixel)) {
+            int shade = dark_obstacles && random_below(&state, 4) == 0
+                            ? random_below(&state, 4)
+                            : 0;
+            *pixel = (Color){ shade, shade, shade };
+        }
+        else if (random_below(&state, 2) == 0) {
+            *pixel = (Color){ 64 + random_below(&state, 192), 64 + random_below(&state, 192),
+                              64 + random_below(&state, 192) };
+        }
+    }
+
+    test.light_count = random_below(&state, max_lights + 1);
+    LightLayout layout = random_below(&state, LIGHT_LAYOUT_COUNT);
+    double strength = 2 + random_below(&state, 400);
+    uint64_t light_seed = next_random(&state);
+    test.lights = generate_lights(test.scene, layout, test.light_count, strength,
+                                  light_seed);
+    if (test.lights == NULL) {
+        // Nothing is open, so only grid lights can be placed
+        test.lights = generate_lights(test.scene, LIGHTS_GRID, test.light_count,
+                                      strength, light_seed);
+    }
+    for (int i = 0; i < test.light_count; i++) {
+        test.lights[i].strength = 2 + random_below(&state, 400);
+    }
+    test.threads = 1 + random_below(&state, max_threads);
+    return test;
+}
+
+// Returns 1 if the light at `end` is visible from pixel (x, y) of `scene`.
+static int reference_visible(Image* scene, int x, int y, PixelLocation end) {
+    PixelLocation start = { x, y };
+    Pair direction = direction_pair(start, end);
+    Pair pos = { (double)x, (double)y };
+    while (1) {
+        PixelLocation next_pixel = step(&pos, direction);
+        if ((direction.x > 0 && next_pixel.x > end.x) ||
+            (direction.x < 0 && next_pixel.x < end.x) ||
+            (direction.y > 0 && next_pixel.y > end.y) ||
+            (direction.y < 0 && next_pixel.y < end.y) ||
+            (next_pixel.x == end.x && next_pixel.y == end.y)) {
+            return 1;
+        }
+        // Pixels beyond the scene are open space
+        if (next_pixel.x < (unsigned int)scene->width &&
+            next_pixel.y < (unsigned int)scene->height &&
+            is_obstacle(*image_pixel(scene, next_pixel.x, next_pixel.y))) {
+            return 0;
+        }
+    }
+}
+
+// Render `test` the way the original sequential engine did.
+static Image* reference_render(const Case* test) {
+    Image* scene = test->scene;
+    Image* cast = new_image(scene->width, scene->height);
+    for (int y = 0; y < scene->height; y++) {
+        for (int x = 0; x < scene->width; x++) {
+            Color orig = *image_pixel(scene, x, y);
+            if (is_obstacle(orig)) {
+                *image_pixel(cast, x, y) = orig;
+                continue;
+            }
+            Color total_illum = (Color){ 0, 0, 0 };
+            for (int l = 0; l < test->light_count; l++) {
+                Light light = test->lights[l];
+                if ((x == (int)light.pixel.x && y == (int)light.pixel.y) ||
+                    reference_visible(scene, x, y, light.pixel)) {
+                    total_illum = add_colors(total_illum, illuminate(light, x, y));
+                }
+            }
+            *image_pixel(cast, x, y) = mul_colors(total_illum, orig);
+        }
+    }
+    return cast;
+}
+
+static Diff compare_images(const Image* expected, const Image* actual) {
+    Diff diff = { 0 };
+    for (int y = 0; y < expected->height; y++) {
+        for (int x = 0; x < expected->width; x++) {
+            Color want = expected->pixels[(size_t)y * expected->width + x];
+            Color got = actual->pixels[(size_t)y * actual->width + x];
+            int errors[3] = { abs(want.red - got.red), abs(want.green - got.green),
+                              abs(want.blue - got.blue) };
+            int error = errors[0] > errors[1] ? errors[0] : errors[1];
+            error = error > errors[2] ? error : errors[2];
+            if (error == 0) {
+                continue;
+            }
+            if (diff.mismatches++ == 0) {
+                diff.x = x;
+                diff.y = y;
+                diff.expected = want;
+                diff.actual = got;
+            }
+            diff.max_error = error > diff.max_error ? error : diff.max_error;
+        }
+    }
+    return diff;
+}
+
+static Diff check_case(const Case* test, const Engine* engine) {
+    Image* expected = reference_render(test);
+    PreparedScene* prepared = raycast_prepare(test->scene);
+    Image* actual = engine->render(prepared, test->lights, test->light_count,
+                                   test->threads);
+    Diff diff = compare_images(expected, actual);
+    free_image(actual);
+    free_image(expected);
+    free_prepared_scene(prepared);
+    return diff;
+}
+
+/*
+ * Replace `test` with `candidate` if the engine still disagrees on it.
+ * Returns 1 if it did, and frees `candidate` otherwise.
+ */
+static int keep_if_failing(Case* test, Case* candidate, const Engine* engine) {
+    if (check_case(candidate, engine).mismatches == 0) {
+        free_case(candidate);
+        return 0;
+    }
+    free_case(test);
+    *test = *candidate;
+    return 1;
+}
+
+// Crop a case to a rectangle, dropping the lights outside it.
+static Case crop_case(const Case* source, int x, int y, int width, int height) {
+    Case crop = *source;
+    crop.scene = new_image(width, height);
+    for (int row = 0; row < height; row++) {
+        memcpy(crop.scene->pixels + (size_t)row * width,
+               source->scene->pixels + (size_t)(y + row) * source->scene->width + x,
+               sizeof(Color) * width);
+    }
+    crop.lights = raycast_malloc(sizeof(Light) * (source->light_count + 1));
+    crop.light_count = 0;
+    for (int i = 0; i < source->light_count; i++) {
+        Light light = source->lights[i];
+        if (light.pixel.x >= (unsigned int)x && light.pixel.x < (unsigned int)(x + width) &&
+            light.pixel.y >= (unsigned int)y && light.pixel.y < (unsigned int)(y + height)) {
+            light.pixel.x -= x;
+            light.pixel.y -= y;
+            crop.lights[crop.light_count++] = light;
+        }
+    }
+    return crop;
+}
+
+// Try removing `count` rows or columns from one edge. Returns 1 on success.
+static int shrink_edge(Case* test, const Engine* engine, int edge, int count) {
+    int width = test->scene->width;
+    int height = test->scene->height;
+    int vertical = edge < 2;
+    if ((vertical ? width : height) <= count) {
+        return 0;
+    }
+    Case candidate;
+    switch (edge) {
+    case 0:
+        candidate = crop_case(test, count, 0, width - count, height);
+        break;
+    case 1:
+        candidate = crop_case(test, 0, 0, width - count, height);
+        break;
+    case 2:
+        candidate = crop_case(test, 0, count, width, height - count);
+        break;
+    default:
+        candidate = crop_case(test, 0, 0, width, height - count);
+        break;
+    }
+    return keep_if_failing(test, &candidate, engine);
+}
+
+/*
+ * Try removing each light, then each pair of lights, then each light along
+ * with a thread: engines that split lights over threads may only disagree for
+ * some light and thread counts. Returns 1 if any were removed.
+ */
+static int remove_lights(Case* test, const Engine* engine) {
+    int removed = 0;
+    for (int i = 0; i < test->light_count; i++) {
+        Case candidate = copy_case(test);
+        memmove(&candidate.lights[i], &candidate.lights[i + 1],
+                sizeof(Light) * (candidate.light_count - i - 1));
+        candidate.light_count--;
+        if (keep_if_failing(test, &candidate, engine)) {
+            removed = 1;
+            i--;
+        }
+    }
+    for (int i = 0; i < test->light_count; i++) {
+        for (int j = i + 1; j < test->light_count; j++) {
+            Case candidate = copy_case(test);
+            memmove(&candidate.lights[j], &candidate.lights[j + 1],
+                    sizeof(Light) * (candidate.light_count - j - 1));
+            memmove(&candidate.lights[i], &candidate.lights[i + 1],
+                    sizeof(Light) * (candidate.light_count - i - 2));
+            candidate.light_count -= 2;
+            if (keep_if_failing(test, &candidate, engine)) {
+                removed = 1;
+                j = i;
+            }
+        }
+    }
+    for (int i = 0; i < test->light_count && test->threads > 1; i++) {
+        Case candidate = copy_case(test);
+        memmove(&candidate.lights[i], &candidate.lights[i + 1],
+                sizeof(Light) * (candidate.light_count - i - 1));
+        candidate.light_count--;
+        candidate.threads--;
+        if (keep_if_failing(test, &candidate, engine)) {
+            removed = 1;
+            i--;
+        }
+    }
+    return removed;
+}
+
+/*
+ * Shrink a failing case for as long as the engine keeps disagreeing on it.
+ */
+static void shrink_case(Case* test, const Engine* engine) {
+    static const Color white = { 255, 255, 255 };
+    static const Color black = { 0, 0, 0 };
+    int progress = 1;
+    while (progress) {
+        progress = remove_lights(test, engine);
+
+        for (int threads = 1; threads < test->threads; threads++) {
+            Case candidate = copy_case(test);
+            candidate.threads = threads;
+            if (keep_if_failing(test, &candidate, engine)) {
+                progress = 1;
+                break;
+            }
+        }
+
+        // Pull lights towards the top left, so the far edges can be cropped.
+        // Lights that meet may then be removed.
+        int moved = 0;
+        for (int i = 0; i < test->light_count; i++) {
+            PixelLocation at = test->lights[i].pixel;
+            PixelLocation moves[2] = { { at.x / 2, at.y / 2 },
+                                       { at.x - (at.x > 0), at.y - (at.y > 0) } };
+            for (int move = 0; move < 2; move++) {
+                if (moves[move].x == at.x && moves[move].y == at.y) {
+                    continue;
+                }
+                Case candidate = copy_case(test);
+                candidate.lights[i].pixel = moves[move];
+                if (keep_if_failing(test, &candidate, engine)) {
+                    moved = 1;
+                    break;
+                }
+            }
+        }
+        if (moved) {
+            progress = 1;
+            remove_lights(test, engine);
+        }
+
+        for (int edge = 0; edge < 4; edge++) {
+            int side = edge < 2 ? test->scene->width : test->scene->height;
+            for (int count = side / 2; count >= 1; count /= 2) {
+                while (shrink_edge(test, engine, edge, count)) {
+                    progress = 1;
+                }
+            }
+        }
+
+        // Make pixels plain black or white, then open up obstacles
+        int pixel_count = test->scene->width * test->scene->height;
+        for (int pass = 0; pass < 2; pass++) {
+            for (int i = 0; i < pixel_count; i++) {
+                Color pixel = test->scene->pixels[i];
+                Color plain = is_obstacle(pixel) && pass == 0 ? black : white;
+                if (memcmp(&pixel, &plain, sizeof(Color)) == 0) {
+                    continue;
+                }
+                Case candidate = copy_case(test);
+                candidate.scene->pixels[i] = plain;
+                progress |= keep_if_failing(test, &candidate, engine);
+            }
+        }
+
+        for (int i = 0; i < test->light_count; i++) {
+            Light plain = test->lights[i];
+            plain.color = white;
+            plain.strength = 100;
+            if (memcmp(&plain.color, &test->lights[i].color, sizeof(Color)) == 0 &&
+                plain.strength == test->lights[i].strength) {
+                continue;
+            }
+            Case candidate = copy_case(test);
+            candidate.lights[i] = plain;
+            progress |= keep_if_failing(test, &candidate, engine);
+        }
+    }
+}
+
+static void print_case(const Case* test, const Diff* diff) {
+    const Image* scene = test->scene;
+    printf("    %dx%d scene, %d lights, %d threads\n", scene->width, scene->height,
+           test->light_count, test->threads);
+    printf("    map: '#' black and '%%' other obstacles, '.' white and 'o' other "
+           "open pixels,\n         'L' lights, '!' first disagreement\n");
+    for (int y = 0; y < scene->height; y++) {
+        printf("      ");
+        for (int x = 0; x < scene->width; x++) {
+            Color pixel = scene->pixels[(size_t)y * scene->width + x];
+            char symbol = is_obstacle(pixel)
+                              ? (pixel.red | pixel.green | pixel.blue) == 0 ? '#' : '%'
+                              : (pixel.red & pixel.green & pixel.blue) == 255 ? '.' : 'o';
+            for (int i = 0; i < test->light_count; i++) {
+                if (test->lights[i].pixel.x == (unsigned int)x &&
+                    test->lights[i].pixel.y == (unsigned int)y) {
+                    symbol = 'L';
+                }
+            }
+            putchar(x == diff->x && y == diff->y ? '!' : symbol);
+        }
+        putchar('\n');
+    }
+    for (int y = 0; y < scene->height; y++) {
+        for (int x = 0; x < scene->width; x++) {
+            Color pixel = scene->pixels[(size_t)y * scene->width + x];
+            int plain = (pixel.red | pixel.green | pixel.blue) == 0 ||
+                        (pixel.red & pixel.green & pixel.blue) == 255;
+            if (!plain) {
+                printf("    pixel (%d, %d) = (%d, %d, %d)\n", x, y, pixel.red,
+                       pixel.green, pixel.blue);
+            }
+        }
+    }
+    for (int i = 0; i < test->light_count; i++) {
+        const Light* light = &test->lights[i];
+        printf("    light %d at (%u, %u), color (%d, %d, %d), strength %g\n", i,
+               light->pixel.x, light->pixel.y, light->color.red, light->color.green,
+               light->color.blue, light->strength);
+    }
+    printf("    pixel (%d, %d): reference (%d, %d, %d), engine (%d, %d, %d)\n",
+           diff->x, diff->y, diff->expected.red, diff->expected.green,
+           diff->expected.blue, diff->actual.red, diff->actual.green,
+           diff->actual.blue);
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [--engines LIST] [--cases N] [--seed N] [--start N]\n"
+            "       [--max-size N] [--max-lights N] [--max-threads N]\n"
+            "       [--obstacles dark|black]\n",
+            program);
+}
+
+int main(int argc, char** argv) {
+    int selected[ENGINE_TOTAL];
+    for (int e = 0; e < ENGINE_TOTAL; e++) {
+        selected[e] = 1;
+    }
+    int cases = 500;
+    unsigned long long seed = 1;
+    int start = 0;
+    int max_size = 48;
+    int max_lights = 6;
+    int max_threads = 4;
+    int dark_obstacles = 0;
+    for (int arg = 1; arg < argc; arg++) {
+        if (arg + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+        const char* option = argv[arg];
+        char* value = argv[++arg];
+        if (strcmp(option, "--engines") == 0) {
+            memset(selected, 0, sizeof(selected));
+            for (char* name = strtok(value, ","); name != NULL; name = strtok(NULL, ",")) {
+                int found = 0;
+                for (int e = 0; e < ENGINE_TOTAL; e++) {
+                    if (strcmp(name, engines[e].name) == 0) {
+                        selected[e] = found = 1;
+                    }
+                }
+                if (!found) {
+                    usage(argv[0]);
+                    return 2;
+                }
+            }
+        }
+        else if (strcmp(option, "--cases") == 0) {
+            cases = atoi(value);
+        }
+        else if (strcmp(option, "--seed") == 0) {
+            seed = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(option, "--start") == 0) {
+            start = atoi(value);
+        }
+        else if (strcmp(option, "--max-size") == 0) {
+            max_size = atoi(value);
+        }
+        else if (strcmp(option, "--max-lights") == 0) {
+            max_lights = atoi(value);
+        }
+        else if (strcmp(option, "--max-threads") == 0) {
+            max_threads = atoi(value);
+        }
+        else if (strcmp(option, "--obstacles") == 0) {
+            if (strcmp(value, "black") != 0 && strcmp(value, "dark") != 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            dark_obstacles = strcmp(value, "dark") == 0;
+        }
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (cases < 0 || start < 0 || max_size < 1 || max_lights < 0 || max_threads < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    EngineReport reports[ENGINE_TOTAL] = { 0 };
+    for (int index = start; index < start + cases; index++) {
+        Case test = make_case(seed, index, max_size, max_lights, max_threads,
+                              dark_obstacles);
+        for (int e = 0; e < ENGINE_TOTAL; e++) {
+            if (!selected[e]) {
+                continue;
+            }
+            EngineReport* report = &reports[e];
+            Diff diff = check_case(&test, &engines[e]);
+            report->cases++;
+            if (diff.mismatches == 0) {
+                continue;
+            }
+            if (report->failed_cases++ == 0) {
+                report->first_failure = index;
+                report->failure = copy_case(&test);
+                report->failure_diff = diff;
+            }
+            report->mismatches += diff.mismatches;
+            report->max_error = diff.max_error > report->max_error ? diff.max_error
+                                                                    : report->max_error;
+        }
+        free_case(&test);
+    }
+
+    printf("%-12s %7s %7s %14s %9s  %s\n", "engine", "cases", "failed",
+           "pixels differ", "max error", "first failure");
+    int failed = 0;
+    for (int e = 0; e < ENGINE_TOTAL; e++) {
+        const EngineReport* report = &reports[e];
+        if (!selected[e]) {
+            continue;
+        }
+        printf("%-12s %7d %7d %14lu %9d  ", engines[e].name, report->cases,
+               report->failed_cases, report->mismatches, report->max_error);
+        if (report->failed_cases > 0) {
+            printf("case %d, pixel (%d, %d)\n", report->first_failure,
+                   report->failure_diff.x, report->failure_diff.y);
+        }
+        else {
+            printf("-\n");
+        }
+        failed |= report->failed_cases > 0;
+    }
+
+    for (int e = 0; e < ENGINE_TOTAL; e++) {
+        EngineReport* report = &reports[e];
+        if (!selected[e] || report->failed_cases == 0) {
+            continue;
+        }
+        printf("\n%s: case %d (rerun with --seed %llu --start %d --cases 1) "
+               "shrinks to\n",
+               engines[e].name, report->first_failure, seed, report->first_failure);
+        shrink_case(&report->failure, &engines[e]);
+        Diff diff = check_case(&report->failure, &engines[e]);
+        print_case(&report->failure, &diff);
+        free_case(&report->failure);
+    }
+    return failed ? 1 : 0;
+}
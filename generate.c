@@ -0,0 +1,399 @@
+#include <math.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "generate.h"
+
+#define OPEN (Color){ 255, 255, 255 }
+#define WALL (Color){ 0, 0, 0 }
+
+static const char* scene_kind_names[SCENE_KIND_COUNT] = {
+    [SCENE_BLOBS] = "blobs",
+    [SCENE_MAZE] = "maze",
+    [SCENE_ROOMS] = "rooms",
+    [SCENE_OPEN] = "open",
+};
+
+static const char* light_layout_names[LIGHT_LAYOUT_COUNT] = {
+    [LIGHTS_UNIFORM] = "uniform",
+    [LIGHTS_CLUSTERED] = "clustered",
+    [LIGHTS_GRID] = "grid",
+};
+
+const char* scene_kind_name(SceneKind kind) {
+    return scene_kind_names[kind];
+}
+
+int scene_kind_parse(const char* name) {
+    for (int kind = 0; kind < SCENE_KIND_COUNT; kind++) {
+        if (strcmp(name, scene_kind_names[kind]) == 0) {
+            return kind;
+        }
+    }
+    return -1;
+}
+
+const char* light_layout_name(LightLayout layout) {
+    return light_layout_names[layout];
+}
+
+int light_layout_parse(const char* name) {
+    for (int layout = 0; layout < LIGHT_LAYOUT_COUNT; layout++) {
+        if (strcmp(name, light_layout_names[layout]) == 0) {
+            return layout;
+        }
+    }
+    return -1;
+}
+
+// xorshift64*, seeded through splitmix64 so that nearby seeds diverge at once
+typedef struct {
+    uint64_t state;
+} Random;
+
+static Random random_seed(uint64_t seed) {
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return (Random){ z != 0 ? z : 1 };
+}
+
+static uint64_t random_next(Random* random) {
+    random->state ^= random->state >> 12;
+    random->state ^= random->state << 25;
+    random->state ^= random->state >> 27;
+    return random->state * 0x2545F4914F6CDD1DULL;
+}
+
+// Uniform in [0, bound)
+static unsigned int random_below(Random* random, unsigned int bound) {
+    return random_next(random) % bound;
+}
+
+// Uniform in [0, 1)
+static double random_unit(Random* random) {
+    return (random_next(random) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void fill_rect(Image* image, int x, int y, int width, int height,
+                      Color color) {
+    for (int row = y; row < y + height; row++) {
+        for (int column = x; column < x + width; column++) {
+            image->pixels[(size_t)row * image->width + column] = color;
+        }
+    }
+}
+
+static void generate_blobs(Image* scene, double density, Random* random) {
+    size_t pixel_count = (size_t)scene->width * scene->height;
+    size_t target = density * pixel_count;
+    if (target >= pixel_count) {
+        fill_rect(scene, 0, 0, scene->width, scene->height, WALL);
+        return;
+    }
+
+    int short_side = scene->width < scene->height ? scene->width : scene->height;
+    int max_radius = short_side / 16 > 2 ? short_side / 16 : 2;
+    size_t blocked = 0;
+    while (blocked < target) {
+        int center_x = random_below(random, scene->width);
+        int center_y = random_below(random, scene->height);
+        int radius = 1 + random_below(random, max_radius);
+        for (int y = center_y - radius; y <= center_y + radius; y++) {
+            for (int x = center_x - radius; x <= center_x + radius; x++) {
+                int dx = x - center_x;
+                int dy = y - center_y;
+                if (x < 0 || y < 0 || x >= scene->width || y >= scene->height ||
+                    dx * dx + dy * dy > radius * radius) {
+                    continue;
+                }
+                Color* pixel = &scene->pixels[(size_t)y * scene->width + x];
+                if (!is_obstacle(*pixel)) {
+                    *pixel = WALL;
+                    blocked++;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Carve a perfect maze with a randomized depth-first search. Cells are
+ * `corridor` pixels square, separated by one-pixel walls.
+ */
+static void generate_maze(Image* scene, double density, Random* random) {
+    if (density <= 0) {
+        return;
+    }
+    fill_rect(scene, 0, 0, scene->width, scene->height, WALL);
+    int corridor = round((1 - density) / density);
+    corridor = corridor > 1 ? corridor : 1;
+    int pitch = corridor + 1;
+    int columns = (scene->width - 1) / pitch;
+    int rows = (scene->height - 1) / pitch;
+    if (columns < 1 || rows < 1) {
+        return;
+    }
+
+    static const int offsets[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+    size_t cell_count = (size_t)columns * rows;
+    uint8_t* visited = raycast_calloc(cell_count, 1);
+    size_t* stack = raycast_malloc(sizeof(size_t) * cell_count);
+    size_t depth = 0;
+    size_t start = random_below(random, cell_count);
+    stack[depth++] = start;
+    visited[start] = 1;
+    fill_rect(scene, 1 + start % columns * pitch, 1 + start / columns * pitch,
+              corridor, corridor, OPEN);
+
+    while (depth > 0) {
+        size_t cell = stack[depth - 1];
+        int column = cell % columns;
+        int row = cell / columns;
+        int choices[4];
+        int choice_count = 0;
+        for (int i = 0; i < 4; i++) {
+            int next_column = column + offsets[i][0];
+            int next_row = row + offsets[i][1];
+            if (next_column >= 0 && next_column < columns && next_row >= 0 &&
+                next_row < rows &&
+                !visited[(size_t)next_row * columns + next_column]) {
+                choices[choice_count++] = i;
+            }
+        }
+        if (choice_count == 0) {
+            depth--;
+            continue;
+        }
+
+        int i = choices[random_below(random, choice_count)];
+        int next_column = column + offsets[i][0];
+        int next_row = row + offsets[i][1];
+        size_t next = (size_t)next_row * columns + next_column;
+        visited[next] = 1;
+        stack[depth++] = next;
+        int left = 1 + (column < next_column ? column : next_column) * pitch;
+        int top = 1 + (row < next_row ? row : next_row) * pitch;
+        // The cell and the wall between it and the last one
+        fill_rect(scene, 1 + next_column * pitch, 1 + next_row * pitch,
+                  corridor, corridor, OPEN);
+        if (offsets[i][0] != 0) {
+            fill_rect(scene, left + corridor, top, 1, corridor, OPEN);
+        }
+        else {
+            fill_rect(scene, left, top + corridor, corridor, 1, OPEN);
+        }
+    }
+
+    raycast_free(stack);
+    raycast_free(visited);
+}
+
+/*
+ * Split the scene into rooms by recursive division: each region too big to be
+ * a room gets a wall across its longer side, with a doorway at a random spot.
+ */
+static void generate_rooms(Image* scene, double density, Random* random) {
+    if (density <= 0) {
+        return;
+    }
+    int min_room = 4 / density;
+    min_room = min_room > 4 ? min_room : 4;
+    int door = min_room / 3 > 1 ? min_room / 3 : 1;
+
+    typedef struct {
+        int x, y, width, height;
+    } Region;
+    int capacity = 16;
+    Region* stack = raycast_malloc(sizeof(Region) * capacity);
+    int depth = 0;
+    stack[depth++] = (Region){ 0, 0, scene->width, scene->height };
+    while (depth > 0) {
+        Region region = stack[--depth];
+        int vertical = region.width >= region.height;
+        int span = vertical ? region.width : region.height;
+        int length = vertical ? region.height : region.width;
+        if (span < 2 * min_room + 1) {
+            continue;
+        }
+
+        int wall = min_room + random_below(random, span - 2 * min_room);
+        int door_length = door < length ? door : length;
+        int door_start = random_below(random, length - door_length + 1);
+        Region first = region;
+        Region second = region;
+        if (vertical) {
+            fill_rect(scene, region.x + wall, region.y, 1, region.height, WALL);
+            fill_rect(scene, region.x + wall, region.y + door_start, 1,
+                      door_length, OPEN);
+            first.width = wall;
+            second.x += wall + 1;
+            second.width -= wall + 1;
+        }
+        else {
+            fill_rect(scene, region.x, region.y + wall, region.width, 1, WALL);
+            fill_rect(scene, region.x + door_start, region.y + wall,
+                      door_length, 1, OPEN);
+            first.height = wall;
+            second.y += wall + 1;
+            second.height -= wall + 1;
+        }
+
+        if (depth + 2 > capacity) {
+            capacity *= 2;
+            stack = raycast_realloc(stack, sizeof(Region) * capacity);
+        }
+        stack[depth++] = first;
+        stack[depth++] = second;
+    }
+    raycast_free(stack);
+}
+
+static void generate_open(Image* scene, double density, Random* random) {
+    size_t pixel_count = (size_t)scene->width * scene->height;
+    for (size_t i = 0; i < pixel_count; i++) {
+        if (random_unit(random) < density) {
+            scene->pixels[i] = WALL;
+        }
+    }
+}
+
+Image* generate_scene(SceneKind kind, int width, int height, double density,
+                      uint64_t seed) {
+    if (width < 1 || height < 1 || !(density >= 0 && density <= 1) ||
+        kind < 0 || kind >= SCENE_KIND_COUNT) {
+        return NULL;
+    }
+    Image* scene = new_image(width, height);
+    fill_rect(scene, 0, 0, width, height, OPEN);
+    Random random = random_seed(seed);
+    switch (kind) {
+    case SCENE_BLOBS:
+        generate_blobs(scene, density, &random);
+        break;
+    case SCENE_MAZE:
+        generate_maze(scene, density, &random);
+        break;
+    case SCENE_ROOMS:
+        generate_rooms(scene, density, &random);
+        break;
+    default:
+        generate_open(scene, density, &random);
+        break;
+    }
+    return scene;
+}
+
+// Bright, saturated colors: one channel full, the others random
+static Color random_light_color(Random* random) {
+    uint8_t channels[3] = { random_below(random, 256), random_below(random, 256),
+                            random_below(random, 256) };
+    channels[random_below(random, 3)] = 255;
+    return (Color){ channels[0], channels[1], channels[2] };
+}
+
+static int open_at(const Image* scene, int x, int y) {
+    return !is_obstacle(scene->pixels[(size_t)y * scene->width + x]);
+}
+
+/*
+ * A random open pixel. The scene must have one. After a bounded number of
+ * misses, which only happens when open space is scarce, take the first open
+ * pixel at or after a random one instead.
+ */
+static PixelLocation random_pixel(const Image* scene, Random* random) {
+    for (int attempt = 0; attempt < 64; attempt++) {
+        int x = random_below(random, scene->width);
+        int y = random_below(random, scene->height);
+        if (open_at(scene, x, y)) {
+            return (PixelLocation){ x, y };
+        }
+    }
+    size_t pixel_count = (size_t)scene->width * scene->height;
+    size_t i = random_next(random) % pixel_count;
+    while (is_obstacle(scene->pixels[i])) {
+        i = (i + 1) % pixel_count;
+    }
+    return (PixelLocation){ i % scene->width, i / scene->width };
+}
+
+// The sum of four uniform offsets in [-reach, reach], which is close to normal
+static int random_offset(Random* random, int reach) {
+    int offset = -4 * reach;
+    for (int i = 0; i < 4; i++) {
+        offset += random_below(random, 2 * reach + 1);
+    }
+    return offset;
+}
+
+Light* generate_lights(const Image* scene, LightLayout layout, int count,
+                       double strength, uint64_t seed) {
+    if (count < 0) {
+        return NULL;
+    }
+    size_t pixel_count = (size_t)scene->width * scene->height;
+    int has_open = 0;
+    for (size_t i = 0; i < pixel_count && !has_open; i++) {
+        has_open = !is_obstacle(scene->pixels[i]);
+    }
+    if (!has_open && layout != LIGHTS_GRID && count > 0) {
+        return NULL;
+    }
+    Light* lights = raycast_malloc(sizeof(Light) * (count + 1));
+    Random random = random_seed(seed);
+
+    if (layout == LIGHTS_GRID) {
+        int columns = round(sqrt((double)count * scene->width / scene->height));
+        columns = columns > 1 ? columns : 1;
+        int rows = (count + columns - 1) / columns;
+        for (int i = 0; i < count; i++) {
+            int column = i % columns;
+            int row = i / columns;
+            PixelLocation pixel = {
+                (2 * column + 1) * (size_t)scene->width / (2 * columns),
+                (2 * row + 1) * (size_t)scene->height / (2 * rows),
+            };
+            lights[i] = (Light){ random_light_color(&random), strength, pixel };
+        }
+        return lights;
+    }
+
+    if (layout == LIGHTS_UNIFORM) {
+        for (int i = 0; i < count; i++) {
+            PixelLocation pixel = random_pixel(scene, &random);
+            lights[i] = (Light){ random_light_color(&random), strength, pixel };
+        }
+        return lights;
+    }
+
+    // Clustered: about 16 lights around each of a few centers, spread about
+    // 1/32 of the scene along each axis. Sampling uses integers only, so no
+    // libm rounding differences can move a light between hosts.
+    int cluster_count = (count + 15) / 16;
+    PixelLocation* centers = raycast_malloc(sizeof(PixelLocation) * (cluster_count + 1));
+    for (int i = 0; i < cluster_count; i++) {
+        centers[i] = random_pixel(scene, &random);
+    }
+    // Four uniform offsets in [-reach, reach] sum to a standard deviation of
+    // about reach * 2 / sqrt(3), and 28 / 1024 is about sqrt(3) / 2 / 32
+    int short_side = scene->width < scene->height ? scene->width : scene->height;
+    int reach = short_side * 28 / 1024 > 1 ? short_side * 28 / 1024 : 1;
+    for (int i = 0; i < count; i++) {
+        PixelLocation center = centers[random_below(&random, cluster_count)];
+        PixelLocation pixel = center;
+        for (int attempt = 0; attempt < 32; attempt++) {
+            int x = (int)center.x + random_offset(&random, reach);
+            int y = (int)center.y + random_offset(&random, reach);
+            x = x < 0 ? 0 : x >= scene->width ? scene->width - 1 : x;
+            y = y < 0 ? 0 : y >= scene->height ? scene->height - 1 : y;
+            if (open_at(scene, x, y)) {
+                pixel = (PixelLocation){ x, y };
+                break;
+            }
+        }
+        lights[i] = (Light){ random_light_color(&random), strength, pixel };
+    }
+    raycast_free(centers);
+    return lights;
+}
@@ -0,0 +1,84 @@
+#ifndef __GENERATE_H__
+#define __GENERATE_H__
+
+#include <stdint.h>
+
+#include "image.h"
+#include "raycaster_util.h"
+
+/*
+ * Procedural scenes and lights.
+ *
+ * Everything here is a pure function of its arguments and seed: the same call
+ * produces the same pixels and lights on every run and every host, so large
+ * generated inputs can stand in for checked-in images in benchmarks and tests.
+ * Open space is white and obstacles are black.
+ */
+
+typedef enum {
+    // Random filled discs
+    SCENE_BLOBS,
+    // A perfect maze: every open cell reachable by exactly one path
+    SCENE_MAZE,
+    // Rectangular rooms separated by one-pixel walls with doorways
+    SCENE_ROOMS,
+    // An open field with isolated single-pixel obstacles
+    SCENE_OPEN,
+    SCENE_KIND_COUNT
+} SceneKind;
+
+typedef enum {
+    // Lights spread evenly at random over open space
+    LIGHTS_UNIFORM,
+    // Lights in a few tight groups
+    LIGHTS_CLUSTERED,
+    // Lights at the centers of a regular grid, whether open or not
+    LIGHTS_GRID,
+    LIGHT_LAYOUT_COUNT
+} LightLayout;
+
+/*
+ * Returns the name of a scene kind ("blobs", "maze", "rooms" or "open").
+ */
+const char* scene_kind_name(SceneKind kind);
+
+/*
+ * Returns the scene kind with the given name, or -1 if there is none.
+ */
+int scene_kind_parse(const char* name);
+
+/*
+ * Returns the name of a light layout ("uniform", "clustered" or "grid").
+ */
+const char* light_layout_name(LightLayout layout);
+
+/*
+ * Returns the light layout with the given name, or -1 if there is none.
+ */
+int light_layout_parse(const char* name);
+
+/*
+ * Generate a `width` x `height` scene. `density`, between 0 and 1, controls
+ * how much of it is obstacle:
+ *
+ * - blobs and open: the fraction of pixels that are obstacles
+ * - maze: the fraction of each corridor pitch taken by wall, so 0.5 makes
+ *   one-pixel corridors and smaller values wider ones
+ * - rooms: rooms are about 4 / density pixels across
+ *
+ * Returns NULL if the size or density is out of range.
+ */
+Image* generate_scene(SceneKind kind, int width, int height, double density,
+                      uint64_t seed);
+
+/*
+ * Generate `count` lights of the given `strength` for `scene`, with random
+ * saturated colors. Uniform and clustered lights are placed on open pixels.
+ * Returns NULL if `count` is negative, or if the layout is uniform or
+ * clustered and the scene has no open pixel to put lights on. Release the
+ * lights with `raycast_free`.
+ */
+Light* generate_lights(const Image* scene, LightLayout layout, int count,
+                       double strength, uint64_t seed);
+
+#endif // __GENERATE_H__
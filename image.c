@@ -1,30 +1,36 @@
+#include "alloc.h"
 #include "image.h"
 
+// stb allocates through the counted hooks too, so decoding and encoding show
+// up in the allocation counts
 #define STB_IMAGE_IMPLEMENTATION
+#define STBI_MALLOC(size) raycast_malloc(size)
+#define STBI_REALLOC(pointer, size) raycast_realloc(pointer, size)
+#define STBI_FREE(pointer) raycast_free(pointer)
 #include "stb_image.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
+#define STBIW_MALLOC(size) raycast_malloc(size)
+#define STBIW_REALLOC(pointer, size) raycast_realloc(pointer, size)
+#define STBIW_FREE(pointer) raycast_free(pointer)
 #include "stb_image_write.h"
 
+// `Color` must match stb's packed 3-channel layout byte for byte, so decoded
+// buffers can be adopted as `Image.pixels` and encoded straight from them.
+_Static_assert(sizeof(Color) == CHANNELS, "Color must be packed RGB");
+
 Image* read_image(const char* filename) {
     int width, height, bpp;
 
     uint8_t* rgb_image = stbi_load(filename, &width, &height, &bpp, CHANNELS);
-
-    Color* pixels = (Color*)malloc(sizeof(Color) * width * height);
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            int index = i * width + j;
-            pixels[index].red = rgb_image[CHANNELS * index + 0];
-            pixels[index].green = rgb_image[CHANNELS * index + 1];
-            pixels[index].blue = rgb_image[CHANNELS * index + 2];
-        }
+    if (rgb_image == NULL) {
+        return NULL;
     }
 
-    stbi_image_free(rgb_image);
-
-    Image* image = (Image*)malloc(sizeof(Image));
-    image->pixels = pixels;
+    // Adopt the decoder's buffer directly. stb allocates with `raycast_malloc`,
+    // as `new_image` does, so `free_image` releases either the same way.
+    Image* image = (Image*)raycast_malloc(sizeof(Image));
+    image->pixels = (Color*)rgb_image;
     image->width = width;
     image->height = height;
 
@@ -32,36 +38,19 @@ Image* read_image(const char* filename) {
 }
 
 void write_image(const char* filename, Image* image) {
-    uint8_t* rgb_image = (uint8_t*)malloc(sizeof(uint8_t) * image->width *
-                                          image->height * CHANNELS);
-
-    for (int i = 0; i < image->height; i++) {
-        for (int j = 0; j < image->width; j++) {
-            int index = i * image->width + j;
-            rgb_image[CHANNELS * index + 0] =
-                image->pixels[index].red;
-            rgb_image[CHANNELS * index + 1] =
-                image->pixels[index].green;
-            rgb_image[CHANNELS * index + 2] =
-                image->pixels[index].blue;
-        }
-    }
-
-    stbi_write_png(filename, image->width, image->height, CHANNELS, rgb_image,
-                   image->width * CHANNELS);
-
-    free(rgb_image);
+    stbi_write_png(filename, image->width, image->height, CHANNELS,
+                   image->pixels, image->width * CHANNELS);
 }
 
 void free_image(Image* image) {
-    free(image->pixels);
-    free(image);
+    raycast_free(image->pixels);
+    raycast_free(image);
 }
 
 Image* new_image(int width, int height) {
-    Color* pixels = (Color*)calloc(width * height, sizeof(Color));
+    Color* pixels = (Color*)raycast_calloc(width * height, sizeof(Color));
 
-    Image* image = (Image*)malloc(sizeof(Image));
+    Image* image = (Image*)raycast_malloc(sizeof(Image));
     image->pixels = pixels;
     image->width = width;
     image->height = height;
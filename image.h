@@ -20,6 +20,11 @@ typedef struct {
  *
  * Pixels are stored in a row-major array: the pixel at (x, y) is stored in the
  * array at `pixels[y * width + x]`.
+ *
+ * Images and their pixels are allocated with `raycast_malloc` (see alloc.h),
+ * which keeps a size header in front of each block. Release them only with
+ * `free_image`, never with `free`; a `pixels` array swapped into an image must
+ * likewise come from `raycast_malloc`.
  */
 typedef struct {
     Color* pixels;
@@ -28,17 +33,21 @@ typedef struct {
 } Image;
 
 /**
- * Load an image from a PNG file.
+ * Load an image from a PNG file. Returns NULL if the file cannot be decoded.
+ *
+ * The decoded buffer becomes `pixels` without being copied; release the image
+ * with `free_image` as usual.
  */
 Image* read_image(const char* filename);
 
 /**
- * Same an image to a PNG file.
+ * Save an image to a PNG file. Pixels are encoded in place, without an
+ * intermediate copy.
  */
 void write_image(const char* filename, Image* image);
 
 /**
- * Deallocate an image.
+ * Deallocate an image made by `new_image` or `read_image`, and its pixels.
  */
 void free_image(Image* image);
 
@@ -0,0 +1,312 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "light_file.h"
+
+// Lights staged per write, so padding bytes reach the file zeroed
+#define WRITE_BATCH 4096
+
+_Static_assert(sizeof(LightFileHeader) % _Alignof(Light) == 0,
+               "light records must stay aligned after the header");
+
+int write_light_file(const char* filename, const Light* lights, int count) {
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+
+    LightFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LIGHT_FILE_MAGIC, sizeof(header.magic));
+    header.version = LIGHT_FILE_VERSION;
+    header.byte_order = LIGHT_FILE_BYTE_ORDER;
+    header.record_size = sizeof(Light);
+    header.count = count;
+    int error = fwrite(&header, sizeof(header), 1, file) != 1;
+
+    Light* batch = raycast_malloc(sizeof(Light) * WRITE_BATCH);
+    memset(batch, 0, sizeof(Light) * WRITE_BATCH);
+    for (int start = 0; start < count && !error; start += WRITE_BATCH) {
+        int length = count - start < WRITE_BATCH ? count - start : WRITE_BATCH;
+        for (int i = 0; i < length; i++) {
+            batch[i].color = lights[start + i].color;
+            batch[i].strength = lights[start + i].strength;
+            batch[i].pixel = lights[start + i].pixel;
+        }
+        error = fwrite(batch, sizeof(Light), length, file) != (size_t)length;
+    }
+    raycast_free(batch);
+
+    error |= fclose(file) != 0;
+    return error ? -1 : 0;
+}
+
+int write_light_csv(const char* filename, const Light* lights, int count) {
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    int error = fprintf(file, "x,y,red,green,blue,strength\n") < 0;
+    for (int i = 0; i < count && !error; i++) {
+        const Light* light = &lights[i];
+        error = fprintf(file, "%u,%u,%u,%u,%u,%.17g\n", light->pixel.x,
+                        light->pixel.y, light->color.red, light->color.green,
+                        light->color.blue, light->strength) < 0;
+    }
+    error |= fclose(file) != 0;
+    return error ? -1 : 0;
+}
+
+LightSet* map_light_file(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(LightFileHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size_t length = info.st_size;
+    // Private and writable, so callers may adjust lights without touching the file
+    char* mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    LightFileHeader header;
+    memcpy(&header, mapping, sizeof(header));
+    if (memcmp(header.magic, LIGHT_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != LIGHT_FILE_VERSION ||
+        header.byte_order != LIGHT_FILE_BYTE_ORDER ||
+        header.record_size != sizeof(Light) || header.count > INT_MAX ||
+        header.count > (length - sizeof(header)) / sizeof(Light)) {
+        munmap(mapping, length);
+        return NULL;
+    }
+
+    LightSet* set = raycast_malloc(sizeof(LightSet));
+    set->lights = (Light*)(mapping + sizeof(header));
+    set->count = header.count;
+    set->mapping = mapping;
+    set->mapping_length = length;
+    return set;
+}
+
+/*
+ * Read a whole file into a NUL-terminated buffer. Returns NULL on failure.
+ */
+static char* read_text(const char* filename, size_t* length) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return NULL;
+    }
+    char* text = raycast_malloc(info.st_size + 1);
+    size_t total = 0;
+    while (total < (size_t)info.st_size) {
+        ssize_t count = read(fd, text + total, info.st_size - total);
+        if (count <= 0) {
+            raycast_free(text);
+            close(fd);
+            return NULL;
+        }
+        total += count;
+    }
+    close(fd);
+    text[total] = '\0';
+    *length = total;
+    return text;
+}
+
+static const char* skip_blanks(const char* text) {
+    while (*text == ' ' || *text == '\t') {
+        text++;
+    }
+    return text;
+}
+
+/*
+ * Parse an unsigned decimal no larger than `max`, followed by a comma. Returns
+ * the text after the comma, or NULL if the field is malformed.
+ */
+static const char* parse_unsigned(const char* text, unsigned long max,
+                                  unsigned int* value) {
+    text = skip_blanks(text);
+    if (*text < '0' || *text > '9') {
+        return NULL;
+    }
+    unsigned long result = 0;
+    while (*text >= '0' && *text <= '9') {
+        result = result * 10 + (*text++ - '0');
+        if (result > max) {
+            return NULL;
+        }
+    }
+    text = skip_blanks(text);
+    if (*text != ',') {
+        return NULL;
+    }
+    *value = result;
+    return text + 1;
+}
+
+/*
+ * Parse a strength. Plain decimals whose digits fit in a double's mantissa are
+ * converted directly: one division of two exactly representable values is
+ * correctly rounded, so this matches strtod. Everything else goes to strtod.
+ * Returns the text after the number, or NULL if there is none.
+ */
+static const char* parse_strength(const char* text, double* value) {
+    static const double powers[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                      1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                      1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                      1e18, 1e19, 1e20, 1e21, 1e22 };
+    text = skip_blanks(text);
+    const char* c = text;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int fraction_digits = -1;
+    for (;; c++) {
+        if (*c >= '0' && *c <= '9') {
+            mantissa = mantissa * 10 + (*c - '0');
+            digits++;
+            fraction_digits += fraction_digits >= 0;
+        }
+        else if (*c == '.' && fraction_digits < 0) {
+            fraction_digits = 0;
+        }
+        else {
+            break;
+        }
+        if (digits > 15) {
+            break;
+        }
+    }
+    int exact = digits > 0 && digits <= 15 && *c != 'e' && *c != 'E' &&
+                (*c < '0' || *c > '9');
+    if (exact) {
+        *value = fraction_digits > 0 ? (double)mantissa / powers[fraction_digits]
+                                     : (double)mantissa;
+        return c;
+    }
+
+    char* end;
+    *value = strtod(text, &end);
+    return end != text ? end : NULL;
+}
+
+/*
+ * Parse one `x,y,red,green,blue,strength` line. Returns the start of the next
+ * line, or NULL if the line is malformed.
+ */
+static const char* parse_light_line(const char* text, Light* light) {
+    unsigned int x, y, red, green, blue;
+    if ((text = parse_unsigned(text, UINT_MAX, &x)) == NULL ||
+        (text = parse_unsigned(text, UINT_MAX, &y)) == NULL ||
+        (text = parse_unsigned(text, 255, &red)) == NULL ||
+        (text = parse_unsigned(text, 255, &green)) == NULL ||
+        (text = parse_unsigned(text, 255, &blue)) == NULL) {
+        return NULL;
+    }
+    double strength;
+    if ((text = parse_strength(text, &strength)) == NULL) {
+        return NULL;
+    }
+    text = skip_blanks(text);
+    if (*text == '\r') {
+        text++;
+    }
+    if (*text != '\n' && *text != '\0') {
+        return NULL;
+    }
+    *light = (Light){ (Color){ red, green, blue }, strength, (PixelLocation){ x, y } };
+    return *text == '\n' ? text + 1 : text;
+}
+
+LightSet* read_light_csv(const char* filename) {
+    size_t length;
+    char* text = read_text(filename, &length);
+    if (text == NULL) {
+        return NULL;
+    }
+
+    // Every light takes a line, so the line count bounds the allocation
+    size_t capacity = 1;
+    for (const char* c = text; (c = memchr(c, '\n', text + length - c)) != NULL; c++) {
+        capacity++;
+    }
+    if (capacity > INT_MAX) {
+        raycast_free(text);
+        return NULL;
+    }
+    LightSet* set = raycast_malloc(sizeof(LightSet));
+    set->lights = raycast_malloc(sizeof(Light) * capacity);
+    set->count = 0;
+    set->mapping = NULL;
+    set->mapping_length = 0;
+
+    const char* line = text;
+    int first_line = 1;
+    while (*line != '\0') {
+        const char* start = skip_blanks(line);
+        int ignored = *start == '#' || *start == '\n' || *start == '\r' ||
+                      *start == '\0' ||
+                      (first_line && (*start < '0' || *start > '9'));
+        first_line = 0;
+        if (ignored) {
+            const char* end = strchr(start, '\n');
+            line = end != NULL ? end + 1 : start + strlen(start);
+            continue;
+        }
+        line = parse_light_line(start, &set->lights[set->count]);
+        if (line == NULL) {
+            raycast_free(text);
+            free_light_set(set);
+            return NULL;
+        }
+        set->count++;
+    }
+
+    raycast_free(text);
+    return set;
+}
+
+LightSet* load_light_file(const char* filename) {
+    // Anything that does not start like a light file is treated as CSV
+    char magic[sizeof(LIGHT_FILE_MAGIC) - 1] = { 0 };
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    size_t count = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    if (count == sizeof(magic) && memcmp(magic, LIGHT_FILE_MAGIC, sizeof(magic)) == 0) {
+        return map_light_file(filename);
+    }
+    return read_light_csv(filename);
+}
+
+void free_light_set(LightSet* set) {
+    if (set->mapping != NULL) {
+        munmap(set->mapping, set->mapping_length);
+    }
+    else {
+        raycast_free(set->lights);
+    }
+    raycast_free(set);
+}
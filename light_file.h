@@ -0,0 +1,94 @@
+#ifndef __LIGHT_FILE_H__
+#define __LIGHT_FILE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "raycaster_util.h"
+
+/*
+ * Light lists.
+ *
+ * Lights can be loaded from two formats:
+ *
+ * - Native light files: a LightFileHeader followed directly by `count` `Light`
+ *   records in the raycaster's in-memory layout and native byte order. The
+ *   file is mapped and its records used in place, so loading costs no parsing
+ *   or copying whatever the light count.
+ *
+ * - CSV: one light per line as `x,y,red,green,blue,strength`. Blank lines and
+ *   lines starting with `#` are ignored, as is a header line (a first line that
+ *   does not start with a number).
+ */
+
+#define LIGHT_FILE_MAGIC "RAYLIGHT"
+#define LIGHT_FILE_VERSION 1
+// Written into every header so files from a different-endian host are refused
+#define LIGHT_FILE_BYTE_ORDER 0x01020304
+
+/*
+ * The fixed header at the start of every light file. Its size keeps the
+ * records that follow it aligned.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    // sizeof(Light) on the writing host, so differently-padded layouts are refused
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t count;
+} LightFileHeader;
+
+/*
+ * A loaded list of lights, ready to pass to any raycast function.
+ */
+typedef struct {
+    Light* lights;
+    int count;
+
+    // Non-NULL when `lights` points into a mapped light file
+    void* mapping;
+    size_t mapping_length;
+} LightSet;
+
+/*
+ * Save `count` lights to a native light file.
+ *
+ * Returns 0 on success and -1 if the file could not be written.
+ */
+int write_light_file(const char* filename, const Light* lights, int count);
+
+/*
+ * Save `count` lights as CSV, in the format `read_light_csv` reads. Strengths
+ * are written with enough digits to read back exactly.
+ *
+ * Returns 0 on success and -1 if the file could not be written.
+ */
+int write_light_csv(const char* filename, const Light* lights, int count);
+
+/*
+ * Map a native light file. The lights may be modified; changes are private to
+ * this process and never written back. Returns NULL if the file is missing,
+ * truncated or not a light file from a compatible host.
+ */
+LightSet* map_light_file(const char* filename);
+
+/*
+ * Parse a CSV light list. Returns NULL if the file cannot be read or any line
+ * is malformed.
+ */
+LightSet* read_light_csv(const char* filename);
+
+/*
+ * Load lights from either a native light file (which is mapped) or a CSV
+ * file (which is parsed). Returns NULL if the file cannot be loaded.
+ */
+LightSet* load_light_file(const char* filename);
+
+/*
+ * Deallocate a light set, unmapping its file if it has one.
+ */
+void free_light_set(LightSet* set);
+
+#endif // __LIGHT_FILE_H__
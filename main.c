@@ -1,25 +1,440 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "alloc.h"
 #include "image.h"
+#include "light_file.h"
+#include "png_writer.h"
 #include "raycaster.h"
 #include "raycaster_util.h"
+#include "scene_file.h"
+#include "trace.h"
+
+/*
+ * Batch renderer.
+ *
+ * Usage: raycaster [--workers N] [--trace PATH] <manifest>
+ *        ("-" reads the manifest from stdin)
+ *
+ * The manifest lists one render job per line as whitespace-separated
+ * `key=value` fields; blank lines and lines starting with `#` are ignored.
+ *
+ *   scene=PATH      scene to render, a PNG or a native scene file (required)
+ *   output=PATH     PNG to write (required)
+ *   engine=NAME     sequential, lights or rows (default sequential)
+ *   threads=N       threads the engine and the PNG encoder may use (default 1)
+ *   level=N         PNG compression level, 0-9 (default 6)
+ *   light=X,Y,R,G,B,STRENGTH
+ *                   a light; repeat the field for more lights
+ *   lights=PATH     add every light in a light file (native or CSV, see
+ *                   light_file.h)
+ *   heatmap=PATH    also write a PNG of the ray steps traced for each pixel
+ *                   (rendered with the sequential engine's rules, so only
+ *                   engine=sequential may be given with it)
+ *
+ * For example, to render `images/large_empty.png` with four lights:
+ *
+ *   scene=images/large_empty.png engine=rows threads=4 output=cool.png light=0,0,255,0,0,100 light=32,32,0,0,255,100 light=128,128,0,255,0,100 light=300,300,255,255,255,100
+ *
+ * Every distinct scene is loaded and prepared once, and released after its
+ * last job. Jobs run on a pool of `--workers` threads (by default one per
+ * CPU), so one job's decode, another's render and a third's encode overlap.
+ * A job's `threads` are capped so that the workers together use no more
+ * threads than there are CPUs.
+ *
+ * `--trace PATH` records a timeline of every thread's loads, render phases and
+ * encodes, and writes it to PATH as Chrome trace JSON (see trace.h).
+ */
+
+#define DEFAULT_LEVEL PNG_LEVEL_DEFAULT
 
-int main(void) {
-    // Scene setup identical to test_cool_lights
-    Image* scene = read_image("images/large_empty.png");
-    Light lights[4];
-    lights[0] = (Light){ (Color) { 255, 0, 0 }, 100.0, (PixelLocation) { 0, 0 } };
-    lights[1] = (Light){ (Color) { 0, 0, 255 }, 100.0, (PixelLocation) { 32, 32 } };
-    lights[2] = (Light){ (Color) { 0, 255, 0 }, 100.0, (PixelLocation) { 128, 128 } };
-    lights[3] = (Light){ (Color) { 255, 255, 255 }, 100.0, (PixelLocation) { 300, 300 } };
+typedef enum {
+    SCENE_UNLOADED,
+    SCENE_LOADING,
+    SCENE_READY,
+    SCENE_FAILED,
+} SceneState;
 
-    int light_count = 4;
+/*
+ * A scene shared by every job that renders it.
+ */
+typedef struct {
+    char* path;
+    SceneState state;
+    PreparedScene* prepared;
+    int pending_jobs; // jobs that have not finished with the scene yet
+} SceneEntry;
 
-    Image* output = raycast_sequential(scene, lights, light_count);
-    write_image("images/test_references/cool_lights_test.png", output);
+typedef struct {
+    int line;
+    int scene;
+    RaycastEngine engine;
+    int threads;
+    int level;
+    char* output;
+    char* heatmap;
+    Light* lights;
+    int light_count;
+} Job;
 
-    free_image(scene);
-    free_image(output);
+typedef struct {
+    SceneEntry* scenes;
+    int scene_count;
+    Job* jobs;
+    int job_count;
+    int next_job;
+    int failures;
+    int max_job_threads; // most threads one job may use
+    pthread_mutex_t lock;
+    pthread_cond_t scene_loaded;
+} Batch;
 
+// Returns the index of the scene with the given path, adding it if it is new.
+static int intern_scene(Batch* batch, const char* path) {
+    for (int i = 0; i < batch->scene_count; i++) {
+        if (strcmp(batch->scenes[i].path, path) == 0) {
+            return i;
+        }
+    }
+    batch->scenes = realloc(batch->scenes,
+                            sizeof(SceneEntry) * (batch->scene_count + 1));
+    batch->scenes[batch->scene_count] = (SceneEntry){
+        .path = strdup(path),
+        .state = SCENE_UNLOADED,
+        .prepared = NULL,
+        .pending_jobs = 0,
+    };
+    return batch->scene_count++;
+}
+
+// Parse a `light=` value. Returns 0 on success and -1 on malformed input.
+static int parse_light(const char* text, Light* light) {
+    unsigned int x, y, red, green, blue;
+    double strength;
+    char extra;
+    if (sscanf(text, "%u,%u,%u,%u,%u,%lf%c", &x, &y, &red, &green, &blue,
+               &strength, &extra) != 6 ||
+        red > 255 || green > 255 || blue > 255) {
+        return -1;
+    }
+    *light = (Light){ (Color){ red, green, blue }, strength, (PixelLocation){ x, y } };
     return 0;
-}
\ No newline at end of file
+}
+
+// Parse one manifest line into `job`. Returns 0 on success, 1 for a line with
+// no job, and -1 (after printing an error) for a malformed line.
+static int parse_job(Batch* batch, char* text, int line, Job* job) {
+    *job = (Job){ .line = line, .scene = -1, .engine = ENGINE_SEQUENTIAL,
+                  .threads = 1, .level = DEFAULT_LEVEL };
+    int light_capacity = 0;
+    const char* scene = NULL;
+
+    for (char* field = strtok(text, " \t\r\n"); field != NULL;
+         field = strtok(NULL, " \t\r\n")) {
+        if (field[0] == '#') {
+            break;
+        }
+        char* value = strchr(field, '=');
+        if (value == NULL) {
+            fprintf(stderr, "line %d: expected key=value, got '%s'\n", line, field);
+            return -1;
+        }
+        *value++ = '\0';
+
+        if (strcmp(field, "scene") == 0) {
+            scene = value;
+        }
+        else if (strcmp(field, "output") == 0) {
+            free(job->output);
+            job->output = strdup(value);
+        }
+        else if (strcmp(field, "heatmap") == 0) {
+            free(job->heatmap);
+            job->heatmap = strdup(value);
+        }
+        else if (strcmp(field, "engine") == 0) {
+            int engine = raycast_engine_parse(value);
+            if (engine < 0) {
+                fprintf(stderr, "line %d: unknown engine '%s'\n", line, value);
+                return -1;
+            }
+            job->engine = engine;
+        }
+        else if (strcmp(field, "threads") == 0) {
+            job->threads = atoi(value);
+            if (job->threads < 1) {
+                fprintf(stderr, "line %d: threads must be positive\n", line);
+                return -1;
+            }
+        }
+        else if (strcmp(field, "level") == 0) {
+            job->level = atoi(value);
+        }
+        else if (strcmp(field, "light") == 0) {
+            if (job->light_count == light_capacity) {
+                light_capacity = light_capacity ? light_capacity * 2 : 4;
+                job->lights = realloc(job->lights, sizeof(Light) * light_capacity);
+            }
+            if (parse_light(value, &job->lights[job->light_count]) != 0) {
+                fprintf(stderr, "line %d: malformed light '%s'\n", line, value);
+                return -1;
+            }
+            job->light_count++;
+        }
+        else if (strcmp(field, "lights") == 0) {
+            LightSet* set = load_light_file(value);
+            if (set == NULL) {
+                fprintf(stderr, "line %d: cannot load lights from %s\n", line, value);
+                return -1;
+            }
+            if (job->light_count + set->count > light_capacity) {
+                light_capacity = job->light_count + set->count;
+                job->lights = realloc(job->lights, sizeof(Light) * light_capacity);
+            }
+            memcpy(job->lights + job->light_count, set->lights,
+                   sizeof(Light) * set->count);
+            job->light_count += set->count;
+            free_light_set(set);
+        }
+        else {
+            fprintf(stderr, "line %d: unknown field '%s'\n", line, field);
+            return -1;
+        }
+    }
+
+    if (scene == NULL && job->output == NULL && job->light_count == 0) {
+        return 1;
+    }
+    if (scene == NULL || job->output == NULL) {
+        fprintf(stderr, "line %d: a job needs a scene and an output\n", line);
+        return -1;
+    }
+    if (job->heatmap != NULL && job->engine != ENGINE_SEQUENTIAL) {
+        fprintf(stderr, "line %d: heatmap renders with the sequential engine, not %s\n",
+                line, raycast_engine_name(job->engine));
+        return -1;
+    }
+    job->scene = intern_scene(batch, scene);
+    return 0;
+}
+
+static void free_job(Job* job) {
+    free(job->output);
+    free(job->heatmap);
+    free(job->lights);
+}
+
+// Read every job in the manifest. Returns 0 on success and -1 on any error.
+static int read_manifest(Batch* batch, FILE* manifest) {
+    char* text = NULL;
+    size_t capacity = 0;
+    int line = 0;
+    int job_capacity = 0;
+    int error = 0;
+
+    while (getline(&text, &capacity, manifest) != -1) {
+        line++;
+        Job job;
+        int result = parse_job(batch, text, line, &job);
+        if (result != 0) {
+            free_job(&job);
+            error |= result < 0;
+            continue;
+        }
+        if (batch->job_count == job_capacity) {
+            job_capacity = job_capacity ? job_capacity * 2 : 16;
+            batch->jobs = realloc(batch->jobs, sizeof(Job) * job_capacity);
+        }
+        batch->jobs[batch->job_count++] = job;
+        batch->scenes[job.scene].pending_jobs++;
+    }
+
+    free(text);
+    return error ? -1 : 0;
+}
+
+// Get a job's scene, loading it on this thread if no other worker has.
+static PreparedScene* acquire_scene(Batch* batch, SceneEntry* entry) {
+    pthread_mutex_lock(&batch->lock);
+    while (entry->state == SCENE_LOADING) {
+        pthread_cond_wait(&batch->scene_loaded, &batch->lock);
+    }
+    if (entry->state == SCENE_UNLOADED) {
+        entry->state = SCENE_LOADING;
+        pthread_mutex_unlock(&batch->lock);
+
+        TraceSpan span = trace_begin("load");
+        PreparedScene* prepared = load_scene_file(entry->path);
+        trace_end(span);
+
+        pthread_mutex_lock(&batch->lock);
+        entry->prepared = prepared;
+        entry->state = prepared != NULL ? SCENE_READY : SCENE_FAILED;
+        pthread_cond_broadcast(&batch->scene_loaded);
+    }
+    PreparedScene* prepared = entry->prepared;
+    pthread_mutex_unlock(&batch->lock);
+    return prepared;
+}
+
+// Finish with a job's scene, freeing it after its last job.
+static void release_scene(Batch* batch, SceneEntry* entry) {
+    PreparedScene* unused = NULL;
+    pthread_mutex_lock(&batch->lock);
+    if (--entry->pending_jobs == 0) {
+        unused = entry->prepared;
+        entry->prepared = NULL;
+    }
+    pthread_mutex_unlock(&batch->lock);
+    if (unused != NULL) {
+        free_prepared_scene(unused);
+    }
+}
+
+static int run_job(Batch* batch, Job* job) {
+    SceneEntry* entry = &batch->scenes[job->scene];
+    PreparedScene* prepared = acquire_scene(batch, entry);
+    if (prepared == NULL) {
+        fprintf(stderr, "line %d: cannot load scene %s\n", job->line, entry->path);
+        release_scene(batch, entry);
+        return -1;
+    }
+
+    int threads = job->threads < batch->max_job_threads ? job->threads
+                                                        : batch->max_job_threads;
+    Image* cast;
+    Image* heatmap = NULL;
+    if (job->heatmap != NULL) {
+        Image* scene = prepared_scene_image(prepared);
+        uint32_t* cost =
+            raycast_malloc(sizeof(uint32_t) * scene->width * scene->height);
+        cast = raycast_prepared_cost(prepared, job->lights, job->light_count,
+                                     threads, cost);
+        heatmap = cost_heatmap(cost, scene->width, scene->height);
+        raycast_free(cost);
+    }
+    else {
+        cast = raycast_prepared(prepared, job->engine, job->lights,
+                                job->light_count, threads);
+    }
+    release_scene(batch, entry);
+
+    int error = write_image_parallel(job->output, cast, job->level, threads);
+    if (error) {
+        fprintf(stderr, "line %d: cannot write %s\n", job->line, job->output);
+    }
+    if (heatmap != NULL) {
+        if (write_image_parallel(job->heatmap, heatmap, job->level, threads)) {
+            fprintf(stderr, "line %d: cannot write %s\n", job->line, job->heatmap);
+            error = -1;
+        }
+        free_image(heatmap);
+    }
+    free_image(cast);
+    return error;
+}
+
+static void* batch_worker(void* arg) {
+    Batch* batch = (Batch*)arg;
+    while (1) {
+        pthread_mutex_lock(&batch->lock);
+        int index = batch->next_job++;
+        pthread_mutex_unlock(&batch->lock);
+        if (index >= batch->job_count) {
+            return NULL;
+        }
+        if (run_job(batch, &batch->jobs[index]) != 0) {
+            pthread_mutex_lock(&batch->lock);
+            batch->failures++;
+            pthread_mutex_unlock(&batch->lock);
+        }
+    }
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "usage: %s [--workers N] [--trace PATH] <manifest | ->\n",
+            program);
+}
+
+int main(int argc, char** argv) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long workers = cpus;
+    const char* trace_path = NULL;
+    int arg = 1;
+    while (arg + 1 < argc && strncmp(argv[arg], "--", 2) == 0) {
+        if (strcmp(argv[arg], "--workers") == 0) {
+            workers = atol(argv[arg + 1]);
+        }
+        else if (strcmp(argv[arg], "--trace") == 0) {
+            trace_path = argv[arg + 1];
+        }
+        else {
+            break;
+        }
+        arg += 2;
+    }
+    if (argc - arg != 1 || workers < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    FILE* manifest = strcmp(argv[arg], "-") == 0 ? stdin : fopen(argv[arg], "r");
+    if (manifest == NULL) {
+        fprintf(stderr, "%s: cannot open %s\n", argv[0], argv[arg]);
+        return 1;
+    }
+
+    Batch batch = { 0 };
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.scene_loaded, NULL);
+    int error = read_manifest(&batch, manifest);
+    if (manifest != stdin) {
+        fclose(manifest);
+    }
+
+    if (trace_path != NULL) {
+        trace_start();
+    }
+    if (!error) {
+        int num_threads = workers < batch.job_count ? workers : batch.job_count;
+        batch.max_job_threads = num_threads < cpus ? cpus / num_threads : 1;
+        pthread_t* threads = malloc(sizeof(pthread_t) * (num_threads + 1));
+        for (int i = 0; i < num_threads; i++) {
+            pthread_create(&threads[i], NULL, batch_worker, &batch);
+        }
+        for (int i = 0; i < num_threads; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+        if (batch.failures > 0) {
+            fprintf(stderr, "%d of %d jobs failed\n", batch.failures, batch.job_count);
+            error = 1;
+        }
+    }
+
+    if (trace_path != NULL) {
+        trace_stop();
+        if (trace_write(trace_path) != 0) {
+            fprintf(stderr, "%s: cannot write %s\n", argv[0], trace_path);
+            error = 1;
+        }
+    }
+
+    for (int i = 0; i < batch.job_count; i++) {
+        free_job(&batch.jobs[i]);
+    }
+    for (int i = 0; i < batch.scene_count; i++) {
+        free(batch.scenes[i].path);
+    }
+    free(batch.jobs);
+    free(batch.scenes);
+    pthread_mutex_destroy(&batch.lock);
+    pthread_cond_destroy(&batch.scene_loaded);
+
+    return error ? 1 : 0;
+}
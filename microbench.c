@@ -0,0 +1,439 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "image.h"
+#include "raycaster_util.h"
+#include "step_kernels.h"
+
+/*
+ * Kernel microbenchmarks.
+ *
+ * Usage: microbench [options]
+ *
+ *   --kernels LIST     kernels to time (default all): step, direction_pair,
+ *                      illuminate, is_obstacle, add_colors, mul_colors,
+ *                      scale_color
+ *   --scene PATH       PNG the inputs are drawn from (default images/large.png)
+ *   --ops N            calls per timed pass (default 1048576)
+ *   --repeats N        timed passes per variant; the fastest is reported
+ *                      (default 5)
+ *   --seed N           seed for the input generator (default 1)
+ *   --format FORMAT    text or csv (default text)
+ *
+ * Each kernel is timed in isolation over inputs shaped like a real render's:
+ * rays between random open pixels and random lights in the scene, the
+ * positions `step` visits along them, the scene's own colors and the
+ * illumination those lights produce. Inputs are generated once, so every
+ * variant of a kernel sees exactly the same calls.
+ *
+ * To A/B an alternative implementation, write it below with the same
+ * signature as the `KernelRun` for its kernel and add a row to `variants`.
+ * The first row for a kernel is its baseline: every other variant is reported
+ * relative to it, along with how many of its results differ from the
+ * baseline's, so a faster variant that is not bit-identical is obvious.
+ */
+
+#define DEFAULT_OPS (1 << 20)
+#define DEFAULT_REPEATS 5
+
+// The inputs every kernel draws from, `count` of each.
+typedef struct {
+    size_t count;
+    // step: a position along a ray and the ray's direction
+    Pair* positions;
+    Pair* directions;
+    // direction_pair: a pixel and a light
+    PixelLocation* starts;
+    PixelLocation* ends;
+    // illuminate: a light and the pixel it lights
+    Light* lights;
+    PixelLocation* pixels;
+    // is_obstacle and mul_colors: scene colors
+    Color* scene_colors;
+    // add_colors, mul_colors and scale_color: illumination from one light,
+    // and the illumination scale it came from
+    Color* illuminations;
+    float* scales;
+} Inputs;
+
+/*
+ * Runs one kernel over every input, storing a fingerprint of each result in
+ * `out` so that variants can be compared bit for bit.
+ */
+typedef void (*KernelRun)(const Inputs* inputs, uint64_t* out);
+
+typedef struct {
+    const char* kernel;
+    const char* variant;
+    KernelRun run;
+} Variant;
+
+static uint64_t double_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static uint64_t color_bits(Color color) {
+    return (uint64_t)color.red << 16 | (uint64_t)color.green << 8 | color.blue;
+}
+
+// Baselines: the library's own implementations
+
+static void run_step(const Inputs* inputs, uint64_t* out) {
+    for (size_t i = 0; i < inputs->count; i++) {
+        Pair pos = inputs->positions[i];
+        PixelLocation next = step(&pos, inputs->directions[i]);
+        out[i] = ((uint64_t)next.x << 32 | next.y) ^ double_bits(pos.x) ^
+                 (double_bits(pos.y) << 1);
+    }
+}
+
+static void run_direction_pair(const Inputs* inputs, uint64_t* out) {
+    for (size_t i = 0; i < inputs->count; i++) {
+        Pair direction = direction_pair(inputs->starts[i], inputs->ends[i]);
+        out[i] = double_bits(direction.x) ^ (double_bits(direction.y) << 1);
+    }
+}
+
+static void run_illuminate(const Inputs* inputs, uint64_t* out) {
+    for (size_t i = 0; i < inputs->count; i++) {
+        out[i] = color_bits(
+            illuminate(inputs->lights[i], inputs->pixels[i].x, inputs->pixels[i].y));
+    }
+}
+
+static void run_is_obstacle(const Inputs* inputs, uint64_t* out) {
+    for (size_t i = 0; i < inputs->count; i++) {
+        out[i] = is_obstacle(inputs->scene_colors[i]);
+    }
+}
+
+static void run_add_colors(const Inputs* inputs, uint64_t* out) {
+    // Accumulate like a pixel summing its lights, restarting every few lights
+    Color total = BLACK;
+    for (size_t i = 0; i < inputs->count; i++) {
+        if (i % 8 == 0) {
+            total = (Color){ 0, 0, 0 };
+        }
+        total = add_colors(total, inputs->illuminations[i]);
+        out[i] = color_bits(total);
+    }
+}
+
+static void run_mul_colors(const Inputs* inputs, uint64_t* out) {
+    for (size_t i = 0; i < inputs->count; i++) {
+        out[i] = color_bits(mul_colors(inputs->illuminations[i], inputs->scene_colors[i]));
+    }
+}
+
+static void run_scale_color(const Inputs* inputs, uint64_t* out) {
+    for (size_t i = 0; i < inputs->count; i++) {
+        out[i] = color_bits(scale_color(inputs->lights[i].color, inputs->scales[i]));
+    }
+}
+
+// Alternatives
+
+// `step` through the kernel for each ray's direction, chosen once per ray as
+// the engines do (consecutive inputs along one ray share its direction)
+static void run_step_kernels(const Inputs* inputs, uint64_t* out) {
+    StepFunction function = step;
+    Pair direction = { 0, 0 };
+    for (size_t i = 0; i < inputs->count; i++) {
+        if (inputs->directions[i].x != direction.x ||
+            inputs->directions[i].y != direction.y) {
+            direction = inputs->directions[i];
+            function = step_kernel_function(step_kernel(direction));
+        }
+        Pair pos = inputs->positions[i];
+        PixelLocation next = function(&pos, direction);
+        out[i] = ((uint64_t)next.x << 32 | next.y) ^ double_bits(pos.x) ^
+                 (double_bits(pos.y) << 1);
+    }
+}
+
+// Saturating integer addition; the sums are exact either way
+static void run_add_colors_int(const Inputs* inputs, uint64_t* out) {
+    Color total = BLACK;
+    for (size_t i = 0; i < inputs->count; i++) {
+        if (i % 8 == 0) {
+            total = (Color){ 0, 0, 0 };
+        }
+        Color add = inputs->illuminations[i];
+        unsigned int red = total.red + add.red;
+        unsigned int green = total.green + add.green;
+        unsigned int blue = total.blue + add.blue;
+        total = (Color){ red > 255 ? 255 : red, green > 255 ? 255 : green,
+                         blue > 255 ? 255 : blue };
+        out[i] = color_bits(total);
+    }
+}
+
+static const Variant variants[] = {
+    { "step", "baseline", run_step },
+    { "step", "kernels", run_step_kernels },
+    { "direction_pair", "baseline", run_direction_pair },
+    { "illuminate", "baseline", run_illuminate },
+    { "is_obstacle", "baseline", run_is_obstacle },
+    { "add_colors", "baseline", run_add_colors },
+    { "add_colors", "int", run_add_colors_int },
+    { "mul_colors", "baseline", run_mul_colors },
+    { "scale_color", "baseline", run_scale_color },
+};
+
+#define VARIANT_COUNT (int)(sizeof(variants) / sizeof(variants[0]))
+
+// xorshift64*, so inputs are identical on every host for a given seed
+static uint64_t next_random(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static unsigned int random_below(uint64_t* state, unsigned int bound) {
+    return next_random(state) % bound;
+}
+
+static PixelLocation random_open_pixel(const Image* scene, uint64_t* state) {
+    while (1) {
+        PixelLocation pixel = { random_below(state, scene->width),
+                                random_below(state, scene->height) };
+        if (!is_obstacle(scene->pixels[(size_t)pixel.y * scene->width + pixel.x])) {
+            return pixel;
+        }
+    }
+}
+
+/*
+ * Generate `count` inputs of every kind from `scene`. Returns -1 if the scene
+ * has no open pixels to place lights on.
+ */
+static int generate_inputs(const Image* scene, size_t count, uint64_t seed,
+                           Inputs* inputs) {
+    *inputs = (Inputs){
+        .count = count,
+        .positions = malloc(sizeof(Pair) * count),
+        .directions = malloc(sizeof(Pair) * count),
+        .starts = malloc(sizeof(PixelLocation) * count),
+        .ends = malloc(sizeof(PixelLocation) * count),
+        .lights = malloc(sizeof(Light) * count),
+        .pixels = malloc(sizeof(PixelLocation) * count),
+        .scene_colors = malloc(sizeof(Color) * count),
+        .illuminations = malloc(sizeof(Color) * count),
+        .scales = malloc(sizeof(float) * count),
+    };
+    size_t pixel_count = (size_t)scene->width * scene->height;
+    size_t open_count = 0;
+    for (size_t i = 0; i < pixel_count; i++) {
+        open_count += !is_obstacle(scene->pixels[i]);
+    }
+    if (open_count == 0) {
+        return -1;
+    }
+
+    uint64_t state = seed * 0x9E3779B97F4A7C15ULL + 1;
+    for (size_t i = 0; i < count; i++) {
+        PixelLocation pixel = random_open_pixel(scene, &state);
+        PixelLocation light_pixel = random_open_pixel(scene, &state);
+        inputs->starts[i] = pixel;
+        inputs->ends[i] = light_pixel;
+
+        // Colors and strengths spanning dim to bright lights
+        Color color = { random_below(&state, 256), random_below(&state, 256),
+                        random_below(&state, 256) };
+        double strength = 10.0 * pow(100.0, random_below(&state, 1000) / 1000.0);
+        inputs->lights[i] = (Light){ color, strength, light_pixel };
+        inputs->pixels[i] = pixel;
+
+        int dx = (int)pixel.x - (int)light_pixel.x;
+        int dy = (int)pixel.y - (int)light_pixel.y;
+        inputs->scales[i] = exp(-(dx * dx + dy * dy) / strength);
+        inputs->illuminations[i] = illuminate(inputs->lights[i], pixel.x, pixel.y);
+        inputs->scene_colors[i] = scene->pixels[random_below(&state, pixel_count)];
+    }
+
+    // Positions `step` actually visits: walk rays from random pixels towards
+    // random lights until they arrive or leave the scene, recording each call
+    size_t recorded = 0;
+    while (recorded < count) {
+        PixelLocation start = random_open_pixel(scene, &state);
+        PixelLocation end = random_open_pixel(scene, &state);
+        if (start.x == end.x && start.y == end.y) {
+            continue;
+        }
+        Pair direction = direction_pair(start, end);
+        Pair pos = center_point(start.x, start.y);
+        PixelLocation current = start;
+        while (recorded < count && !(current.x == end.x && current.y == end.y) &&
+               current.x < scene->width && current.y < scene->height) {
+            inputs->positions[recorded] = pos;
+            inputs->directions[recorded] = direction;
+            recorded++;
+            current = step(&pos, direction);
+        }
+    }
+    return 0;
+}
+
+static void free_inputs(Inputs* inputs) {
+    free(inputs->positions);
+    free(inputs->directions);
+    free(inputs->starts);
+    free(inputs->ends);
+    free(inputs->lights);
+    free(inputs->pixels);
+    free(inputs->scene_colors);
+    free(inputs->illuminations);
+    free(inputs->scales);
+}
+
+static double now_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+// Time `repeats` passes of a variant, returning the fastest in ns per call.
+static double time_variant(const Variant* variant, const Inputs* inputs,
+                           int repeats, uint64_t* out) {
+    // One untimed pass to fault in `out` and warm the caches
+    variant->run(inputs, out);
+    double best = INFINITY;
+    for (int i = 0; i < repeats; i++) {
+        double start = now_ns();
+        variant->run(inputs, out);
+        double elapsed = now_ns() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+    return best / inputs->count;
+}
+
+// Returns 1 if `kernel` is in the comma-separated `list`, or if there is none.
+static int kernel_selected(const char* list, const char* kernel) {
+    if (list == NULL) {
+        return 1;
+    }
+    size_t length = strlen(kernel);
+    for (const char* item = list; item != NULL; item = strchr(item, ',')) {
+        item += *item == ',';
+        if (strncmp(item, kernel, length) == 0 &&
+            (item[length] == ',' || item[length] == '\0')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [--kernels LIST] [--scene PATH] [--ops N] [--repeats N]\n"
+            "       [--seed N] [--format text|csv]\n",
+            program);
+}
+
+int main(int argc, char** argv) {
+    const char* kernels = NULL;
+    const char* scene_path = "images/large.png";
+    long ops = DEFAULT_OPS;
+    int repeats = DEFAULT_REPEATS;
+    unsigned long seed = 1;
+    int csv = 0;
+    for (int arg = 1; arg < argc; arg++) {
+        if (arg + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+        const char* option = argv[arg];
+        const char* value = argv[++arg];
+        if (strcmp(option, "--kernels") == 0) {
+            kernels = value;
+        }
+        else if (strcmp(option, "--scene") == 0) {
+            scene_path = value;
+        }
+        else if (strcmp(option, "--ops") == 0) {
+            ops = atol(value);
+        }
+        else if (strcmp(option, "--repeats") == 0) {
+            repeats = atoi(value);
+        }
+        else if (strcmp(option, "--seed") == 0) {
+            seed = strtoul(value, NULL, 10);
+        }
+        else if (strcmp(option, "--format") == 0 &&
+                 (strcmp(value, "text") == 0 || strcmp(value, "csv") == 0)) {
+            csv = strcmp(value, "csv") == 0;
+        }
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (ops < 1 || repeats < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    Image* scene = read_image(scene_path);
+    if (scene == NULL) {
+        fprintf(stderr, "%s: cannot read image %s\n", argv[0], scene_path);
+        return 1;
+    }
+    Inputs inputs;
+    if (generate_inputs(scene, ops, seed, &inputs) != 0) {
+        fprintf(stderr, "%s: %s has no open pixels\n", argv[0], scene_path);
+        free_inputs(&inputs);
+        free_image(scene);
+        return 1;
+    }
+
+    uint64_t* baseline = malloc(sizeof(uint64_t) * ops);
+    uint64_t* out = malloc(sizeof(uint64_t) * ops);
+    double baseline_ns = 0;
+    if (csv) {
+        printf("kernel,variant,ns_per_op,relative,mismatches\n");
+    }
+    else {
+        printf("%-16s %-12s %10s %9s %11s\n", "kernel", "variant", "ns/op",
+               "relative", "mismatches");
+    }
+    for (int v = 0; v < VARIANT_COUNT; v++) {
+        const Variant* variant = &variants[v];
+        if (!kernel_selected(kernels, variant->kernel)) {
+            continue;
+        }
+        int is_baseline = v == 0 || strcmp(variants[v - 1].kernel, variant->kernel) != 0;
+        double ns = time_variant(variant, &inputs, repeats, is_baseline ? baseline : out);
+        long mismatches = 0;
+        if (is_baseline) {
+            baseline_ns = ns;
+        }
+        else {
+            for (long i = 0; i < ops; i++) {
+                mismatches += out[i] != baseline[i];
+            }
+        }
+        if (csv) {
+            printf("%s,%s,%.3f,%.3f,%ld\n", variant->kernel, variant->variant, ns,
+                   ns / baseline_ns, mismatches);
+        }
+        else {
+            printf("%-16s %-12s %10.2f %8.2fx %11ld\n", variant->kernel,
+                   variant->variant, ns, ns / baseline_ns, mismatches);
+        }
+    }
+
+    free(baseline);
+    free(out);
+    free_inputs(&inputs);
+    free_image(scene);
+    return 0;
+}
@@ -0,0 +1,203 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "out_of_core.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "trace.h"
+
+// Read exactly `length` bytes at `offset`. Returns 0 on success, -1 otherwise.
+static int read_fully(int fd, void* data, size_t length, uint64_t offset) {
+    char* bytes = (char*)data;
+    while (length > 0) {
+        ssize_t count = pread(fd, bytes, length, offset);
+        if (count <= 0) {
+            return -1;
+        }
+        bytes += count;
+        length -= count;
+        offset += count;
+    }
+    return 0;
+}
+
+// Write exactly `length` bytes at `offset`. Returns 0 on success, -1 otherwise.
+static int write_fully(int fd, const void* data, size_t length,
+                       uint64_t offset) {
+    const char* bytes = (const char*)data;
+    while (length > 0) {
+        ssize_t count = pwrite(fd, bytes, length, offset);
+        if (count <= 0) {
+            return -1;
+        }
+        bytes += count;
+        length -= count;
+        offset += count;
+    }
+    return 0;
+}
+
+// Size of a tile's halo window along one axis, clipped to the scene.
+static size_t window_extent(int tile, int halo, int scene) {
+    size_t extent = (size_t)tile + 2 * (size_t)halo;
+    return extent < (size_t)scene ? extent : (size_t)scene;
+}
+
+// Bytes needed to render one `tile` x `tile` output tile: the halo window,
+// what preparing it allocates, the output tile and the render's own buffers.
+static size_t tile_working_set(int tile, int halo, int width, int height,
+                               int max_threads) {
+    size_t window_width = window_extent(tile, halo, width);
+    size_t window_height = window_extent(tile, halo, height);
+    return sizeof(Color) * window_width * window_height +
+           scene_window_bytes(window_width, window_height) +
+           sizeof(Color) * tile * tile + render_region_bytes(max_threads);
+}
+
+int raycast_out_of_core(const char* scene_path, const char* output_path,
+                        Light* lights, int light_count, size_t memory_budget,
+                        int max_threads) {
+    int fd = open(scene_path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat info;
+    SceneFileHeader header;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(header) ||
+        read_fully(fd, &header, sizeof(header), 0) != 0 ||
+        !scene_header_valid(&header, info.st_size)) {
+        close(fd);
+        return -1;
+    }
+    int width = header.width;
+    int height = header.height;
+
+    // The halo is the farthest any light reaches, but never more than the scene
+    unsigned int* radii = raycast_malloc(sizeof(unsigned int) * (light_count + 1));
+    unsigned int reach = 0;
+    for (int l = 0; l < light_count; l++) {
+        radii[l] = light_radius(lights[l]);
+        if (radii[l] > reach) {
+            reach = radii[l];
+        }
+    }
+    int longest_side = width > height ? width : height;
+    int halo = reach < (unsigned int)longest_side ? (int)reach : longest_side;
+
+    // Pick the largest tile whose working set fits in what the light lists
+    // leave of the budget
+    size_t light_bytes = (sizeof(unsigned int) + sizeof(Light)) * (light_count + 1);
+    size_t tile_budget = memory_budget > light_bytes ? memory_budget - light_bytes : 0;
+    int low = 0;
+    int high = longest_side;
+    while (low < high) {
+        int middle = low + (high - low + 1) / 2;
+        if (tile_working_set(middle, halo, width, height, max_threads) <=
+            tile_budget) {
+            low = middle;
+        }
+        else {
+            high = middle - 1;
+        }
+    }
+    int tile = low;
+
+    int out_fd = -1;
+    if (tile > 0) {
+        out_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (out_fd < 0) {
+        raycast_free(radii);
+        close(fd);
+        return -1;
+    }
+    SceneFileHeader out_header = scene_file_header(width, height, 0);
+    int error = write_fully(out_fd, &out_header, sizeof(out_header), 0);
+    if (!error) {
+        error = ftruncate(out_fd, out_header.pixels_offset +
+                                      sizeof(Color) * (uint64_t)width * height);
+    }
+
+    // Buffers are sized for the largest tile and reused for every tile
+    Image window;
+    window.pixels = raycast_malloc(sizeof(Color) * window_extent(tile, halo, width) *
+                           window_extent(tile, halo, height));
+    Color* tile_pixels = raycast_malloc(sizeof(Color) * tile * tile);
+    Light* tile_lights = raycast_malloc(sizeof(Light) * (light_count + 1));
+
+    for (int tile_y = 0; tile_y < height && !error; tile_y += tile) {
+        int tile_height = tile < height - tile_y ? tile : height - tile_y;
+        for (int tile_x = 0; tile_x < width && !error; tile_x += tile) {
+            int tile_width = tile < width - tile_x ? tile : width - tile_x;
+            TraceSpan span = trace_begin("tile");
+
+            // Only lights that reach the tile matter. Skipping the rest is
+            // exact: they would add black to every pixel.
+            int tile_light_count = 0;
+            for (int l = 0; l < light_count; l++) {
+                double x_gap = axis_gap(lights[l].pixel.x, tile_x,
+                                        tile_x + tile_width);
+                double y_gap = axis_gap(lights[l].pixel.y, tile_y,
+                                        tile_y + tile_height);
+                if (x_gap * x_gap + y_gap * y_gap <=
+                    (double)radii[l] * radii[l]) {
+                    tile_lights[tile_light_count++] = lights[l];
+                }
+            }
+
+            // Stream in the tile and its halo
+            int window_x = tile_x - halo > 0 ? tile_x - halo : 0;
+            int window_y = tile_y - halo > 0 ? tile_y - halo : 0;
+            int window_end_x = tile_x + tile_width + halo < width
+                                   ? tile_x + tile_width + halo
+                                   : width;
+            int window_end_y = tile_y + tile_height + halo < height
+                                   ? tile_y + tile_height + halo
+                                   : height;
+            window.width = window_end_x - window_x;
+            window.height = window_end_y - window_y;
+            for (int y = window_y; y < window_end_y && !error; y++) {
+                error = read_fully(
+                    fd, window.pixels + (size_t)(y - window_y) * window.width,
+                    sizeof(Color) * window.width,
+                    header.pixels_offset +
+                        sizeof(Color) * ((uint64_t)y * width + window_x));
+            }
+            if (error) {
+                break;
+            }
+
+            PreparedScene* prepared = scene_prepare_window(
+                &window, window_x, window_y, width, height);
+            render_region(prepared, tile_lights, tile_light_count, tile_x,
+                          tile_y, tile_width, tile_height, tile_pixels,
+                          tile_width, max_threads);
+            free_prepared_scene(prepared);
+
+            // Stream the finished tile out
+            for (int y = 0; y < tile_height && !error; y++) {
+                error = write_fully(
+                    out_fd, tile_pixels + (size_t)y * tile_width,
+                    sizeof(Color) * tile_width,
+                    out_header.pixels_offset +
+                        sizeof(Color) *
+                            ((uint64_t)(tile_y + y) * width + tile_x));
+            }
+            trace_end_region(span, tile_x, tile_y, tile_width, tile_height);
+        }
+    }
+
+    raycast_free(window.pixels);
+    raycast_free(tile_pixels);
+    raycast_free(tile_lights);
+    raycast_free(radii);
+    close(fd);
+    error |= close(out_fd);
+    return error ? -1 : 0;
+}
@@ -0,0 +1,30 @@
+#ifndef __OUT_OF_CORE_H__
+#define __OUT_OF_CORE_H__
+
+#include <stddef.h>
+
+#include "raycaster_util.h"
+
+/*
+ * Render a scene too large to hold in memory.
+ *
+ * The scene is read from the native scene file `scene_path` (see scene_file.h)
+ * one tile at a time, and every finished tile is written straight into the
+ * scene file `output_path`, which holds just the rendered pixels and can be
+ * loaded with `map_scene_file`. Pixels match `raycast_sequential`.
+ *
+ * A light never affects pixels beyond its `light_radius`, so each output tile
+ * only needs the scene within that radius of it (its halo) and only the lights
+ * that reach it. The tile size is chosen so that the light lists and one
+ * tile's working set (halo pixels, their acceleration data, the output tile
+ * and the render threads' buffers) fit in `memory_budget` bytes, whatever the
+ * scene holds. Rows within a tile are rendered by up to `max_threads` threads.
+ *
+ * Returns 0 on success and -1 if a file cannot be read or written, or if even
+ * a single-pixel tile with its halo would exceed the memory budget.
+ */
+int raycast_out_of_core(const char* scene_path, const char* output_path,
+                        Light* lights, int light_count, size_t memory_budget,
+                        int max_threads);
+
+#endif // __OUT_OF_CORE_H__
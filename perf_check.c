@@ -0,0 +1,340 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Compare benchmark results against a baseline.
+ *
+ * Usage: perf_check [--threshold PERCENT] [--max-noise PERCENT]
+ *                   <baseline.json> <current.json>
+ *
+ * Both files are `timing --format json` output. Cases are matched by engine,
+ * scene, light count and thread count, and compared by their fastest render,
+ * which is the timing least disturbed by the rest of the machine.
+ *
+ * A case regresses when it got slower by more than the threshold (default
+ * 10%) plus the noise seen in either run. Noise is the median absolute
+ * deviation of a run's times as a percentage of its median, which a few
+ * disturbed iterations cannot inflate, and counts for at most
+ * `--max-noise` percent (default 5%). Noisy cases therefore need a somewhat
+ * bigger slowdown to fail, but no amount of noise hides a large one. Runs
+ * recorded before timing reported the deviation count as quiet.
+ *
+ * Prints a table of every case and exits with 1 if any case regressed or
+ * disappeared, and 0 otherwise.
+ */
+
+#define DEFAULT_THRESHOLD 10.0
+#define DEFAULT_MAX_NOISE 5.0
+
+typedef struct {
+    char engine[32];
+    char scene[256];
+    int lights;
+    int threads;
+    double min_ms;
+    double median_ms;
+    double mad_ms;
+} PerfCase;
+
+typedef struct {
+    PerfCase* cases;
+    int count;
+} PerfResults;
+
+static const char* skip_space(const char* text) {
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    return text;
+}
+
+/*
+ * Parse a JSON string into `value` (truncating it to `size` bytes). Returns
+ * the text after it, or NULL if it is malformed.
+ */
+static const char* parse_string(const char* text, char* value, size_t size) {
+    if (*text != '"') {
+        return NULL;
+    }
+    size_t length = 0;
+    for (text++; *text != '"'; text++) {
+        if (*text == '\0') {
+            return NULL;
+        }
+        if (*text == '\\' && *++text == '\0') {
+            return NULL;
+        }
+        if (length + 1 < size) {
+            value[length++] = *text;
+        }
+    }
+    value[length] = '\0';
+    return text + 1;
+}
+
+// Skip any JSON value. Returns the text after it, or NULL if it is malformed.
+static const char* skip_value(const char* text) {
+    text = skip_space(text);
+    if (*text == '"') {
+        char ignored[1];
+        return parse_string(text, ignored, sizeof(ignored));
+    }
+    if (*text == '{' || *text == '[') {
+        int depth = 0;
+        do {
+            if (*text == '"') {
+                char ignored[1];
+                if ((text = parse_string(text, ignored, sizeof(ignored))) == NULL) {
+                    return NULL;
+                }
+                continue;
+            }
+            if (*text == '\0') {
+                return NULL;
+            }
+            depth += (*text == '{' || *text == '[') - (*text == '}' || *text == ']');
+            text++;
+        } while (depth > 0);
+        return text;
+    }
+    char* end;
+    strtod(text, &end);
+    return end != text ? end : NULL;
+}
+
+/*
+ * Parse one benchmark object into `result`. Returns the text after it, or NULL
+ * if it is malformed.
+ */
+static const char* parse_case(const char* text, PerfCase* result) {
+    memset(result, 0, sizeof(*result));
+    text = skip_space(text);
+    if (*text++ != '{') {
+        return NULL;
+    }
+    while (1) {
+        text = skip_space(text);
+        if (*text == '}') {
+            return text + 1;
+        }
+        char key[64];
+        if ((text = parse_string(text, key, sizeof(key))) == NULL) {
+            return NULL;
+        }
+        text = skip_space(text);
+        if (*text++ != ':') {
+            return NULL;
+        }
+        text = skip_space(text);
+
+        if (strcmp(key, "engine") == 0) {
+            text = parse_string(text, result->engine, sizeof(result->engine));
+        }
+        else if (strcmp(key, "scene") == 0) {
+            text = parse_string(text, result->scene, sizeof(result->scene));
+        }
+        else if (strcmp(key, "lights") == 0 || strcmp(key, "threads") == 0 ||
+                 strcmp(key, "min_ms") == 0 || strcmp(key, "median_ms") == 0 ||
+                 strcmp(key, "mad_ms") == 0) {
+            char* end;
+            double value = strtod(text, &end);
+            if (end == text) {
+                return NULL;
+            }
+            text = end;
+            if (strcmp(key, "lights") == 0) {
+                result->lights = value;
+            }
+            else if (strcmp(key, "threads") == 0) {
+                result->threads = value;
+            }
+            else if (strcmp(key, "min_ms") == 0) {
+                result->min_ms = value;
+            }
+            else if (strcmp(key, "median_ms") == 0) {
+                result->median_ms = value;
+            }
+            else {
+                result->mad_ms = value;
+            }
+        }
+        else {
+            text = skip_value(text);
+        }
+        if (text == NULL) {
+            return NULL;
+        }
+
+        text = skip_space(text);
+        if (*text == ',') {
+            text++;
+        }
+        else if (*text != '}') {
+            return NULL;
+        }
+    }
+}
+
+/*
+ * Read the benchmarks from a `timing --format json` file. Returns -1 if the
+ * file cannot be read or is malformed.
+ */
+static int read_results(const char* filename, PerfResults* results) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    size_t capacity = 4096;
+    size_t length = 0;
+    char* text = malloc(capacity);
+    size_t count;
+    while ((count = fread(text + length, 1, capacity - length - 1, file)) > 0) {
+        length += count;
+        if (length + 1 == capacity) {
+            capacity *= 2;
+            text = realloc(text, capacity);
+        }
+    }
+    fclose(file);
+    text[length] = '\0';
+
+    results->cases = NULL;
+    results->count = 0;
+    const char* array = strstr(text, "\"benchmarks\"");
+    const char* cursor = array != NULL ? strchr(array, '[') : NULL;
+    int error = cursor == NULL;
+    if (!error) {
+        cursor = skip_space(cursor + 1);
+    }
+    while (!error && *cursor != ']') {
+        PerfCase result;
+        cursor = parse_case(cursor, &result);
+        if (cursor == NULL) {
+            error = 1;
+            break;
+        }
+        results->cases = realloc(results->cases, sizeof(PerfCase) * (results->count + 1));
+        results->cases[results->count++] = result;
+        cursor = skip_space(cursor);
+        if (*cursor == ',') {
+            cursor = skip_space(cursor + 1);
+        }
+        else if (*cursor != ']') {
+            error = 1;
+        }
+    }
+
+    free(text);
+    if (error) {
+        free(results->cases);
+        return -1;
+    }
+    return 0;
+}
+
+static const PerfCase* find_case(const PerfResults* results, const PerfCase* key) {
+    for (int i = 0; i < results->count; i++) {
+        const PerfCase* candidate = &results->cases[i];
+        if (strcmp(candidate->engine, key->engine) == 0 &&
+            strcmp(candidate->scene, key->scene) == 0 &&
+            candidate->lights == key->lights && candidate->threads == key->threads) {
+            return candidate;
+        }
+    }
+    return NULL;
+}
+
+// A case's median absolute deviation, as a percentage of its median.
+static double noise_percent(const PerfCase* result) {
+    return result->median_ms > 0 ? 100.0 * result->mad_ms / result->median_ms : 0;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [--threshold PERCENT] [--max-noise PERCENT] "
+            "<baseline.json> <current.json>\n",
+            program);
+}
+
+int main(int argc, char** argv) {
+    double threshold = DEFAULT_THRESHOLD;
+    double max_noise = DEFAULT_MAX_NOISE;
+    int arg = 1;
+    while (arg + 1 < argc && strncmp(argv[arg], "--", 2) == 0) {
+        if (strcmp(argv[arg], "--threshold") == 0) {
+            threshold = atof(argv[arg + 1]);
+        }
+        else if (strcmp(argv[arg], "--max-noise") == 0) {
+            max_noise = atof(argv[arg + 1]);
+        }
+        else {
+            break;
+        }
+        arg += 2;
+    }
+    if (argc - arg != 2 || threshold < 0 || max_noise < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    PerfResults baseline;
+    PerfResults current;
+    if (read_results(argv[arg], &baseline) != 0) {
+        fprintf(stderr, "%s: cannot read benchmarks from %s\n", argv[0], argv[arg]);
+        return 2;
+    }
+    if (read_results(argv[arg + 1], &current) != 0) {
+        fprintf(stderr, "%s: cannot read benchmarks from %s\n", argv[0], argv[arg + 1]);
+        free(baseline.cases);
+        return 2;
+    }
+
+    printf("%-10s %-28s %6s %7s %11s %11s %8s %8s  %s\n", "engine", "scene",
+           "lights", "threads", "base ms", "now ms", "delta", "allowed", "status");
+    int regressions = 0;
+    for (int i = 0; i < baseline.count; i++) {
+        const PerfCase* base = &baseline.cases[i];
+        const PerfCase* now = find_case(&current, base);
+        printf("%-10s %-28s %6d %7d %11.3f ", base->engine, base->scene,
+               base->lights, base->threads, base->min_ms);
+        if (now == NULL) {
+            printf("%11s %8s %8s  MISSING\n", "-", "-", "-");
+            regressions++;
+            continue;
+        }
+
+        double delta = 100.0 * (now->min_ms - base->min_ms) / base->min_ms;
+        double noise = noise_percent(base) > noise_percent(now) ? noise_percent(base)
+                                                                 : noise_percent(now);
+        double allowed = threshold + (noise < max_noise ? noise : max_noise);
+        const char* status = "ok";
+        if (delta > allowed) {
+            status = "REGRESSED";
+            regressions++;
+        }
+        else if (-delta > allowed) {
+            status = "faster";
+        }
+        printf("%11.3f %+7.1f%% %7.1f%%  %s\n", now->min_ms, delta, allowed, status);
+    }
+    for (int i = 0; i < current.count; i++) {
+        const PerfCase* now = &current.cases[i];
+        if (find_case(&baseline, now) == NULL) {
+            printf("%-10s %-28s %6d %7d %11s %11.3f %8s %8s  new\n", now->engine,
+                   now->scene, now->lights, now->threads, "-", now->min_ms, "-", "-");
+        }
+    }
+
+    if (regressions > 0) {
+        printf("\n%d of %d cases regressed beyond %.1f%% plus noise\n", regressions,
+               baseline.count, threshold);
+    }
+    else {
+        printf("\nno regressions in %d cases\n", baseline.count);
+    }
+    free(baseline.cases);
+    free(current.cases);
+    return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,519 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "png_writer.h"
+#include "trace.h"
+
+// Upper bound on the raw bytes in one band, so that no band's IDAT chunk can
+// approach PNG's 2^31 - 1 byte chunk limit
+#define BAND_BYTES (16 << 20)
+
+// Deflate parameters
+#define WINDOW_SIZE 32768
+#define HASH_BITS 15
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define STORED_BLOCK_MAX 65535
+
+// Longest hash chain searched for a match at each compression level
+static const int chain_limits[] = { 0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096 };
+
+// Fixed Huffman tables for match lengths (codes 257-285) and distances
+static const uint16_t length_base[29] = {
+    3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+    2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distance_base[30] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577
+};
+static const uint8_t distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+    6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/*
+ * A growable byte buffer that deflate output is written to, least
+ * significant bit first.
+ */
+typedef struct {
+    uint8_t* data;
+    size_t length;
+    size_t capacity;
+    uint64_t bits;
+    int bit_count;
+} BitWriter;
+
+static void put_byte(BitWriter* writer, uint8_t byte) {
+    if (writer->length == writer->capacity) {
+        writer->capacity = writer->capacity ? writer->capacity * 2 : 4096;
+        writer->data = raycast_realloc(writer->data, writer->capacity);
+    }
+    writer->data[writer->length++] = byte;
+}
+
+static void put_bits(BitWriter* writer, uint32_t value, int count) {
+    writer->bits |= (uint64_t)value << writer->bit_count;
+    writer->bit_count += count;
+    while (writer->bit_count >= 8) {
+        put_byte(writer, writer->bits & 0xff);
+        writer->bits >>= 8;
+        writer->bit_count -= 8;
+    }
+}
+
+// Pad with zero bits up to the next byte boundary.
+static void align_byte(BitWriter* writer) {
+    if (writer->bit_count > 0) {
+        put_bits(writer, 0, 8 - writer->bit_count);
+    }
+}
+
+// Huffman codes are packed most significant bit first.
+static void put_code(BitWriter* writer, uint32_t code, int length) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < length; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    put_bits(writer, reversed, length);
+}
+
+// Write a literal/length symbol with the fixed Huffman code.
+static void put_symbol(BitWriter* writer, int symbol) {
+    if (symbol < 144) {
+        put_code(writer, 0x30 + symbol, 8);
+    }
+    else if (symbol < 256) {
+        put_code(writer, 0x190 + symbol - 144, 9);
+    }
+    else if (symbol < 280) {
+        put_code(writer, symbol - 256, 7);
+    }
+    else {
+        put_code(writer, 0xc0 + symbol - 280, 8);
+    }
+}
+
+static void put_match(BitWriter* writer, int length, int distance) {
+    int l = 0;
+    while (l < 28 && length_base[l + 1] <= length) {
+        l++;
+    }
+    put_symbol(writer, 257 + l);
+    put_bits(writer, length - length_base[l], length_extra[l]);
+
+    int d = 0;
+    while (d < 29 && distance_base[d + 1] <= distance) {
+        d++;
+    }
+    put_code(writer, d, 5);
+    put_bits(writer, distance - distance_base[d], distance_extra[d]);
+}
+
+static uint32_t hash3(const uint8_t* data) {
+    uint32_t key = data[0] << 16 | data[1] << 8 | data[2];
+    return (key * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/*
+ * Compress `length` bytes as non-final deflate blocks. Level 0 emits stored
+ * blocks; higher levels emit one fixed-Huffman block of greedy LZ77 matches.
+ */
+static void deflate_band(BitWriter* writer, const uint8_t* data, size_t length,
+                         int level) {
+    if (level == PNG_LEVEL_STORE) {
+        for (size_t pos = 0; pos < length; pos += STORED_BLOCK_MAX) {
+            size_t count = length - pos < STORED_BLOCK_MAX ? length - pos
+                                                           : STORED_BLOCK_MAX;
+            put_bits(writer, 0, 3);
+            align_byte(writer);
+            put_bits(writer, count, 16);
+            put_bits(writer, ~count & 0xffff, 16);
+            for (size_t i = 0; i < count; i++) {
+                put_byte(writer, data[pos + i]);
+            }
+        }
+        return;
+    }
+
+    int32_t* head = raycast_malloc(sizeof(int32_t) << HASH_BITS);
+    int32_t* prev = raycast_malloc(sizeof(int32_t) * WINDOW_SIZE);
+    memset(head, 0xff, sizeof(int32_t) << HASH_BITS);
+    int chain_limit = chain_limits[level];
+
+    // BFINAL = 0, BTYPE = 01 (fixed Huffman codes)
+    put_bits(writer, 0, 1);
+    put_bits(writer, 1, 2);
+
+    size_t pos = 0;
+    while (pos < length) {
+        size_t best_length = 0;
+        size_t best_distance = 0;
+        if (pos + MIN_MATCH <= length) {
+            uint32_t hash = hash3(data + pos);
+            size_t max_length = length - pos < MAX_MATCH ? length - pos : MAX_MATCH;
+            int32_t candidate = head[hash];
+            for (int chain = 0; chain < chain_limit && candidate >= 0 &&
+                                pos - candidate <= WINDOW_SIZE;
+                 chain++) {
+                if (data[candidate + best_length] == data[pos + best_length]) {
+                    size_t n = 0;
+                    while (n < max_length && data[candidate + n] == data[pos + n]) {
+                        n++;
+                    }
+                    if (n > best_length) {
+                        best_length = n;
+                        best_distance = pos - candidate;
+                        if (n == max_length) {
+                            break;
+                        }
+                    }
+                }
+                candidate = prev[candidate % WINDOW_SIZE];
+            }
+            prev[pos % WINDOW_SIZE] = head[hash];
+            head[hash] = pos;
+        }
+
+        if (best_length >= MIN_MATCH) {
+            put_match(writer, best_length, best_distance);
+            // Keep the chains complete for the positions the match covers
+            for (size_t i = pos + 1; i < pos + best_length && i + MIN_MATCH <= length; i++) {
+                uint32_t hash = hash3(data + i);
+                prev[i % WINDOW_SIZE] = head[hash];
+                head[hash] = i;
+            }
+            pos += best_length;
+        }
+        else {
+            put_symbol(writer, data[pos]);
+            pos++;
+        }
+    }
+
+    // End of block
+    put_symbol(writer, 256);
+
+    raycast_free(head);
+    raycast_free(prev);
+}
+
+#define ADLER_MOD 65521
+
+static uint32_t adler32(const uint8_t* data, size_t length) {
+    uint32_t a = 1;
+    uint32_t b = 0;
+    while (length > 0) {
+        // 5552 is the most bytes that can be summed before b could overflow
+        size_t block = length < 5552 ? length : 5552;
+        for (size_t i = 0; i < block; i++) {
+            a += data[i];
+            b += a;
+        }
+        a %= ADLER_MOD;
+        b %= ADLER_MOD;
+        data += block;
+        length -= block;
+    }
+    return b << 16 | a;
+}
+
+// Checksum of two concatenated byte strings from the checksums of each.
+static uint32_t adler32_combine(uint32_t adler1, uint32_t adler2,
+                                uint64_t length2) {
+    uint64_t remainder = length2 % ADLER_MOD;
+    uint64_t a = (adler1 & 0xffff) + (adler2 & 0xffff) + ADLER_MOD - 1;
+    uint64_t b = remainder * (adler1 & 0xffff) % ADLER_MOD +
+                 (adler1 >> 16) + (adler2 >> 16) + ADLER_MOD - remainder;
+    return (uint32_t)((b % ADLER_MOD) << 16 | (a % ADLER_MOD));
+}
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void build_crc_table(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+// Continue a CRC-32 over more data; start from 0.
+static uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t length) {
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint8_t paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+/*
+ * Apply PNG filter `type` to `row` (with `above` the previous row, or NULL for
+ * the first row), writing the filter byte and filtered row to `out`.
+ */
+static void filter_row(uint8_t* out, const uint8_t* row, const uint8_t* above,
+                       size_t row_bytes, int type) {
+    out[0] = type;
+    for (size_t i = 0; i < row_bytes; i++) {
+        int a = i >= CHANNELS ? row[i - CHANNELS] : 0;
+        int b = above ? above[i] : 0;
+        int c = above && i >= CHANNELS ? above[i - CHANNELS] : 0;
+        switch (type) {
+        case 0: out[i + 1] = row[i]; break;
+        case 1: out[i + 1] = row[i] - a; break;
+        case 2: out[i + 1] = row[i] - b; break;
+        case 3: out[i + 1] = row[i] - ((a + b) >> 1); break;
+        default: out[i + 1] = row[i] - paeth(a, b, c); break;
+        }
+    }
+}
+
+// Sum of the filtered bytes read as signed values, the usual heuristic for
+// how well a filtered row will compress.
+static unsigned long filter_cost(const uint8_t* filtered, size_t row_bytes) {
+    unsigned long cost = 0;
+    for (size_t i = 1; i <= row_bytes; i++) {
+        cost += abs((int8_t)filtered[i]);
+    }
+    return cost;
+}
+
+typedef struct {
+    int start_row;
+    int end_row; // end_row is exclusive
+    BitWriter output;
+    uint32_t adler;     // Adler-32 of the band's filtered bytes
+    size_t raw_length;  // number of filtered bytes
+    uint32_t crc;       // CRC-32 of the band's IDAT chunk
+} Band;
+
+typedef struct {
+    Image* image;
+    int level;
+    Band* bands;
+    int band_count;
+    int next_band;
+    pthread_mutex_t lock;
+} PngJob;
+
+// Filter and compress one band into its own IDAT chunk payload.
+static void encode_band(PngJob* job, Band* band, int last) {
+    Image* image = job->image;
+    size_t row_bytes = (size_t)image->width * CHANNELS;
+    size_t rows = band->end_row - band->start_row;
+    uint8_t* filtered = raycast_malloc((row_bytes + 1) * rows);
+    uint8_t* candidate = raycast_malloc(row_bytes + 1);
+
+    for (size_t r = 0; r < rows; r++) {
+        int y = band->start_row + r;
+        const uint8_t* row = (const uint8_t*)image_pixel(image, 0, y);
+        const uint8_t* above =
+            y > 0 ? (const uint8_t*)image_pixel(image, 0, y - 1) : NULL;
+        uint8_t* out = filtered + r * (row_bytes + 1);
+
+        if (job->level == PNG_LEVEL_STORE) {
+            filter_row(out, row, above, row_bytes, 0);
+        }
+        else if (job->level == PNG_LEVEL_FAST) {
+            filter_row(out, row, above, row_bytes, 1);
+        }
+        else {
+            // Pick the filter whose output looks most compressible
+            unsigned long best_cost = 0;
+            for (int type = 0; type < 5; type++) {
+                filter_row(candidate, row, above, row_bytes, type);
+                unsigned long cost = filter_cost(candidate, row_bytes);
+                if (type == 0 || cost < best_cost) {
+                    best_cost = cost;
+                    memcpy(out, candidate, row_bytes + 1);
+                }
+            }
+        }
+    }
+
+    band->raw_length = (row_bytes + 1) * rows;
+    band->adler = adler32(filtered, band->raw_length);
+    deflate_band(&band->output, filtered, band->raw_length, job->level);
+
+    if (last) {
+        // An empty final fixed-Huffman block ends the zlib stream
+        put_bits(&band->output, 1, 1);
+        put_bits(&band->output, 1, 2);
+        put_symbol(&band->output, 256);
+        align_byte(&band->output);
+    }
+    else {
+        // Sync flush: an empty stored block realigns to a byte boundary, so the
+        // next band's stream can simply be appended
+        put_bits(&band->output, 0, 3);
+        align_byte(&band->output);
+        put_bits(&band->output, 0x0000, 16);
+        put_bits(&band->output, 0xffff, 16);
+    }
+
+    band->crc = crc32_update(0, (const uint8_t*)"IDAT", 4);
+    band->crc = crc32_update(band->crc, band->output.data, band->output.length);
+
+    raycast_free(filtered);
+    raycast_free(candidate);
+}
+
+static void* png_worker(void* arg) {
+    PngJob* job = (PngJob*)arg;
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        int index = job->next_band++;
+        pthread_mutex_unlock(&job->lock);
+        if (index >= job->band_count) {
+            return NULL;
+        }
+        Band* band = &job->bands[index];
+        TraceSpan span = trace_begin("encode band");
+        encode_band(job, band, index == job->band_count - 1);
+        trace_end_region(span, 0, band->start_row, job->image->width,
+                         band->end_row - band->start_row);
+    }
+}
+
+static void put_u32(uint8_t* out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+// Write one chunk whose CRC has already been computed.
+static int write_chunk_crc(FILE* file, const char* type, const uint8_t* data,
+                           size_t length, uint32_t crc) {
+    uint8_t length_bytes[4];
+    uint8_t crc_bytes[4];
+    put_u32(length_bytes, length);
+    put_u32(crc_bytes, crc);
+    int error = fwrite(length_bytes, 1, 4, file) != 4;
+    error |= fwrite(type, 1, 4, file) != 4;
+    if (length > 0) {
+        error |= fwrite(data, 1, length, file) != length;
+    }
+    error |= fwrite(crc_bytes, 1, 4, file) != 4;
+    return error;
+}
+
+static int write_chunk(FILE* file, const char* type, const uint8_t* data,
+                       size_t length) {
+    uint32_t crc = crc32_update(0, (const uint8_t*)type, 4);
+    crc = crc32_update(crc, data, length);
+    return write_chunk_crc(file, type, data, length, crc);
+}
+
+int write_image_parallel(const char* filename, Image* image, int level,
+                         int max_threads) {
+    if (image->width <= 0 || image->height <= 0) {
+        return -1;
+    }
+    pthread_once(&crc_table_once, build_crc_table);
+    TraceSpan span = trace_begin("encode");
+
+    PngJob job;
+    job.image = image;
+    job.level = level < PNG_LEVEL_STORE ? PNG_LEVEL_STORE
+                : level > PNG_LEVEL_BEST ? PNG_LEVEL_BEST
+                                         : level;
+    job.next_band = 0;
+    pthread_mutex_init(&job.lock, NULL);
+
+    // At least one band per thread, and no band over BAND_BYTES
+    size_t row_bytes = (size_t)image->width * CHANNELS;
+    size_t rows_per_band = BAND_BYTES / row_bytes > 0 ? BAND_BYTES / row_bytes : 1;
+    int threads = max_threads > 0 ? max_threads : 1;
+    if ((size_t)image->height / threads < rows_per_band) {
+        rows_per_band = (image->height + threads - 1) / threads;
+    }
+    job.band_count = (image->height + rows_per_band - 1) / rows_per_band;
+    job.bands = raycast_calloc(job.band_count, sizeof(Band));
+    for (int i = 0; i < job.band_count; i++) {
+        job.bands[i].start_row = i * rows_per_band;
+        job.bands[i].end_row = (i + 1) * rows_per_band < (size_t)image->height
+                                   ? (i + 1) * rows_per_band
+                                   : image->height;
+    }
+
+    int num_threads = threads < job.band_count ? threads : job.band_count;
+    if (num_threads == 1) {
+        png_worker(&job);
+    }
+    else {
+        pthread_t* workers = raycast_malloc(num_threads * sizeof(pthread_t));
+        for (int i = 0; i < num_threads; i++) {
+            pthread_create(&workers[i], NULL, png_worker, &job);
+        }
+        for (int i = 0; i < num_threads; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        raycast_free(workers);
+    }
+
+    int error = 1;
+    FILE* file = fopen(filename, "wb");
+    if (file != NULL) {
+        static const uint8_t signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+        error = fwrite(signature, 1, 8, file) != 8;
+
+        // 8-bit RGB, default compression and filtering, no interlacing
+        uint8_t header[13] = { 0 };
+        put_u32(header, image->width);
+        put_u32(header + 4, image->height);
+        header[8] = 8;
+        header[9] = 2;
+        error |= write_chunk(file, "IHDR", header, sizeof(header));
+
+        // zlib header: deflate with a 32K window, no preset dictionary
+        static const uint8_t zlib_header[2] = { 0x78, 0x01 };
+        error |= write_chunk(file, "IDAT", zlib_header, 2);
+
+        uint32_t adler = 1;
+        for (int i = 0; i < job.band_count; i++) {
+            Band* band = &job.bands[i];
+            error |= write_chunk_crc(file, "IDAT", band->output.data,
+                                     band->output.length, band->crc);
+            adler = adler32_combine(adler, band->adler, band->raw_length);
+        }
+
+        uint8_t trailer[4];
+        put_u32(trailer, adler);
+        error |= write_chunk(file, "IDAT", trailer, 4);
+        error |= write_chunk(file, "IEND", NULL, 0);
+        error |= fclose(file) != 0;
+    }
+
+    for (int i = 0; i < job.band_count; i++) {
+        raycast_free(job.bands[i].output.data);
+    }
+    raycast_free(job.bands);
+    pthread_mutex_destroy(&job.lock);
+
+    trace_end(span);
+    return error ? -1 : 0;
+}
@@ -0,0 +1,29 @@
+#ifndef __PNG_WRITER_H__
+#define __PNG_WRITER_H__
+
+#include "image.h"
+
+// Compression levels for `write_image_parallel`
+// Stored blocks only: no compression, fastest to write
+#define PNG_LEVEL_STORE 0
+// Light compression for intermediate outputs
+#define PNG_LEVEL_FAST 1
+#define PNG_LEVEL_DEFAULT 6
+#define PNG_LEVEL_BEST 9
+
+/*
+ * Save an image to a PNG file, filtering and compressing bands of rows on up
+ * to `max_threads` threads.
+ *
+ * Every band is compressed into its own deflate stream, ending on a byte
+ * boundary with a sync flush so the streams can be concatenated into one
+ * valid zlib stream. Bands are written as separate IDAT chunks. `level` ranges
+ * from PNG_LEVEL_STORE to PNG_LEVEL_BEST; higher levels search harder for
+ * matches and choose each row's filter adaptively.
+ *
+ * Returns 0 on success and -1 if the file could not be written.
+ */
+int write_image_parallel(const char* filename, Image* image, int level,
+                         int max_threads);
+
+#endif // __PNG_WRITER_H__
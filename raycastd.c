@@ -0,0 +1,662 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "raycastd.h"
+#include "scene.h"
+
+typedef struct {
+    char id[RAYCASTD_SCENE_ID_LENGTH];
+    PreparedScene* prepared;
+} ServedScene;
+
+// Side of the square tiles requests are split into for the render pool
+#define RENDER_TILE 16
+
+/*
+ * A region being rendered by the pool, one tile at a time. Fields below
+ * `next` change under the pool lock.
+ */
+typedef struct RenderJob {
+    const PreparedScene* prepared;
+    Light* lights;
+    unsigned int* radii; // `light_radius` of each light
+    int light_count;
+    int x;
+    int y;
+    int width;
+    int height;
+    Color* out; // `width` pixels to a row
+    int tiles_across;
+    int tile_count;
+    int helper_limit; // most pool threads working on the job at once
+
+    struct RenderJob* next;
+    int next_tile;
+    int tiles_left;
+    int helpers;
+} RenderJob;
+
+struct RaycastServer {
+    char* socket_path;
+    int listen_fd;
+    int worker_count;
+
+    // Render threads started with the server and shared by every request
+    pthread_t* render_threads;
+    int render_thread_count;
+    pthread_mutex_t pool_lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t job_done;
+    RenderJob* jobs;
+    int pool_stopping;
+
+    // Fixed once the server runs, so workers read them without locking
+    ServedScene* scenes;
+    int scene_count;
+
+    pthread_mutex_t lock;
+    int stopping;
+    // Connection each worker is serving, or -1, so shutdown can end them
+    int* connections;
+    // Names the shared-memory objects handed out to clients
+    unsigned long buffer_counter;
+};
+
+/*
+ * Receive exactly `length` bytes. If `fd` is non-NULL, a descriptor passed
+ * along with the data is stored there (or -1 if there was none). Returns 0 on
+ * success and -1 if the connection failed or closed.
+ */
+static int receive_fully(int connection, void* data, size_t length, int* fd) {
+    char* bytes = (char*)data;
+    if (fd != NULL) {
+        *fd = -1;
+    }
+    while (length > 0) {
+        struct iovec vector = { bytes, length };
+        union {
+            struct cmsghdr header;
+            char space[CMSG_SPACE(sizeof(int))];
+        } control;
+        struct msghdr message = { 0 };
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control.space;
+        message.msg_controllen = sizeof(control.space);
+
+        ssize_t count = recvmsg(connection, &message, 0);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return -1;
+        }
+        for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != NULL;
+             header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level == SOL_SOCKET &&
+                header->cmsg_type == SCM_RIGHTS) {
+                int received;
+                memcpy(&received, CMSG_DATA(header), sizeof(int));
+                if (fd != NULL && *fd < 0) {
+                    *fd = received;
+                }
+                else {
+                    close(received);
+                }
+            }
+        }
+        bytes += count;
+        length -= count;
+    }
+    return 0;
+}
+
+/*
+ * Send exactly `length` bytes, attaching `fd` to the first part unless it is
+ * -1. Returns 0 on success and -1 if the connection failed.
+ */
+static int send_fully(int connection, const void* data, size_t length, int fd) {
+    const char* bytes = (const char*)data;
+    while (length > 0) {
+        struct iovec vector = { (void*)bytes, length };
+        union {
+            struct cmsghdr header;
+            char space[CMSG_SPACE(sizeof(int))];
+        } control;
+        struct msghdr message = { 0 };
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        if (fd >= 0) {
+            memset(&control, 0, sizeof(control));
+            message.msg_control = control.space;
+            message.msg_controllen = sizeof(control.space);
+            struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SCM_RIGHTS;
+            header->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(header), &fd, sizeof(int));
+        }
+
+        ssize_t count = sendmsg(connection, &message, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return -1;
+        }
+        bytes += count;
+        length -= count;
+        fd = -1;
+    }
+    return 0;
+}
+
+/*
+ * Render tile `tile` of `job` into its output, keeping only the lights that
+ * reach the tile (in `tile_lights`, room for every light).
+ */
+static void render_tile(const RenderJob* job, int tile, Light* tile_lights) {
+    int tile_x = tile % job->tiles_across * RENDER_TILE;
+    int tile_y = tile / job->tiles_across * RENDER_TILE;
+    int width = RENDER_TILE < job->width - tile_x ? RENDER_TILE : job->width - tile_x;
+    int height = RENDER_TILE < job->height - tile_y ? RENDER_TILE : job->height - tile_y;
+    int x = job->x + tile_x;
+    int y = job->y + tile_y;
+
+    // Without scratch space every light is passed on, which is slower but
+    // renders the same pixels
+    if (tile_lights == NULL) {
+        render_region(job->prepared, job->lights, job->light_count, x, y, width,
+                      height, job->out + (size_t)tile_y * job->width + tile_x,
+                      job->width, 1);
+        return;
+    }
+    int tile_light_count = 0;
+    for (int l = 0; l < job->light_count; l++) {
+        double x_gap = axis_gap(job->lights[l].pixel.x, x, x + width);
+        double y_gap = axis_gap(job->lights[l].pixel.y, y, y + height);
+        if (x_gap * x_gap + y_gap * y_gap <=
+            (double)job->radii[l] * job->radii[l]) {
+            tile_lights[tile_light_count++] = job->lights[l];
+        }
+    }
+    render_region(job->prepared, tile_lights, tile_light_count, x, y, width,
+                  height, job->out + (size_t)tile_y * job->width + tile_x,
+                  job->width, 1);
+}
+
+// Returns the first queued job with tiles left and room for another thread.
+static RenderJob* open_job(RaycastServer* server) {
+    for (RenderJob* job = server->jobs; job != NULL; job = job->next) {
+        if (job->next_tile < job->tile_count && job->helpers < job->helper_limit) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void* render_worker(void* arg) {
+    RaycastServer* server = (RaycastServer*)arg;
+    Light* tile_lights = NULL;
+    int tile_light_capacity = 0;
+
+    pthread_mutex_lock(&server->pool_lock);
+    while (!server->pool_stopping) {
+        RenderJob* job = open_job(server);
+        if (job == NULL) {
+            pthread_cond_wait(&server->work_ready, &server->pool_lock);
+            continue;
+        }
+        // The job outlives every tile claimed from it, as its submitter waits
+        // for them all
+        job->helpers++;
+        int tile = job->next_tile++;
+        int light_count = job->light_count;
+        pthread_mutex_unlock(&server->pool_lock);
+        if (light_count > tile_light_capacity) {
+            free(tile_lights);
+            tile_lights = malloc(sizeof(Light) * light_count);
+            tile_light_capacity = tile_lights == NULL ? 0 : light_count;
+        }
+
+        while (1) {
+            render_tile(job, tile, tile_lights);
+            pthread_mutex_lock(&server->pool_lock);
+            job->tiles_left--;
+            if (job->next_tile == job->tile_count) {
+                break;
+            }
+            tile = job->next_tile++;
+            pthread_mutex_unlock(&server->pool_lock);
+        }
+        job->helpers--;
+        if (job->tiles_left == 0) {
+            pthread_cond_broadcast(&server->job_done);
+        }
+    }
+    pthread_mutex_unlock(&server->pool_lock);
+    free(tile_lights);
+    return NULL;
+}
+
+/*
+ * Render the `width` x `height` region at (x, y) into `out` on up to `threads`
+ * of the pool's threads, and wait for it to finish.
+ */
+static void pool_render(RaycastServer* server, const PreparedScene* prepared,
+                        Light* lights, int light_count, int x, int y,
+                        int width, int height, Color* out, int threads) {
+    int tiles_across = (width + RENDER_TILE - 1) / RENDER_TILE;
+    int tile_count = tiles_across * ((height + RENDER_TILE - 1) / RENDER_TILE);
+    RenderJob job = {
+        .prepared = prepared,
+        .lights = lights,
+        .light_count = light_count,
+        .x = x,
+        .y = y,
+        .width = width,
+        .height = height,
+        .out = out,
+        .tiles_across = tiles_across,
+        .tile_count = tile_count,
+        .helper_limit = threads,
+        .tiles_left = tile_count,
+    };
+    if (tile_count == 0) {
+        return;
+    }
+    job.radii = malloc(sizeof(unsigned int) * (light_count + 1));
+    for (int l = 0; l < light_count; l++) {
+        job.radii[l] = light_radius(lights[l]);
+    }
+
+    pthread_mutex_lock(&server->pool_lock);
+    RenderJob** last = &server->jobs;
+    while (*last != NULL) {
+        last = &(*last)->next;
+    }
+    *last = &job;
+    pthread_cond_broadcast(&server->work_ready);
+    while (job.tiles_left > 0) {
+        pthread_cond_wait(&server->job_done, &server->pool_lock);
+    }
+    for (RenderJob** link = &server->jobs; *link != NULL; link = &(*link)->next) {
+        if (*link == &job) {
+            *link = job.next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&server->pool_lock);
+    free(job.radii);
+}
+
+RaycastServer* raycastd_create(const char* socket_path, int workers,
+                               int render_threads) {
+    struct sockaddr_un address = { 0 };
+    if (workers < 1 || render_threads < 1 ||
+        strlen(socket_path) >= sizeof(address.sun_path)) {
+        return NULL;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        return NULL;
+    }
+    unlink(socket_path);
+    if (bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0) {
+        close(listen_fd);
+        return NULL;
+    }
+
+    RaycastServer* server = calloc(1, sizeof(RaycastServer));
+    server->socket_path = strdup(socket_path);
+    server->listen_fd = listen_fd;
+    server->worker_count = workers;
+    server->connections = malloc(sizeof(int) * workers);
+    for (int i = 0; i < workers; i++) {
+        server->connections[i] = -1;
+    }
+    pthread_mutex_init(&server->lock, NULL);
+
+    pthread_mutex_init(&server->pool_lock, NULL);
+    pthread_cond_init(&server->work_ready, NULL);
+    pthread_cond_init(&server->job_done, NULL);
+    server->render_thread_count = render_threads;
+    server->render_threads = malloc(sizeof(pthread_t) * render_threads);
+    for (int i = 0; i < render_threads; i++) {
+        pthread_create(&server->render_threads[i], NULL, render_worker, server);
+    }
+    return server;
+}
+
+int raycastd_add_scene(RaycastServer* server, const char* id,
+                       PreparedScene* prepared) {
+    if (strlen(id) >= RAYCASTD_SCENE_ID_LENGTH) {
+        return -1;
+    }
+    for (int i = 0; i < server->scene_count; i++) {
+        if (strcmp(server->scenes[i].id, id) == 0) {
+            return -1;
+        }
+    }
+    server->scenes = realloc(server->scenes,
+                             sizeof(ServedScene) * (server->scene_count + 1));
+    ServedScene* scene = &server->scenes[server->scene_count++];
+    strcpy(scene->id, id);
+    scene->prepared = prepared;
+    return 0;
+}
+
+static const PreparedScene* find_scene(const RaycastServer* server,
+                                       const char* id) {
+    for (int i = 0; i < server->scene_count; i++) {
+        if (strcmp(server->scenes[i].id, id) == 0) {
+            return server->scenes[i].prepared;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Create an anonymous shared-memory buffer of `length` bytes. Returns its
+ * descriptor, or -1 on failure.
+ */
+static int create_buffer(RaycastServer* server, size_t length) {
+    pthread_mutex_lock(&server->lock);
+    unsigned long number = server->buffer_counter++;
+    pthread_mutex_unlock(&server->lock);
+
+    char name[64];
+    snprintf(name, sizeof(name), "/raycastd.%ld.%lu", (long)getpid(), number);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    // Only the descriptor keeps the buffer alive from here on
+    shm_unlink(name);
+    if (ftruncate(fd, length) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Render one request into the client's buffer (`buffer_fd`), or into a new one
+ * returned through `result_fd`. Returns the response status.
+ */
+static int serve_request(RaycastServer* server, const RenderRequest* request,
+                         Light* lights, int buffer_fd,
+                         RenderResponse* response, int* result_fd) {
+    *result_fd = -1;
+    if (memchr(request->scene, '\0', sizeof(request->scene)) == NULL ||
+        request->engine >= ENGINE_COUNT || request->threads < 1 ||
+        request->threads > RAYCASTD_MAX_THREADS) {
+        return RAYCASTD_BAD_REQUEST;
+    }
+    const PreparedScene* prepared = find_scene(server, request->scene);
+    if (prepared == NULL) {
+        return RAYCASTD_UNKNOWN_SCENE;
+    }
+
+    int x = request->x;
+    int y = request->y;
+    int width = request->width;
+    int height = request->height;
+    int whole_scene = width == 0 || height == 0;
+    if (whole_scene) {
+        x = 0;
+        y = 0;
+        width = prepared->width;
+        height = prepared->height;
+    }
+    if (x < 0 || y < 0 || width < 0 || height < 0 ||
+        width > prepared->width - x || height > prepared->height - y) {
+        return RAYCASTD_BAD_REQUEST;
+    }
+    response->width = width;
+    response->height = height;
+    response->length = sizeof(Color) * (uint64_t)width * height;
+
+    int fd = buffer_fd;
+    if (fd < 0) {
+        fd = create_buffer(server, response->length);
+        if (fd < 0) {
+            return RAYCASTD_INTERNAL_ERROR;
+        }
+    }
+    else {
+        struct stat info;
+        if (fstat(fd, &info) != 0 || (uint64_t)info.st_size < response->length) {
+            return RAYCASTD_BAD_BUFFER;
+        }
+    }
+
+    Color* pixels = NULL;
+    if (response->length > 0) {
+        pixels = mmap(NULL, response->length, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+        if (pixels == MAP_FAILED) {
+            if (fd != buffer_fd) {
+                close(fd);
+            }
+            return buffer_fd < 0 ? RAYCASTD_INTERNAL_ERROR : RAYCASTD_BAD_BUFFER;
+        }
+    }
+
+    int light_count = request->light_count;
+    if (whole_scene && request->engine == ENGINE_PARALLEL_LIGHTS) {
+        Image* cast = raycast_prepared(prepared, request->engine, lights,
+                                       light_count, request->threads);
+        memcpy(pixels, cast->pixels, response->length);
+        free_image(cast);
+    }
+    else {
+        // Tiles are rendered straight into the shared buffer
+        pool_render(server, prepared, lights, light_count, x, y, width, height,
+                    pixels, request->threads);
+    }
+
+    if (pixels != NULL) {
+        munmap(pixels, response->length);
+    }
+    if (fd != buffer_fd) {
+        *result_fd = fd;
+    }
+    return RAYCASTD_OK;
+}
+
+// Serve every request on one connection until the client hangs up.
+static void serve_connection(RaycastServer* server, int connection) {
+    Light* lights = NULL;
+    uint32_t light_capacity = 0;
+
+    while (1) {
+        RenderRequest request;
+        int buffer_fd;
+        if (receive_fully(connection, &request, sizeof(request), &buffer_fd) != 0) {
+            break;
+        }
+        if (request.magic != RAYCASTD_MAGIC ||
+            request.light_count > RAYCASTD_MAX_LIGHTS) {
+            // The stream cannot be trusted past a malformed header
+            if (buffer_fd >= 0) {
+                close(buffer_fd);
+            }
+            RenderResponse response = { .status = RAYCASTD_BAD_REQUEST };
+            send_fully(connection, &response, sizeof(response), -1);
+            break;
+        }
+        if (request.light_count > light_capacity) {
+            light_capacity = request.light_count;
+            free(lights);
+            lights = malloc(sizeof(Light) * light_capacity);
+        }
+        if (receive_fully(connection, lights, sizeof(Light) * request.light_count,
+                          NULL) != 0) {
+            if (buffer_fd >= 0) {
+                close(buffer_fd);
+            }
+            break;
+        }
+
+        RenderResponse response = { 0 };
+        int result_fd;
+        response.status = serve_request(server, &request, lights, buffer_fd,
+                                        &response, &result_fd);
+        if (response.status != RAYCASTD_OK) {
+            response.width = 0;
+            response.height = 0;
+            response.length = 0;
+        }
+        if (buffer_fd >= 0) {
+            close(buffer_fd);
+        }
+        int error = send_fully(connection, &response, sizeof(response), result_fd);
+        if (result_fd >= 0) {
+            close(result_fd);
+        }
+        if (error) {
+            break;
+        }
+    }
+
+    free(lights);
+    close(connection);
+}
+
+typedef struct {
+    RaycastServer* server;
+    int index;
+} ServerWorker;
+
+static void* server_worker(void* arg) {
+    RaycastServer* server = ((ServerWorker*)arg)->server;
+    int index = ((ServerWorker*)arg)->index;
+    while (1) {
+        int connection = accept(server->listen_fd, NULL, NULL);
+        pthread_mutex_lock(&server->lock);
+        int stopping = server->stopping;
+        if (!stopping) {
+            server->connections[index] = connection;
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        if (connection < 0) {
+            if (stopping || (errno != EINTR && errno != ECONNABORTED)) {
+                return NULL;
+            }
+            continue;
+        }
+        if (stopping) {
+            close(connection);
+            return NULL;
+        }
+        serve_connection(server, connection);
+
+        pthread_mutex_lock(&server->lock);
+        server->connections[index] = -1;
+        pthread_mutex_unlock(&server->lock);
+    }
+}
+
+void raycastd_run(RaycastServer* server) {
+    pthread_t* threads = malloc(sizeof(pthread_t) * server->worker_count);
+    ServerWorker* workers = malloc(sizeof(ServerWorker) * server->worker_count);
+    for (int i = 0; i < server->worker_count; i++) {
+        workers[i] = (ServerWorker){ server, i };
+        pthread_create(&threads[i], NULL, server_worker, &workers[i]);
+    }
+    for (int i = 0; i < server->worker_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(workers);
+    free(threads);
+}
+
+void raycastd_shutdown(RaycastServer* server) {
+    pthread_mutex_lock(&server->lock);
+    server->stopping = 1;
+    // Clients waiting between requests are hung up on; requests being
+    // rendered still get their responses
+    for (int i = 0; i < server->worker_count; i++) {
+        if (server->connections[i] >= 0) {
+            shutdown(server->connections[i], SHUT_RD);
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+    // Wakes every worker blocked in accept()
+    shutdown(server->listen_fd, SHUT_RDWR);
+}
+
+void raycastd_free(RaycastServer* server) {
+    pthread_mutex_lock(&server->pool_lock);
+    server->pool_stopping = 1;
+    pthread_cond_broadcast(&server->work_ready);
+    pthread_mutex_unlock(&server->pool_lock);
+    for (int i = 0; i < server->render_thread_count; i++) {
+        pthread_join(server->render_threads[i], NULL);
+    }
+    free(server->render_threads);
+    pthread_cond_destroy(&server->work_ready);
+    pthread_cond_destroy(&server->job_done);
+    pthread_mutex_destroy(&server->pool_lock);
+
+    close(server->listen_fd);
+    unlink(server->socket_path);
+    for (int i = 0; i < server->scene_count; i++) {
+        free_prepared_scene(server->scenes[i].prepared);
+    }
+    free(server->scenes);
+    free(server->connections);
+    free(server->socket_path);
+    pthread_mutex_destroy(&server->lock);
+    free(server);
+}
+
+int raycastd_connect(const char* socket_path) {
+    struct sockaddr_un address = { 0 };
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0) {
+        return -1;
+    }
+    if (connect(connection, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(connection);
+        return -1;
+    }
+    return connection;
+}
+
+int raycastd_render(int connection, const RenderRequest* request,
+                    const Light* lights, int buffer_fd,
+                    RenderResponse* response, int* result_fd) {
+    *result_fd = -1;
+    if (send_fully(connection, request, sizeof(*request), buffer_fd) != 0 ||
+        send_fully(connection, lights, sizeof(Light) * request->light_count,
+                   -1) != 0 ||
+        receive_fully(connection, response, sizeof(*response), result_fd) != 0) {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+#ifndef __RAYCASTD_H__
+#define __RAYCASTD_H__
+
+#include <stdint.h>
+
+#include "raycaster.h"
+
+/*
+ * Render daemon.
+ *
+ * The daemon keeps prepared scenes and a pool of connection workers alive and
+ * serves render requests over a Unix domain socket. A connection may carry any
+ * number of requests, one after another:
+ *
+ *   client -> daemon   RenderRequest, then `light_count` native `Light` records.
+ *                      The client may attach a shared-memory file descriptor
+ *                      (SCM_RIGHTS) to the request to receive the pixels in.
+ *   daemon -> client   RenderResponse. Unless the client supplied a buffer,
+ *                      a new shared-memory file descriptor holding the pixels
+ *                      is attached to it.
+ *
+ * Pixels are never encoded: the buffer holds `width * height` `Color`s,
+ * row-major, starting at offset 0. All fields use the host's byte order.
+ */
+
+#define RAYCASTD_MAGIC 0x52434431 // "RCD1"
+#define RAYCASTD_SCENE_ID_LENGTH 64
+// Largest number of lights accepted in one request
+#define RAYCASTD_MAX_LIGHTS (1 << 24)
+// Largest number of render threads one request may ask for
+#define RAYCASTD_MAX_THREADS 256
+
+// Status codes for `RenderResponse.status`
+#define RAYCASTD_OK 0
+#define RAYCASTD_BAD_REQUEST 1
+#define RAYCASTD_UNKNOWN_SCENE 2
+#define RAYCASTD_BAD_BUFFER 3
+#define RAYCASTD_INTERNAL_ERROR 4
+
+/*
+ * A request to render the region of a scene with the given lights.
+ *
+ * A region with zero width or height means the whole scene. Regions are
+ * rendered with the row engine's rules, in tiles, on up to `threads` of the
+ * server's render threads; `engine` matters only for whole-scene renders.
+ * `threads` must be between 1 and RAYCASTD_MAX_THREADS. Whole-scene renders
+ * with the lights engine, whose rules differ, start threads of their own.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t engine;
+    uint32_t threads;
+    uint32_t light_count;
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+    char scene[RAYCASTD_SCENE_ID_LENGTH]; // NUL-terminated scene id
+} RenderRequest;
+
+typedef struct {
+    int32_t status;
+    int32_t width;
+    int32_t height;
+    uint32_t reserved;
+    uint64_t length; // bytes of pixel data in the buffer
+} RenderResponse;
+
+typedef struct RaycastServer RaycastServer;
+
+/*
+ * Create a server listening on the Unix socket `socket_path` (replacing any
+ * stale socket file there), served by `workers` connection threads once
+ * running. Requests are rendered by a pool of `render_threads` threads, which
+ * starts at once and lives until `raycastd_free`. Returns NULL if the socket
+ * cannot be created.
+ */
+RaycastServer* raycastd_create(const char* socket_path, int workers,
+                               int render_threads);
+
+/*
+ * Register a prepared scene under `id`. The server takes ownership of it.
+ * Scenes must be added before `raycastd_run`. Returns 0 on success and -1 if
+ * the id is too long or already taken.
+ */
+int raycastd_add_scene(RaycastServer* server, const char* id,
+                       PreparedScene* prepared);
+
+/*
+ * Serve requests until `raycastd_shutdown` is called.
+ */
+void raycastd_run(RaycastServer* server);
+
+/*
+ * Stop a running server: no new connections or requests are accepted, and
+ * `raycastd_run` returns once the requests being rendered have been answered.
+ * Safe to call from any thread.
+ */
+void raycastd_shutdown(RaycastServer* server);
+
+/*
+ * Deallocate a server (after `raycastd_run` has returned), its scenes and its
+ * socket file.
+ */
+void raycastd_free(RaycastServer* server);
+
+/*
+ * Connect to a daemon. Returns the connected socket, or -1 on failure.
+ */
+int raycastd_connect(const char* socket_path);
+
+/*
+ * Send one request over a connection and wait for its response.
+ *
+ * If `buffer_fd` is a file descriptor (at least `response->length` bytes),
+ * the pixels are rendered into it; pass -1 to have the daemon allocate one,
+ * which is returned through `result_fd` (and must be closed by the caller).
+ * Returns 0 if a response was received (check its status) and -1 if the
+ * connection failed.
+ */
+int raycastd_render(int connection, const RenderRequest* request,
+                    const Light* lights, int buffer_fd,
+                    RenderResponse* response, int* result_fd);
+
+#endif // __RAYCASTD_H__
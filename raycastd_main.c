@@ -0,0 +1,100 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "raycastd.h"
+#include "scene_file.h"
+
+/*
+ * Render daemon.
+ *
+ * Usage: raycastd [--workers N] [--threads N] <socket> <id>=<scene> ...
+ *
+ * Loads and prepares every scene (a PNG or a native scene file) once, then
+ * serves render requests for them on the Unix socket until it receives
+ * SIGINT or SIGTERM. See raycastd.h for the protocol. `--workers` sets how
+ * many connections are served at once and `--threads` how many render threads
+ * they share (both one per CPU by default).
+ */
+
+static void* run_server(void* arg) {
+    raycastd_run((RaycastServer*)arg);
+    return NULL;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [--workers N] [--threads N] <socket> <id>=<scene> ...\n",
+            program);
+}
+
+int main(int argc, char** argv) {
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    long threads = workers;
+    int arg = 1;
+    while (arg + 1 < argc && strncmp(argv[arg], "--", 2) == 0) {
+        if (strcmp(argv[arg], "--workers") == 0) {
+            workers = atol(argv[arg + 1]);
+        }
+        else if (strcmp(argv[arg], "--threads") == 0) {
+            threads = atol(argv[arg + 1]);
+        }
+        else {
+            break;
+        }
+        arg += 2;
+    }
+    if (argc - arg < 2 || workers < 1 || threads < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    RaycastServer* server = raycastd_create(argv[arg], workers, threads);
+    if (server == NULL) {
+        fprintf(stderr, "%s: cannot listen on %s\n", argv[0], argv[arg]);
+        return 1;
+    }
+    for (arg++; arg < argc; arg++) {
+        char* path = strchr(argv[arg], '=');
+        if (path == NULL) {
+            usage(argv[0]);
+            raycastd_free(server);
+            return 2;
+        }
+        *path++ = '\0';
+        PreparedScene* prepared = load_scene_file(path);
+        if (prepared == NULL) {
+            fprintf(stderr, "%s: cannot load scene %s\n", argv[0], path);
+            raycastd_free(server);
+            return 1;
+        }
+        if (raycastd_add_scene(server, argv[arg], prepared) != 0) {
+            fprintf(stderr, "%s: bad or duplicate scene id '%s'\n", argv[0],
+                    argv[arg]);
+            free_prepared_scene(prepared);
+            raycastd_free(server);
+            return 1;
+        }
+    }
+
+    // Workers inherit the blocked signals, so only sigwait() below sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, run_server, server);
+    int signal_number;
+    sigwait(&signals, &signal_number);
+    raycastd_shutdown(server);
+    pthread_join(thread, NULL);
+    raycastd_free(server);
+    return 0;
+}
@@ -2,87 +2,351 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "alloc.h"
 #include "raycaster.h"
+#include "scene.h"
+#include "step_kernels.h"
+#include "trace.h"
+
+/*
+ * How a ray decides that it has reached its light. The sequential and row
+ * engines stop once the ray has passed the light on either axis, while the
+ * light-parallel engine stops as soon as it is at or beyond the light on both.
+ */
+typedef enum {
+    REACH_EITHER_AXIS,
+    REACH_BOTH_AXES,
+} ReachRule;
+
+#ifdef RAYCAST_STATS
+// Counts of the thread running this code, not yet added to `stats_total`
+static _Thread_local RaycastStats thread_stats;
+static RaycastStats stats_total;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define STATS_ADD(counter, amount) (thread_stats.counter += (amount))
+
+// Add this thread's counts to the totals.
+static void stats_flush(void) {
+    pthread_mutex_lock(&stats_lock);
+    stats_total.obstacle_pixels += thread_stats.obstacle_pixels;
+    stats_total.self_light_hits += thread_stats.self_light_hits;
+    stats_total.clearance_hits += thread_stats.clearance_hits;
+    stats_total.cell_hits += thread_stats.cell_hits;
+    stats_total.region_culls += thread_stats.region_culls;
+    stats_total.rays_traced += thread_stats.rays_traced;
+    stats_total.steps += thread_stats.steps;
+    stats_total.rays_blocked += thread_stats.rays_blocked;
+    stats_total.rays_reached += thread_stats.rays_reached;
+    stats_total.space_skips += thread_stats.space_skips;
+    pthread_mutex_unlock(&stats_lock);
+    memset(&thread_stats, 0, sizeof(thread_stats));
+}
+#else
+#define STATS_ADD(counter, amount) ((void)0)
+#define stats_flush() ((void)0)
+#endif
+
+int raycast_stats(RaycastStats* stats) {
+#ifdef RAYCAST_STATS
+    pthread_mutex_lock(&stats_lock);
+    *stats = stats_total;
+    pthread_mutex_unlock(&stats_lock);
+    return 0;
+#else
+    memset(stats, 0, sizeof(*stats));
+    return -1;
+#endif
+}
 
-Image* raycast_sequential(Image* scene, Light* lights, int light_count) {
+void raycast_stats_reset(void) {
+#ifdef RAYCAST_STATS
+    pthread_mutex_lock(&stats_lock);
+    memset(&stats_total, 0, sizeof(stats_total));
+    pthread_mutex_unlock(&stats_lock);
+#endif
+}
+
+/*
+ * Steps a ray takes between checks for whether the rest of it lies in empty
+ * space. A check walks down the occupancy pyramid and costs about as much as
+ * a few dozen steps, so rays check rarely: often enough to end long rays
+ * across open space early, rarely enough that cluttered scenes, where checks
+ * mostly fail, do not slow down.
+ */
+#define SKIP_CHECK_INTERVAL 64
+
+/*
+ * Define `trace_NAME`, which walks `pos` towards the light at `end` with the
+ * step function STEP until the ray reaches the light (returning 1) or an
+ * obstacle (returning 0), adding the steps taken to `cost` if it is non-NULL.
+ * The pixels a ray has left to visit all lie within the box between its
+ * latest pixel and the light, so once that box is empty the light is reached.
+ *
+ * SX and SY are the signs of the direction's components (-1, 0 or 1), which
+ * decide when the ray has passed the light under RULE. For the specialized
+ * kernels they are constants, so the reach test folds down to the comparisons
+ * that can still succeed.
+ */
+#define DEFINE_TRACE(name, STEP, SX, SY, RULE)                                 \
+    static int trace_##name(const PreparedScene* prepared, Pair pos,           \
+                            Pair direction, PixelLocation end,                 \
+                            int leaves_scene, uint32_t* cost) {                \
+        (void)direction;                                                       \
+        unsigned int since_skip_check = 0;                                     \
+        while (1) {                                                            \
+            PixelLocation next_pixel = STEP(&pos, direction);                  \
+            STATS_ADD(steps, 1);                                               \
+            if (cost != NULL) {                                                \
+                (*cost)++;                                                     \
+            }                                                                  \
+                                                                               \
+            /* Stop once we have reached or passed the light */                \
+            if (next_pixel.x == end.x && next_pixel.y == end.y) {              \
+                STATS_ADD(rays_reached, 1);                                    \
+                return 1;                                                      \
+            }                                                                  \
+            if ((RULE) == REACH_EITHER_AXIS                                    \
+                    ? ((SX) > 0 && next_pixel.x > end.x) ||                    \
+                      ((SX) < 0 && next_pixel.x < end.x) ||                    \
+                      ((SY) > 0 && next_pixel.y > end.y) ||                    \
+                      ((SY) < 0 && next_pixel.y < end.y)                       \
+                    : ((SX) > 0 ? next_pixel.x >= end.x                        \
+                                : next_pixel.x <= end.x) &&                    \
+                      ((SY) > 0 ? next_pixel.y >= end.y                        \
+                                : next_pixel.y <= end.y)) {                    \
+                STATS_ADD(rays_reached, 1);                                    \
+                return 1;                                                      \
+            }                                                                  \
+                                                                               \
+            /* Pixels beyond the scene are open space */                       \
+            if (leaves_scene &&                                                \
+                (next_pixel.x >= (unsigned int)prepared->scene_width ||        \
+                 next_pixel.y >= (unsigned int)prepared->scene_height)) {      \
+                continue;                                                      \
+            }                                                                  \
+                                                                               \
+            /* Check if the new pixel is an obstacle */                        \
+            if (scene_obstacle(prepared, next_pixel.x, next_pixel.y)) {        \
+                STATS_ADD(rays_blocked, 1);                                    \
+                return 0;                                                      \
+            }                                                                  \
+                                                                               \
+            /* Now and then, end the ray early if all that is left of it */    \
+            /* crosses empty space */                                          \
+            if (++since_skip_check == SKIP_CHECK_INTERVAL) {                   \
+                since_skip_check = 0;                                          \
+                if (!leaves_scene &&                                           \
+                    scene_box_empty(prepared, next_pixel.x, next_pixel.y,      \
+                                    end.x, end.y)) {                           \
+                    STATS_ADD(space_skips, 1);                                 \
+                    STATS_ADD(rays_reached, 1);                                \
+                    return 1;                                                  \
+                }                                                              \
+            }                                                                  \
+        }                                                                      \
+    }
+
+#define SIGN(value) (((value) > 0) - ((value) < 0))
+
+/*
+ * Every step kernel with the signs of its direction, as
+ * X(kernel, name, step function, SX, SY)
+ */
+#define STEP_KERNELS(X)                                                        \
+    X(STEP_GENERIC, generic, step, SIGN(direction.x), SIGN(direction.y))      \
+    X(STEP_EAST, east, step_east, 1, 0)                                        \
+    X(STEP_WEST, west, step_west, -1, 0)                                       \
+    X(STEP_SOUTH, south, step_south, 0, 1)                                     \
+    X(STEP_NORTH, north, step_north, 0, -1)                                    \
+    X(STEP_SOUTH_EAST, south_east, step_south_east, 1, 1)                      \
+    X(STEP_SOUTH_WEST, south_west, step_south_west, -1, 1)                     \
+    X(STEP_NORTH_EAST, north_east, step_north_east, 1, -1)                     \
+    X(STEP_NORTH_WEST, north_west, step_north_west, -1, -1)                    \
+    X(STEP_DIAGONAL_SOUTH_EAST, diagonal_south_east, step_diagonal_south_east, \
+      1, 1)                                                                    \
+    X(STEP_DIAGONAL_SOUTH_WEST, diagonal_south_west, step_diagonal_south_west, \
+      -1, 1)                                                                   \
+    X(STEP_DIAGONAL_NORTH_EAST, diagonal_north_east, step_diagonal_north_east, \
+      1, -1)                                                                   \
+    X(STEP_DIAGONAL_NORTH_WEST, diagonal_north_west, step_diagonal_north_west, \
+      -1, -1)
+
+#define DEFINE_TRACES(kernel, name, STEP, SX, SY)                              \
+    DEFINE_TRACE(either_##name, STEP, SX, SY, REACH_EITHER_AXIS)               \
+    DEFINE_TRACE(both_##name, STEP, SX, SY, REACH_BOTH_AXES)
+STEP_KERNELS(DEFINE_TRACES)
+
+typedef int (*TraceFunction)(const PreparedScene* prepared, Pair pos,
+                             Pair direction, PixelLocation end,
+                             int leaves_scene, uint32_t* cost);
+
+#define EITHER_TRACE(kernel, name, STEP, SX, SY) [kernel] = trace_either_##name,
+#define BOTH_TRACE(kernel, name, STEP, SX, SY) [kernel] = trace_both_##name,
+static const TraceFunction traces[][STEP_KERNEL_COUNT] = {
+    [REACH_EITHER_AXIS] = { STEP_KERNELS(EITHER_TRACE) },
+    [REACH_BOTH_AXES] = { STEP_KERNELS(BOTH_TRACE) },
+};
+
+/*
+ * `light_visible` for a light in the same row or column as pixel (x, y), away
+ * from it. A ray from a pixel corner along an axis moves one pixel per step,
+ * so instead of stepping, scan the packed obstacle masks for the first
+ * obstacle strictly between the two, 64 pixels per word. Returns the same
+ * result, and counts the same steps, as tracing the ray would.
+ */
+static int axis_visible(const PreparedScene* prepared, int x, int y,
+                        PixelLocation end, uint32_t* cost) {
+    int horizontal = y == (int)end.y;
+    int from = horizontal ? x : y;
+    int to = horizontal ? (int)end.x : (int)end.y;
+    int sign = to > from ? 1 : -1;
+
+    // Pixels outside the window, and so beyond the scene, count as open
+    int blocked = -1;
+    if (to - from != sign) {
+        blocked = horizontal
+                      ? scene_row_obstacle(prepared, y, from + sign, to - sign)
+                      : scene_column_obstacle(prepared, x, from + sign, to - sign);
+    }
+    uint32_t steps = blocked < 0 ? abs(to - from) : abs(blocked - from);
+    STATS_ADD(steps, steps);
+    if (cost != NULL) {
+        *cost += steps;
+    }
+    if (blocked >= 0) {
+        STATS_ADD(rays_blocked, 1);
+        return 0;
+    }
+    STATS_ADD(rays_reached, 1);
+    return 1;
+}
+
+/*
+ * Returns 1 if the light at `end` is visible from pixel (x, y), and 0 if an
+ * obstacle lies in between. If `cost` is non-NULL, the number of steps the ray
+ * took is added to it.
+ */
+static int light_visible(const PreparedScene* prepared, int x, int y,
+                         PixelLocation end, ReachRule rule, uint32_t* cost) {
+    // Lights within the pixel's obstacle-free neighbourhood need no tracing
+    unsigned int x_dist = x > end.x ? x - end.x : end.x - x;
+    unsigned int y_dist = y > end.y ? y - end.y : end.y - y;
+    unsigned int reach = x_dist > y_dist ? x_dist : y_dist;
+    if (prepared->clearance != NULL &&
+        reach < prepared->clearance[scene_index(prepared, x, y)]) {
+        STATS_ADD(clearance_hits, 1);
+        return 1;
+    }
+
+    // So are lights in the pixel's own obstacle-free rectangle
+    if (scene_same_cell(prepared, x, y, end)) {
+        STATS_ADD(cell_hits, 1);
+        return 1;
+    }
+
+    // Lights standing in another connected region cannot be reached. Lights
+    // on obstacles or outside the window have no region, and are traced.
+    uint32_t light_region = scene_region(prepared, end);
+    if (light_region != 0 &&
+        light_region != prepared->regions[scene_index(prepared, x, y)]) {
+        STATS_ADD(region_culls, 1);
+        return 0;
+    }
+    STATS_ADD(rays_traced, 1);
+
+    // Rays towards a light inside the scene never leave it. Only rays towards
+    // lights beyond its edge need to skip the pixels outside.
+    int leaves_scene = end.x >= (unsigned int)prepared->scene_width ||
+                       end.y >= (unsigned int)prepared->scene_height;
+
+    // Lights in the same row or column need no stepping at all
+    if ((x == (int)end.x || y == (int)end.y) && (unsigned int)x < STEP_CORNER_LIMIT &&
+        (unsigned int)y < STEP_CORNER_LIMIT && end.x < STEP_CORNER_LIMIT &&
+        end.y < STEP_CORNER_LIMIT) {
+        return axis_visible(prepared, x, y, end, cost);
+    }
+
+    // Determine the direction from pixel (x,y) to the light source
+    PixelLocation start = { x, y };
+    Pair direction = direction_pair(start, end);
+
+    // We'll "walk" from the pixel towards the light, checking for obstacles,
+    // with the kernel specialized for this direction
+    Pair pos = { (double)x, (double)y };
+    StepKernel kernel = ray_step_kernel(start, end, direction);
+    return traces[rule][kernel](prepared, pos, direction, end, leaves_scene, cost);
+}
+
+/*
+ * Accumulate the illumination that lights `first_light` up to (but excluding)
+ * `end_light` contribute to the open pixel (x, y). If `cost` is non-NULL, the
+ * steps traced are added to it.
+ */
+static Color pixel_illumination(const PreparedScene* prepared, Light* lights,
+                                int first_light, int end_light, int x, int y,
+                                ReachRule rule, uint32_t* cost) {
+    Color total_illum = (Color){ 0, 0, 0 };
+
+    for (int l = first_light; l < end_light; l++) {
+        Light current_light = lights[l];
+
+        // If the pixel is the light source itself, it is always illuminated by
+        // that light. Otherwise the light must be visible from the pixel.
+        int self_lit = x == current_light.pixel.x && y == current_light.pixel.y;
+        STATS_ADD(self_light_hits, self_lit);
+        if (self_lit ||
+            light_visible(prepared, x, y, current_light.pixel, rule, cost)) {
+            Color illum = illuminate(current_light, x, y);
+            total_illum = add_colors(total_illum, illum);
+        }
+    }
+
+    return total_illum;
+}
+
+Image* raycast_prepared_sequential(const PreparedScene* prepared, Light* lights,
+                                   int light_count) {
+    Image* scene = prepared->image;
     // Create a new image of the same size as the scene
     Image* cast = new_image(scene->width, scene->height);
 
     // Iterate over every pixel in the scene
+    TraceSpan span = trace_begin("trace");
     for (int y = 0; y < scene->height; y++) {
         for (int x = 0; x < scene->width; x++) {
             Color orig = *image_pixel(scene, x, y);
             // If it's an obstacle pixel, it remains unchanged (no illumination passes through)
-            if (is_obstacle(orig)) {
+            if (scene_obstacle(prepared, x, y)) {
+                STATS_ADD(obstacle_pixels, 1);
                 *image_pixel(cast, x, y) = orig;
                 continue;
             }
 
             // Accumulate illumination from all lights
-            Color total_illum = (Color){ 0, 0, 0 };
-
-            for (int l = 0; l < light_count; l++) {
-                Light current_light = lights[l];
-
-                // If the pixel is the light source itself, it is always illuminated by that light.
-                if (x == current_light.pixel.x && y == current_light.pixel.y) {
-                    Color illum = illuminate(current_light, x, y);
-                    total_illum = add_colors(total_illum, illum);
-                    continue;
-                }
-
-                // Determine the direction from pixel (x,y) to the light source (lx,ly)
-                PixelLocation start = { x, y };
-                PixelLocation end = { current_light.pixel.x, current_light.pixel.y };
-                Pair direction = direction_pair(start, end);
-
-                // We'll "walk" from the pixel towards the light, checking for obstacles
-                Pair pos;
-                pos.x = (double)x;
-                pos.y = (double)y;
-
-                int occluded = 0;
-                // We step until we reach the light or hit an obstacle
-                // We must be careful to stop the loop once we have passed the light
-                // The direction_pair and step logic should guide us.
-                while (1) {
-                    PixelLocation next_pixel = step(&pos, direction);
-
-                    // If we have reached or passed the light
-                    if ((direction.x > 0 && next_pixel.x > end.x) ||
-                        (direction.x < 0 && next_pixel.x < end.x) ||
-                        (direction.y > 0 && next_pixel.y > end.y) ||
-                        (direction.y < 0 && next_pixel.y < end.y) ||
-                        (next_pixel.x == end.x && next_pixel.y == end.y)) {
-                        // Reached the light without hitting an obstacle
-                        break;
-                    }
-
-                    // Check if the new pixel is an obstacle
-                    Color step_color = *image_pixel(scene, next_pixel.x, next_pixel.y);
-                    if (is_obstacle(step_color)) {
-                        occluded = 1;
-                        break;
-                    }
-                }
-
-                // If not occluded, add this light's contribution
-                if (!occluded) {
-                    Color illum = illuminate(current_light, x, y);
-                    total_illum = add_colors(total_illum, illum);
-                }
-            }
+            Color total_illum = pixel_illumination(
+                prepared, lights, 0, light_count, x, y, REACH_EITHER_AXIS, NULL);
 
             // Multiply original pixel color by the total illumination
             *image_pixel(cast, x, y) = mul_colors(total_illum, orig);
         }
     }
+    stats_flush();
+    trace_end_region(span, 0, 0, scene->width, scene->height);
+    return cast;
+}
+
+Image* raycast_sequential(Image* scene, Light* lights, int light_count) {
+    PreparedScene* prepared = scene_prepare_once(scene);
+    Image* cast = raycast_prepared_sequential(prepared, lights, light_count);
+    free_prepared_scene(prepared);
     return cast;
 }
 
 typedef struct {
-    Image* scene;
+    const PreparedScene* prepared;
     Light* lights;
     int start_light;
     int end_light;
@@ -92,71 +356,33 @@ typedef struct {
 // Thread function that computes illumination from a subset of lights
 static void* parallel_lights_worker(void* arg) {
     ThreadDataLights* data = (ThreadDataLights*)arg;
-    Image* scene = data->scene;
-    Light* lights = data->lights;
+    const PreparedScene* prepared = data->prepared;
     Image* partial = data->partial_illum;
 
-    for (int y = 0; y < scene->height; y++) {
-        for (int x = 0; x < scene->width; x++) {
-            Color orig = *image_pixel(scene, x, y);
+    TraceSpan span = trace_begin("trace");
+    for (int y = 0; y < prepared->height; y++) {
+        for (int x = 0; x < prepared->width; x++) {
             // Obstacle pixels get no illumination
-            if (is_obstacle(orig)) {
+            if (scene_obstacle(prepared, x, y)) {
+                STATS_ADD(obstacle_pixels, 1);
                 *image_pixel(partial, x, y) = (Color){ 0, 0, 0 };
                 continue;
             }
 
-            Color total_illum = (Color){ 0, 0, 0 };
-            for (int l = data->start_light; l < data->end_light; l++) {
-                Light current_light = lights[l];
-
-                // If pixel is the light source, it's always illuminated
-                if (x == current_light.pixel.x && y == current_light.pixel.y) {
-                    Color illum = illuminate(current_light, x, y);
-                    total_illum = add_colors(total_illum, illum);
-                    continue;
-                }
-
-                // Compute direction from pixel to light
-                PixelLocation start = { x, y };
-                PixelLocation end = { current_light.pixel.x, current_light.pixel.y };
-                Pair direction = direction_pair(start, end);
-
-                Pair pos = { (double)x, (double)y };
-                int occluded = 0;
-
-                // Trace the ray towards the light
-                while (1) {
-                    PixelLocation next_pixel = step(&pos, direction);
-
-                    if ((direction.x > 0 && next_pixel.x >= end.x && direction.y > 0 && next_pixel.y >= end.y) ||
-                        (direction.x > 0 && next_pixel.x >= end.x && direction.y <= 0 && next_pixel.y <= end.y) ||
-                        (direction.x <= 0 && next_pixel.x <= end.x && direction.y > 0 && next_pixel.y >= end.y) ||
-                        (direction.x <= 0 && next_pixel.x <= end.x && direction.y <= 0 && next_pixel.y <= end.y) ||
-                        (next_pixel.x == end.x && next_pixel.y == end.y)) {
-                        break;
-                    }
-
-                    // Check for obstacle in the stepped pixel
-                    Color step_color = *image_pixel(scene, next_pixel.x, next_pixel.y);
-                    if (is_obstacle(step_color)) {
-                        occluded = 1;
-                        break;
-                    }
-                }
-
-                if (!occluded) {
-                    Color illum = illuminate(current_light, x, y);
-                    total_illum = add_colors(total_illum, illum);
-                }
-            }
-
-            *image_pixel(partial, x, y) = total_illum;
+            *image_pixel(partial, x, y) = pixel_illumination(
+                prepared, data->lights, data->start_light, data->end_light, x,
+                y, REACH_BOTH_AXES, NULL);
         }
     }
+    stats_flush();
+    trace_end(span);
     return NULL;
 }
 
-Image* raycast_parallel_lights(Image* scene, Light* lights, int light_count, int max_threads) {
+Image* raycast_prepared_parallel_lights(const PreparedScene* prepared,
+                                        Light* lights, int light_count,
+                                        int max_threads) {
+    Image* scene = prepared->image;
     if (light_count == 0) {
         return new_image(scene->width, scene->height);
     }
@@ -166,9 +392,11 @@ Image* raycast_parallel_lights(Image* scene, Light* lights, int light_count, int
     int lights_per_thread = light_count / num_threads;
     int remainder = light_count % num_threads;
 
-    pthread_t* threads = malloc(num_threads * sizeof(pthread_t));
-    ThreadDataLights* thread_data = malloc(num_threads * sizeof(ThreadDataLights));
+    pthread_t* threads = raycast_malloc(num_threads * sizeof(pthread_t));
+    ThreadDataLights* thread_data =
+        raycast_malloc(num_threads * sizeof(ThreadDataLights));
 
+    TraceSpan span = trace_begin("allocate");
     for (int i = 0; i < num_threads; i++) {
         int start_light = i * lights_per_thread + (i < remainder ? 1 : 0);
         int end_light = start_light + lights_per_thread + (i < remainder ? 1 : 0);
@@ -176,7 +404,7 @@ Image* raycast_parallel_lights(Image* scene, Light* lights, int light_count, int
         Image* partial = new_image(scene->width, scene->height);
 
         thread_data[i] = (ThreadDataLights){
-            .scene = scene,
+            .prepared = prepared,
             .lights = lights,
             .start_light = start_light,
             .end_light = end_light,
@@ -185,12 +413,14 @@ Image* raycast_parallel_lights(Image* scene, Light* lights, int light_count, int
 
         pthread_create(&threads[i], NULL, parallel_lights_worker, &thread_data[i]);
     }
+    trace_end(span);
 
     for (int i = 0; i < num_threads; i++) {
         pthread_join(threads[i], NULL);
     }
 
     // Combine partial illumination results
+    span = trace_begin("combine");
     Image* final_illum = new_image(scene->width, scene->height);
     for (int y = 0; y < scene->height; y++) {
         for (int x = 0; x < scene->width; x++) {
@@ -206,11 +436,13 @@ Image* raycast_parallel_lights(Image* scene, Light* lights, int light_count, int
                 *image_pixel(final_illum, x, y) = combined;
             }
         }
-        free(partial->pixels);
-        free(partial);
+        raycast_free(partial->pixels);
+        raycast_free(partial);
     }
+    trace_end(span);
 
     // Multiply by the original scene colors
+    span = trace_begin("multiply");
     Image* result = new_image(scene->width, scene->height);
     for (int y = 0; y < scene->height; y++) {
         for (int x = 0; x < scene->width; x++) {
@@ -219,113 +451,104 @@ Image* raycast_parallel_lights(Image* scene, Light* lights, int light_count, int
             *image_pixel(result, x, y) = mul_colors(illum, orig);
         }
     }
+    trace_end(span);
 
     // Clean up
-    free(final_illum->pixels);
-    free(final_illum);
-    free(threads);
-    free(thread_data);
+    raycast_free(final_illum->pixels);
+    raycast_free(final_illum);
+    raycast_free(threads);
+    raycast_free(thread_data);
 
     return result;
 }
 
+Image* raycast_parallel_lights(Image* scene, Light* lights, int light_count, int max_threads) {
+    PreparedScene* prepared = scene_prepare_once(scene);
+    Image* result = raycast_prepared_parallel_lights(prepared, lights,
+                                                     light_count, max_threads);
+    free_prepared_scene(prepared);
+    return result;
+}
+
 typedef struct {
-    Image* scene;
+    const PreparedScene* prepared;
     Light* lights;
     int light_count;
+    int x;         // left edge of the region, in scene coordinates
+    int width;     // width of the region
     int start_row;
     int end_row;   // end_row is exclusive
-    Image* result; // Each thread writes directly into this final image
+    Color* out;    // Each thread writes its rows of the region directly here
+    int out_stride;
+    uint32_t* cost; // Steps traced per pixel, with `out`'s layout, or NULL
 } ThreadDataRows;
 
-static void* parallel_rows_worker(void* arg) {
-    ThreadDataRows* data = (ThreadDataRows*)arg;
-    Image* scene = data->scene;
-    Light* lights = data->lights;
-    int light_count = data->light_count;
-    Image* result = data->result;
-
-    for (int y = data->start_row; y < data->end_row; y++) {
-        for (int x = 0; x < scene->width; x++) {
-            Color orig = *image_pixel(scene, x, y);
-            if (is_obstacle(orig)) {
-                // obstacle pixels remain unchanged
-                *image_pixel(result, x, y) = orig;
-                continue;
-            }
-
-            // accumulate illumination from all lights
-            Color total_illum = (Color){ 0, 0, 0 };
-            for (int l = 0; l < light_count; l++) {
-                Light current_light = lights[l];
+/*
+ * Returns the final color of scene pixel (x, y) under the sequential engine's
+ * rules. If `cost` is non-NULL, the steps traced for the pixel are added to it.
+ */
+static Color shade_pixel(const PreparedScene* prepared, Light* lights,
+                         int light_count, int x, int y, uint32_t* cost) {
+    size_t index = scene_index(prepared, x, y);
+    Color orig = prepared->image->pixels[index];
+    if (prepared->obstacles[index]) {
+        // obstacle pixels remain unchanged
+        STATS_ADD(obstacle_pixels, 1);
+        return orig;
+    }
+    // Unlit open pixels are black; regions far from every light are common
+    if (light_count == 0) {
+        return (Color){ 0, 0, 0 };
+    }
 
-                // If the pixel is the light source itself, it's always illuminated
-                if (x == current_light.pixel.x && y == current_light.pixel.y) {
-                    Color illum = illuminate(current_light, x, y);
-                    total_illum = add_colors(total_illum, illum);
-                    continue;
-                }
+    // accumulate illumination from all lights
+    Color total_illum = pixel_illumination(prepared, lights, 0, light_count,
+                                           x, y, REACH_EITHER_AXIS, cost);
 
-                // determine direction from pixel to the light
-                PixelLocation start = { x, y };
-                PixelLocation end = { current_light.pixel.x, current_light.pixel.y };
-                Pair direction = direction_pair(start, end);
-
-                Pair pos = { (double)x, (double)y };
-                int occluded = 0;
-
-                // trace the ray towards the light
-                while (1) {
-                    PixelLocation next_pixel = step(&pos, direction);
-
-                    // check if we have reached or passed the light
-                    if ((direction.x > 0 && next_pixel.x > end.x) ||
-                        (direction.x < 0 && next_pixel.x < end.x) ||
-                        (direction.y > 0 && next_pixel.y > end.y) ||
-                        (direction.y < 0 && next_pixel.y < end.y) ||
-                        (next_pixel.x == end.x && next_pixel.y == end.y)) {
-                        // reached the light
-                        break;
-                    }
-
-                    // Check if new pixel is an obstacle
-                    Color step_color = *image_pixel(scene, next_pixel.x, next_pixel.y);
-                    if (is_obstacle(step_color)) {
-                        occluded = 1;
-                        break;
-                    }
-                }
+    // multiply original pixel color by total illumination
+    return mul_colors(total_illum, orig);
+}
 
-                // if not occluded, add light's contribution
-                if (!occluded) {
-                    Color illum = illuminate(current_light, x, y);
-                    total_illum = add_colors(total_illum, illum);
-                }
-            }
+static void* parallel_rows_worker(void* arg) {
+    ThreadDataRows* data = (ThreadDataRows*)arg;
+    TraceSpan span = trace_begin("trace");
 
-            // multiply original pixel color by total illumination
-            *image_pixel(result, x, y) = mul_colors(total_illum, orig);
+    for (int y = data->start_row; y < data->end_row; y++) {
+        size_t row_offset = (size_t)(y - data->start_row) * data->out_stride;
+        Color* out_row = data->out + row_offset;
+        uint32_t* cost_row = data->cost != NULL ? data->cost + row_offset : NULL;
+        for (int x = data->x; x < data->x + data->width; x++) {
+            out_row[x - data->x] = shade_pixel(
+                data->prepared, data->lights, data->light_count, x, y,
+                cost_row != NULL ? &cost_row[x - data->x] : NULL);
         }
     }
 
+    stats_flush();
+    trace_end_region(span, data->x, data->start_row, data->width,
+                     data->end_row - data->start_row);
     return NULL;
 }
 
-Image* raycast_parallel_rows(Image* scene, Light* lights, int light_count, int max_threads) {
-    if (light_count == 0) {
-        return new_image(scene->width, scene->height);
+/*
+ * Same as `render_region`, also adding the steps traced for each pixel to
+ * `cost` (laid out like `out`) unless it is NULL.
+ */
+static void render_rows(const PreparedScene* prepared, Light* lights,
+                        int light_count, int x, int y, int width, int height,
+                        Color* out, int out_stride, uint32_t* cost,
+                        int max_threads) {
+    int num_threads = (max_threads < height) ? max_threads : height;
+    if (num_threads < 1) {
+        num_threads = 1;
     }
+    pthread_t* threads = raycast_malloc(num_threads * sizeof(pthread_t));
+    ThreadDataRows* thread_data = raycast_malloc(num_threads * sizeof(ThreadDataRows));
 
-    int num_threads = (max_threads < scene->height) ? max_threads : scene->height;
-    pthread_t* threads = malloc(num_threads * sizeof(pthread_t));
-    ThreadDataRows* thread_data = malloc(num_threads * sizeof(ThreadDataRows));
-
-    Image* result = new_image(scene->width, scene->height);
+    int rows_per_thread = height / num_threads;
+    int remainder = height % num_threads;
 
-    int rows_per_thread = scene->height / num_threads;
-    int remainder = scene->height % num_threads;
-
-    int current_start = 0;
+    int current_start = y;
     for (int i = 0; i < num_threads; i++) {
         int rows_for_this_thread = rows_per_thread + (i < remainder ? 1 : 0);
         int start_row = current_start;
@@ -333,23 +556,289 @@ Image* raycast_parallel_rows(Image* scene, Light* lights, int light_count, int m
         current_start = end_row;
 
         thread_data[i] = (ThreadDataRows){
-            .scene = scene,
+            .prepared = prepared,
             .lights = lights,
             .light_count = light_count,
+            .x = x,
+            .width = width,
             .start_row = start_row,
             .end_row = end_row,
-            .result = result
+            .out = out + (size_t)(start_row - y) * out_stride,
+            .out_stride = out_stride,
+            .cost = cost != NULL ? cost + (size_t)(start_row - y) * out_stride : NULL
         };
+    }
 
-        pthread_create(&threads[i], NULL, parallel_rows_worker, &thread_data[i]);
+    // A single band is rendered on the calling thread
+    if (num_threads == 1) {
+        parallel_rows_worker(&thread_data[0]);
+    }
+    else {
+        for (int i = 0; i < num_threads; i++) {
+            pthread_create(&threads[i], NULL, parallel_rows_worker, &thread_data[i]);
+        }
+        for (int i = 0; i < num_threads; i++) {
+            pthread_join(threads[i], NULL);
+        }
     }
 
-    for (int i = 0; i < num_threads; i++) {
-        pthread_join(threads[i], NULL);
+    raycast_free(threads);
+    raycast_free(thread_data);
+}
+
+void render_region(const PreparedScene* prepared, Light* lights,
+                   int light_count, int x, int y, int width, int height,
+                   Color* out, int out_stride, int max_threads) {
+    render_rows(prepared, lights, light_count, x, y, width, height, out,
+                out_stride, NULL, max_threads);
+}
+
+size_t render_region_bytes(int max_threads) {
+    size_t num_threads = max_threads > 1 ? max_threads : 1;
+    return num_threads * (sizeof(pthread_t) + sizeof(ThreadDataRows));
+}
+
+Image* raycast_prepared_parallel_rows(const PreparedScene* prepared,
+                                      Light* lights, int light_count,
+                                      int max_threads) {
+    Image* scene = prepared->image;
+    TraceSpan span = trace_begin("allocate");
+    Image* result = new_image(scene->width, scene->height);
+    trace_end(span);
+    if (light_count == 0) {
+        return result;
+    }
+
+    render_region(prepared, lights, light_count, 0, 0, scene->width,
+                  scene->height, result->pixels, scene->width, max_threads);
+
+    return result;
+}
+
+Image* raycast_parallel_rows(Image* scene, Light* lights, int light_count, int max_threads) {
+    PreparedScene* prepared = scene_prepare_once(scene);
+    Image* result = raycast_prepared_parallel_rows(prepared, lights, light_count,
+                                                   max_threads);
+    free_prepared_scene(prepared);
+    return result;
+}
+
+typedef struct {
+    const PreparedScene* prepared;
+    Light* lights;
+    int light_count;
+    int step;       // sample spacing of this level
+    int start_row;  // first sample row, a multiple of `step`
+    int end_row;    // end_row is exclusive
+    Image* out;
+} ThreadDataProgressive;
+
+static void* progressive_worker(void* arg) {
+    ThreadDataProgressive* data = (ThreadDataProgressive*)arg;
+    Image* out = data->out;
+    int step = data->step;
+    // Samples on the coarser levels' lattice are already rendered
+    int coarser = step < PROGRESSIVE_FIRST_STEP ? 2 * step : 0;
+
+    TraceSpan span = trace_begin("trace");
+    for (int y = data->start_row; y < data->end_row; y += step) {
+        for (int x = 0; x < out->width; x += step) {
+            if (coarser && x % coarser == 0 && y % coarser == 0) {
+                continue;
+            }
+            *image_pixel(out, x, y) = shade_pixel(data->prepared, data->lights,
+                                                  data->light_count, x, y, NULL);
+        }
+
+        // Fill the rest of this sample row's band from its samples
+        if (step == 1) {
+            continue;
+        }
+        int band_end = y + step < out->height ? y + step : out->height;
+        for (int fill_y = y; fill_y < band_end; fill_y++) {
+            for (int x = 0; x < out->width; x++) {
+                if (fill_y != y || x % step != 0) {
+                    *image_pixel(out, x, fill_y) = *image_pixel(out, x - x % step, y);
+                }
+            }
+        }
+    }
+
+    stats_flush();
+    trace_end_region(span, 0, data->start_row, out->width,
+                     data->end_row - data->start_row);
+    return NULL;
+}
+
+Image* raycast_prepared_progressive(const PreparedScene* prepared, Light* lights,
+                                    int light_count, int max_threads,
+                                    ProgressCallback callback, void* context) {
+    Image* scene = prepared->image;
+    Image* result = new_image(scene->width, scene->height);
+    // The last level samples every row, so it never needs more threads
+    int thread_limit = max_threads < scene->height ? max_threads : scene->height;
+    if (thread_limit < 1) {
+        thread_limit = 1;
+    }
+    pthread_t* threads = raycast_malloc(sizeof(pthread_t) * thread_limit);
+    ThreadDataProgressive* thread_data =
+        raycast_malloc(sizeof(ThreadDataProgressive) * thread_limit);
+
+    for (int step = PROGRESSIVE_FIRST_STEP; step >= 1; step /= 2) {
+        // Split this level's sample rows evenly over the threads
+        int sample_rows = (scene->height + step - 1) / step;
+        int num_threads = thread_limit < sample_rows ? thread_limit : sample_rows;
+        if (num_threads < 1) {
+            num_threads = 1;
+        }
+        int current_start = 0;
+        for (int i = 0; i < num_threads; i++) {
+            int rows = sample_rows / num_threads + (i < sample_rows % num_threads);
+            thread_data[i] = (ThreadDataProgressive){
+                .prepared = prepared,
+                .lights = lights,
+                .light_count = light_count,
+                .step = step,
+                .start_row = current_start * step,
+                .end_row = (current_start + rows) * step,
+                .out = result,
+            };
+            current_start += rows;
+        }
+
+        if (num_threads == 1) {
+            progressive_worker(&thread_data[0]);
+        }
+        else {
+            for (int i = 0; i < num_threads; i++) {
+                pthread_create(&threads[i], NULL, progressive_worker, &thread_data[i]);
+            }
+            for (int i = 0; i < num_threads; i++) {
+                pthread_join(threads[i], NULL);
+            }
+        }
+
+        if (callback != NULL && callback(result, step, context) != 0) {
+            break;
+        }
     }
 
-    free(threads);
-    free(thread_data);
+    raycast_free(threads);
+    raycast_free(thread_data);
+    return result;
+}
 
+Image* raycast_prepared_cost(const PreparedScene* prepared, Light* lights,
+                             int light_count, int max_threads, uint32_t* cost) {
+    Image* scene = prepared->image;
+    Image* result = new_image(scene->width, scene->height);
+    memset(cost, 0, sizeof(uint32_t) * scene->width * scene->height);
+    render_rows(prepared, lights, light_count, 0, 0, scene->width,
+                scene->height, result->pixels, scene->width, cost, max_threads);
     return result;
 }
+
+Image* cost_heatmap(const uint32_t* cost, int width, int height) {
+    Image* heatmap = new_image(width, height);
+    size_t pixel_count = (size_t)width * height;
+    uint32_t max_cost = 0;
+    for (size_t i = 0; i < pixel_count; i++) {
+        if (cost[i] > max_cost) {
+            max_cost = cost[i];
+        }
+    }
+    if (max_cost == 0) {
+        return heatmap;
+    }
+
+    // Black through red and yellow to white, each third of the range adding
+    // one channel
+    for (size_t i = 0; i < pixel_count; i++) {
+        double level = 3.0 * cost[i] / max_cost;
+        double channels[3] = { level, level - 1, level - 2 };
+        uint8_t values[3];
+        for (int c = 0; c < 3; c++) {
+            double channel = channels[c] < 0 ? 0 : channels[c] > 1 ? 1 : channels[c];
+            values[c] = (uint8_t)(channel * 255 + 0.5);
+        }
+        heatmap->pixels[i] = (Color){ values[0], values[1], values[2] };
+    }
+    return heatmap;
+}
+
+int raycast_prepared_region(const PreparedScene* prepared, Light* lights,
+                            int light_count, int x, int y, int width,
+                            int height, Color* out, int out_stride,
+                            int max_threads) {
+    if (x < prepared->origin_x || y < prepared->origin_y || width < 0 ||
+        height < 0 || width > prepared->origin_x + prepared->width - x ||
+        height > prepared->origin_y + prepared->height - y ||
+        out_stride < width) {
+        return -1;
+    }
+    if (width == 0 || height == 0) {
+        return 0;
+    }
+
+    // Lights beyond their radius of every pixel in the region would only add
+    // black, so dropping them leaves the result unchanged
+    Light* region_lights = raycast_malloc(sizeof(Light) * (light_count + 1));
+    int region_light_count = 0;
+    for (int l = 0; l < light_count; l++) {
+        double x_gap = axis_gap(lights[l].pixel.x, x, x + width);
+        double y_gap = axis_gap(lights[l].pixel.y, y, y + height);
+        double radius = light_radius(lights[l]);
+        if (x_gap * x_gap + y_gap * y_gap <= radius * radius) {
+            region_lights[region_light_count++] = lights[l];
+        }
+    }
+
+    render_region(prepared, region_lights, region_light_count, x, y, width,
+                  height, out, out_stride, max_threads);
+    raycast_free(region_lights);
+    return 0;
+}
+
+int raycast_region(Image* scene, Light* lights, int light_count, int x, int y,
+                   int width, int height, Color* out, int out_stride,
+                   int max_threads) {
+    PreparedScene* prepared = scene_prepare_once(scene);
+    int result = raycast_prepared_region(prepared, lights, light_count, x, y,
+                                         width, height, out, out_stride,
+                                         max_threads);
+    free_prepared_scene(prepared);
+    return result;
+}
+
+static const char* engine_names[ENGINE_COUNT] = {
+    [ENGINE_SEQUENTIAL] = "sequential",
+    [ENGINE_PARALLEL_LIGHTS] = "lights",
+    [ENGINE_PARALLEL_ROWS] = "rows",
+};
+
+const char* raycast_engine_name(RaycastEngine engine) {
+    return engine_names[engine];
+}
+
+int raycast_engine_parse(const char* name) {
+    for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+        if (strcmp(name, engine_names[engine]) == 0) {
+            return engine;
+        }
+    }
+    return -1;
+}
+
+Image* raycast_prepared(const PreparedScene* prepared, RaycastEngine engine,
+                        Light* lights, int light_count, int max_threads) {
+    switch (engine) {
+    case ENGINE_PARALLEL_LIGHTS:
+        return raycast_prepared_parallel_lights(prepared, lights, light_count,
+                                                max_threads);
+    case ENGINE_PARALLEL_ROWS:
+        return raycast_prepared_parallel_rows(prepared, lights, light_count,
+                                              max_threads);
+    default:
+        return raycast_prepared_sequential(prepared, lights, light_count);
+    }
+}
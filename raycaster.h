@@ -1,6 +1,8 @@
 #ifndef __RAYCASTER_H__
 #define __RAYCASTER_H__
 
+#include <stdint.h>
+
 #include "image.h"
 #include "raycaster_util.h"
 
@@ -32,4 +34,193 @@ Image* raycast_parallel_lights(Image* scene, Light* lights, int light_count,
 Image* raycast_parallel_rows(Image* image, Light* lights, int light_count,
                              int max_threads);
 
+/*
+ * A scene that has been preprocessed for rendering.
+ *
+ * Preparing a scene classifies every pixel as obstacle or open space and
+ * builds the acceleration data the engines use, once. Any number of renders,
+ * with any lights, can then reuse it. The handle is opaque; create it with
+ * `raycast_prepare` and release it with `free_prepared_scene`.
+ */
+typedef struct PreparedScene PreparedScene;
+
+/*
+ * Preprocess `scene` for rendering.
+ *
+ * The prepared scene borrows `scene`: it must stay alive until the prepared
+ * scene is freed, and be modified only as `raycast_update_scene` allows.
+ */
+PreparedScene* raycast_prepare(Image* scene);
+
+/*
+ * Bring a prepared scene up to date after the pixels of the `width` x `height`
+ * rectangle of its image whose top-left pixel is (x, y) were changed. The
+ * obstacle data the rays walk is updated for that rectangle alone, in time
+ * proportional to its area; the clearance and region data, which span the
+ * whole scene, are rebuilt. No render may use the scene meanwhile.
+ *
+ * Returns 0 on success and -1 if the rectangle is not inside the image or the
+ * scene was loaded with `map_scene_file`, whose data is read-only.
+ */
+int raycast_update_scene(PreparedScene* prepared, int x, int y, int width,
+                         int height);
+
+/*
+ * Deallocate a prepared scene. A borrowed scene image is not freed.
+ */
+void free_prepared_scene(PreparedScene* prepared);
+
+/*
+ * Get the scene image a prepared scene renders. Its pixels must not be
+ * modified while the prepared scene is alive, except as `raycast_update_scene`
+ * allows.
+ */
+Image* prepared_scene_image(const PreparedScene* prepared);
+
+/*
+ * Same as `raycast_sequential`, rendering a prepared scene.
+ */
+Image* raycast_prepared_sequential(const PreparedScene* prepared, Light* lights,
+                                   int light_count);
+
+/*
+ * Same as `raycast_parallel_lights`, rendering a prepared scene.
+ */
+Image* raycast_prepared_parallel_lights(const PreparedScene* prepared,
+                                        Light* lights, int light_count,
+                                        int max_threads);
+
+/*
+ * Same as `raycast_parallel_rows`, rendering a prepared scene.
+ */
+Image* raycast_prepared_parallel_rows(const PreparedScene* prepared,
+                                      Light* lights, int light_count,
+                                      int max_threads);
+
+/*
+ * Render only the `width` x `height` rectangle of a prepared scene whose
+ * top-left pixel is (x, y) into `out`, a caller-provided buffer with
+ * `out_stride` pixels per row. Rays still cross, and lights still shine from,
+ * the whole scene: the result is exactly that rectangle of
+ * `raycast_sequential`'s render. Lights too far away to reach the rectangle
+ * are skipped, and its rows are split over up to `max_threads` threads.
+ *
+ * Returns 0 on success and -1 if the rectangle is not inside the scene or
+ * `out_stride` is less than `width`.
+ */
+int raycast_prepared_region(const PreparedScene* prepared, Light* lights,
+                            int light_count, int x, int y, int width,
+                            int height, Color* out, int out_stride,
+                            int max_threads);
+
+/*
+ * Same as `raycast_prepared_region`, for a scene that is not prepared yet.
+ * Preparing costs a pass over the whole scene, so prepare it once instead when
+ * rendering many regions of the same scene.
+ */
+int raycast_region(Image* scene, Light* lights, int light_count, int x, int y,
+                   int width, int height, Color* out, int out_stride,
+                   int max_threads);
+
+/*
+ * Render a prepared scene like `raycast_sequential`, on up to `max_threads`
+ * threads, while measuring where the time goes: `cost` (`width * height`
+ * values, row-major) receives the number of ray steps traced for each pixel,
+ * summed over all lights. Obstacles, and lights seen without tracing, cost 0.
+ */
+Image* raycast_prepared_cost(const PreparedScene* prepared, Light* lights,
+                             int light_count, int max_threads, uint32_t* cost);
+
+/*
+ * Turn per-pixel costs into a heatmap image for `write_image`: black for no
+ * cost through red and yellow to white for the most expensive pixel.
+ */
+Image* cost_heatmap(const uint32_t* cost, int width, int height);
+
+/*
+ * Called by `raycast_prepared_progressive` after each refinement level with
+ * the preview so far and the level's sample spacing. Return 0 to continue
+ * refining, or nonzero to stop and return the current preview.
+ */
+typedef int (*ProgressCallback)(const Image* preview, int step, void* context);
+
+// Sample spacing of the first, coarsest progressive level
+#define PROGRESSIVE_FIRST_STEP 8
+
+/*
+ * Render a prepared scene coarse to fine. The first level renders every
+ * PROGRESSIVE_FIRST_STEP-th pixel of every PROGRESSIVE_FIRST_STEP-th row; each
+ * later level halves the spacing and renders only the new samples, down to a
+ * spacing of 1. After each level, every pixel not rendered yet takes the color
+ * of the sample above and left of it, and `callback` (if non-NULL) is called
+ * with the preview.
+ *
+ * Every pixel is rendered once, by the same rules as `raycast_sequential`, so
+ * the final image matches its render exactly. Rows are split over up to
+ * `max_threads` threads.
+ */
+Image* raycast_prepared_progressive(const PreparedScene* prepared, Light* lights,
+                                    int light_count, int max_threads,
+                                    ProgressCallback callback, void* context);
+
+/*
+ * The rendering engines, for callers that choose one at run time.
+ */
+typedef enum {
+    ENGINE_SEQUENTIAL,
+    ENGINE_PARALLEL_LIGHTS,
+    ENGINE_PARALLEL_ROWS,
+    ENGINE_COUNT,
+} RaycastEngine;
+
+/*
+ * Returns the engine's name: "sequential", "lights" or "rows".
+ */
+const char* raycast_engine_name(RaycastEngine engine);
+
+/*
+ * Returns the engine with the given name, or -1 if there is none.
+ */
+int raycast_engine_parse(const char* name);
+
+/*
+ * Render a prepared scene with the given engine. `max_threads` is ignored by
+ * the sequential engine.
+ */
+Image* raycast_prepared(const PreparedScene* prepared, RaycastEngine engine,
+                        Light* lights, int light_count, int max_threads);
+
+/*
+ * Traversal counters, summed over every thread and render.
+ *
+ * The engines only count when built with -DRAYCAST_STATS; otherwise the
+ * counting code is compiled out entirely. Each thread counts privately and
+ * adds its counts to the process-wide totals as it finishes its share of a
+ * render.
+ */
+typedef struct {
+    uint64_t obstacle_pixels; // obstacle pixels skipped without any lighting
+    uint64_t self_light_hits; // lights found on the very pixel being lit
+    uint64_t clearance_hits;  // lights seen without tracing, by clearance
+    uint64_t cell_hits;       // lights seen without tracing, in one rectangle
+    uint64_t region_culls;    // lights in another region, skipped untraced
+    uint64_t rays_traced;     // rays stepped towards a light
+    uint64_t steps;           // `step` calls made by those rays
+    uint64_t rays_blocked;    // rays stopped by an obstacle
+    uint64_t rays_reached;    // rays that reached their light
+    uint64_t space_skips;     // of those, rays ended early in empty space
+} RaycastStats;
+
+/*
+ * Copy the totals counted since the last `raycast_stats_reset` into `stats`.
+ * Returns 0 on success, or -1 (with `stats` zeroed) if the engines were built
+ * without counters.
+ */
+int raycast_stats(RaycastStats* stats);
+
+/*
+ * Zero the process-wide totals.
+ */
+void raycast_stats_reset(void);
+
 #endif // __RAYCASTER_H__
@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <math.h>
 
 #include "raycaster_util.h"
@@ -130,3 +131,35 @@ Color illuminate(Light light, int x, int y) {
 
     return scale_color(light.color, illumination);
 }
+
+unsigned int light_radius(Light light) {
+    uint8_t brightest = light.color.red;
+    if (light.color.green > brightest) {
+        brightest = light.color.green;
+    }
+    if (light.color.blue > brightest) {
+        brightest = light.color.blue;
+    }
+    if (brightest == 0) {
+        return 0;
+    }
+    if (!(light.strength > 0)) {
+        return UINT_MAX;
+    }
+
+    // A component truncates to zero once brightest * exp(-d^2 / strength) < 1,
+    // i.e. d^2 > strength * ln(brightest). Pad both terms so rounding in
+    // `illuminate` and `scale_color` can never push it back above zero.
+    double radius = ceil(sqrt(light.strength * (log(brightest) + 0.01))) + 1;
+    return radius < UINT_MAX ? (unsigned int)radius : UINT_MAX;
+}
+
+double axis_gap(unsigned int value, int start, int end) {
+    if ((int)value < start) {
+        return start - (double)value;
+    }
+    if ((int)value >= end) {
+        return (double)value - (end - 1);
+    }
+    return 0;
+}
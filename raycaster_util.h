@@ -98,4 +98,18 @@ PixelLocation step(Pair* pos, Pair direction);
  */
 Color illuminate(Light light, int x, int y);
 
+/*
+ * Returns a radius beyond which the given light source contributes nothing:
+ * `illuminate` returns black for every location whose squared distance to the
+ * light exceeds the square of this radius
+ * Returns UINT_MAX for lights whose reach is unbounded
+ */
+unsigned int light_radius(Light light);
+
+/*
+ * Returns the distance from `value` to the range [start, end) along one axis,
+ * or 0 if the value lies inside it
+ */
+double axis_gap(unsigned int value, int start, int end);
+
 #endif // __RAYCAST_UTIL_H__
@@ -0,0 +1,714 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "alloc.h"
+#include "scene.h"
+#include "trace.h"
+
+// Add one to a clearance value without wrapping past `CLEARANCE_MAX`.
+static uint16_t clearance_next(uint16_t value) {
+    return value == CLEARANCE_MAX ? CLEARANCE_MAX : value + 1;
+}
+
+/*
+ * Fill `clearance` with the Chebyshev distance from every pixel to the nearest
+ * obstacle. This is the classic two-pass chamfer transform: with unit weights
+ * on all eight neighbours it is exact for the Chebyshev metric.
+ */
+static void build_clearance(PreparedScene* prepared) {
+    int width = prepared->width;
+    int height = prepared->height;
+    uint16_t* dist = prepared->clearance;
+
+    // Forward pass: top-left to bottom-right, looking at the already visited
+    // neighbours to the left and in the row above.
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            size_t index = (size_t)y * width + x;
+            if (prepared->obstacles[index]) {
+                dist[index] = 0;
+                continue;
+            }
+            uint16_t best = CLEARANCE_MAX;
+            if (x > 0 && dist[index - 1] < best) {
+                best = dist[index - 1];
+            }
+            if (y > 0) {
+                size_t up = index - width;
+                if (dist[up] < best) {
+                    best = dist[up];
+                }
+                if (x > 0 && dist[up - 1] < best) {
+                    best = dist[up - 1];
+                }
+                if (x < width - 1 && dist[up + 1] < best) {
+                    best = dist[up + 1];
+                }
+            }
+            dist[index] = clearance_next(best);
+        }
+    }
+
+    // Backward pass: bottom-right to top-left, mirroring the forward pass.
+    for (int y = height - 1; y >= 0; y--) {
+        for (int x = width - 1; x >= 0; x--) {
+            size_t index = (size_t)y * width + x;
+            uint16_t best = dist[index];
+            if (best == 0) {
+                continue;
+            }
+            if (x < width - 1 && clearance_next(dist[index + 1]) < best) {
+                best = clearance_next(dist[index + 1]);
+            }
+            if (y < height - 1) {
+                size_t down = index + width;
+                if (clearance_next(dist[down]) < best) {
+                    best = clearance_next(dist[down]);
+                }
+                if (x > 0 && clearance_next(dist[down - 1]) < best) {
+                    best = clearance_next(dist[down - 1]);
+                }
+                if (x < width - 1 && clearance_next(dist[down + 1]) < best) {
+                    best = clearance_next(dist[down + 1]);
+                }
+            }
+            dist[index] = best;
+        }
+    }
+}
+
+/*
+ * Fill `row_mask` and `column_mask` from `obstacles`.
+ */
+static void build_masks(PreparedScene* prepared) {
+    int width = prepared->width;
+    int height = prepared->height;
+    for (int y = 0; y < height; y++) {
+        uint64_t* row = prepared->row_mask + (size_t)y * prepared->row_words;
+        for (int x = 0; x < width; x++) {
+            if (prepared->obstacles[(size_t)y * width + x]) {
+                row[x / 64] |= (uint64_t)1 << (x % 64);
+                prepared->column_mask[(size_t)x * prepared->column_words + y / 64] |=
+                    (uint64_t)1 << (y % 64);
+            }
+        }
+    }
+}
+
+// Returns the root of `label`'s set, halving the path to it on the way.
+static uint32_t region_root(uint32_t* parent, uint32_t label) {
+    while (parent[label] != label) {
+        parent[label] = parent[parent[label]];
+        label = parent[label];
+    }
+    return label;
+}
+
+/*
+ * Fill `regions` with a label per connected region of open pixels, joining
+ * pixels to all eight neighbours. One pass gives each open pixel the label of
+ * an open neighbour already visited (or a new one) and records which labels
+ * meet; a second pass replaces every label with the smallest it met, through
+ * a union-find forest kept so that each label's parent is never larger than
+ * the label itself.
+ */
+static void build_regions(PreparedScene* prepared) {
+    int width = prepared->width;
+    int height = prepared->height;
+    uint32_t* regions = prepared->regions;
+    size_t capacity = 64;
+    uint32_t* parent = (uint32_t*)raycast_malloc(sizeof(uint32_t) * capacity);
+    uint32_t count = 0;
+    parent[0] = 0; // obstacles keep label 0
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            size_t index = (size_t)y * width + x;
+            regions[index] = 0;
+            if (prepared->obstacles[index]) {
+                continue;
+            }
+            // The neighbours already visited: left, and the three above
+            size_t neighbours[4];
+            int neighbour_count = 0;
+            if (x > 0) {
+                neighbours[neighbour_count++] = index - 1;
+            }
+            if (y > 0) {
+                size_t up = index - width;
+                neighbours[neighbour_count++] = up;
+                if (x > 0) {
+                    neighbours[neighbour_count++] = up - 1;
+                }
+                if (x < width - 1) {
+                    neighbours[neighbour_count++] = up + 1;
+                }
+            }
+
+            uint32_t label = 0;
+            for (int n = 0; n < neighbour_count; n++) {
+                if (regions[neighbours[n]] == 0) {
+                    continue;
+                }
+                uint32_t root = region_root(parent, regions[neighbours[n]]);
+                if (label == 0 || root == label) {
+                    label = root;
+                }
+                else if (root < label) {
+                    parent[label] = root;
+                    label = root;
+                }
+                else {
+                    parent[root] = label;
+                }
+            }
+            if (label == 0) {
+                label = ++count;
+                if (label >= capacity) {
+                    capacity *= 2;
+                    parent = (uint32_t*)raycast_realloc(
+                        parent, sizeof(uint32_t) * capacity);
+                }
+                parent[label] = label;
+            }
+            regions[index] = label;
+        }
+    }
+
+    // Every parent is smaller than its label, so in increasing order each
+    // parent has already been pointed at its root
+    for (uint32_t label = 1; label <= count; label++) {
+        parent[label] = parent[parent[label]];
+    }
+    size_t pixel_count = (size_t)width * height;
+    for (size_t i = 0; i < pixel_count; i++) {
+        regions[i] = parent[regions[i]];
+    }
+    raycast_free(parent);
+}
+
+/*
+ * Fill `cell_of` and `cells` by splitting open space into rectangles,
+ * greedily: the first open pixel not yet in a rectangle, in row-major order,
+ * starts a new one, which takes the widest run of such pixels to its right
+ * and then every row below that is open across the whole run.
+ */
+static void build_cells(PreparedScene* prepared) {
+    int width = prepared->width;
+    int height = prepared->height;
+    uint32_t* cell_of = prepared->cell_of;
+    size_t capacity = 64;
+    SceneCell* cells = (SceneCell*)raycast_malloc(sizeof(SceneCell) * capacity);
+    uint32_t count = 1;
+    cells[0] = (SceneCell){ 1, 1, 0, 0 }; // contains nothing
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            size_t index = (size_t)y * width + x;
+            if (prepared->obstacles[index] || cell_of[index] != 0) {
+                continue;
+            }
+            int x1 = x;
+            while (x1 + 1 < width && !prepared->obstacles[index + x1 + 1 - x] &&
+                   cell_of[index + x1 + 1 - x] == 0) {
+                x1++;
+            }
+            // Rows below are free of other rectangles under this run, since a
+            // rectangle reaching them from above would also cover this row
+            int y1 = y;
+            while (y1 + 1 < height &&
+                   scene_row_obstacle(prepared, prepared->origin_y + y1 + 1,
+                                      prepared->origin_x + x,
+                                      prepared->origin_x + x1) < 0) {
+                y1++;
+            }
+
+            if (count == capacity) {
+                capacity *= 2;
+                cells = (SceneCell*)raycast_realloc(cells,
+                                                    sizeof(SceneCell) * capacity);
+            }
+            cells[count] = (SceneCell){ x, y, x1, y1 };
+            for (int cell_y = y; cell_y <= y1; cell_y++) {
+                for (int cell_x = x; cell_x <= x1; cell_x++) {
+                    cell_of[(size_t)cell_y * width + cell_x] = count;
+                }
+            }
+            count++;
+        }
+    }
+    prepared->cells = cells;
+    prepared->cell_count = count;
+}
+
+// Number of blocks across and down level `level` of the occupancy pyramid.
+static int level_width(const PreparedScene* prepared, int level) {
+    return ((prepared->width - 1) >> level) + 1;
+}
+
+static int level_height(const PreparedScene* prepared, int level) {
+    return ((prepared->height - 1) >> level) + 1;
+}
+
+/*
+ * Recompute every pyramid block above the window pixels from (x0, y0) to
+ * (x1, y1), both included, from the level below it.
+ */
+static void refresh_occupancy(PreparedScene* prepared, int x0, int y0, int x1,
+                              int y1) {
+    for (int level = 1; level <= prepared->levels; level++) {
+        const uint8_t* below = prepared->occupancy[level - 1];
+        int below_width = level_width(prepared, level - 1);
+        int below_height = level_height(prepared, level - 1);
+        uint8_t* blocks = prepared->occupancy[level];
+        int width = level_width(prepared, level);
+        for (int block_y = y0 >> level; block_y <= y1 >> level; block_y++) {
+            for (int block_x = x0 >> level; block_x <= x1 >> level; block_x++) {
+                int end_x = 2 * block_x + 2 < below_width ? 2 * block_x + 2
+                                                           : below_width;
+                int end_y = 2 * block_y + 2 < below_height ? 2 * block_y + 2
+                                                            : below_height;
+                uint8_t any = 0;
+                for (int y = 2 * block_y; y < end_y; y++) {
+                    for (int x = 2 * block_x; x < end_x; x++) {
+                        any |= below[(size_t)y * below_width + x];
+                    }
+                }
+                blocks[(size_t)block_y * width + block_x] = any;
+            }
+        }
+    }
+}
+
+/*
+ * Allocate the occupancy pyramid's levels above `obstacles`, in one block of
+ * memory, and fill them. If `occupancy[1]` is already set, it holds the
+ * filled levels (from a scene file), which are only sliced.
+ */
+static void build_occupancy(PreparedScene* prepared) {
+    prepared->levels = 0;
+    while (level_width(prepared, prepared->levels) > 1 ||
+           level_height(prepared, prepared->levels) > 1) {
+        prepared->levels++;
+    }
+    prepared->occupancy[0] = prepared->obstacles;
+    if (prepared->levels == 0) {
+        return;
+    }
+    uint8_t* stored = prepared->occupancy[1];
+    uint8_t* levels = stored != NULL
+                          ? stored
+                          : (uint8_t*)raycast_malloc(
+                                scene_pyramid_bytes(prepared->width, prepared->height));
+    for (int level = 1; level <= prepared->levels; level++) {
+        prepared->occupancy[level] = levels;
+        levels += (size_t)level_width(prepared, level) * level_height(prepared, level);
+    }
+    if (stored == NULL) {
+        refresh_occupancy(prepared, 0, 0, prepared->width - 1, prepared->height - 1);
+    }
+}
+
+size_t scene_pyramid_bytes(int width, int height) {
+    size_t bytes = 0;
+    for (int level = 1; level < OCCUPANCY_LEVELS_MAX &&
+                        ((width - 1) >> (level - 1) > 0 ||
+                         (height - 1) >> (level - 1) > 0);
+         level++) {
+        bytes += (size_t)(((width - 1) >> level) + 1) *
+                 (((height - 1) >> level) + 1);
+    }
+    return bytes;
+}
+
+/*
+ * Returns 1 if block (block_x, block_y) of pyramid level `level` holds an
+ * obstacle inside the window box from (x0, y0) to (x1, y1). Empty blocks
+ * answer at once, as do occupied blocks wholly inside the box; blocks the box
+ * only partly covers ask their children.
+ */
+static int block_occupied(const PreparedScene* prepared, int level,
+                          int block_x, int block_y, int x0, int y0, int x1,
+                          int y1) {
+    size_t index = (size_t)block_y * level_width(prepared, level) + block_x;
+    if (!prepared->occupancy[level][index]) {
+        return 0;
+    }
+    int span = (int)(((unsigned int)1 << level) - 1);
+    int left = block_x << level;
+    int top = block_y << level;
+    if (left >= x0 && left + span <= x1 && top >= y0 && top + span <= y1) {
+        return 1;
+    }
+    int child_span = span >> 1;
+    for (int child_y = 2 * block_y; child_y <= 2 * block_y + 1; child_y++) {
+        for (int child_x = 2 * block_x; child_x <= 2 * block_x + 1; child_x++) {
+            int child_left = child_x << (level - 1);
+            int child_top = child_y << (level - 1);
+            if (child_x >= level_width(prepared, level - 1) ||
+                child_y >= level_height(prepared, level - 1) ||
+                child_left > x1 || child_left + child_span < x0 ||
+                child_top > y1 || child_top + child_span < y0) {
+                continue;
+            }
+            if (block_occupied(prepared, level - 1, child_x, child_y, x0, y0,
+                               x1, y1)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int scene_box_empty(const PreparedScene* prepared, int x0, int y0, int x1,
+                    int y1) {
+    int left = (x0 < x1 ? x0 : x1) - prepared->origin_x;
+    int right = (x0 < x1 ? x1 : x0) - prepared->origin_x;
+    int top = (y0 < y1 ? y0 : y1) - prepared->origin_y;
+    int bottom = (y0 < y1 ? y1 : y0) - prepared->origin_y;
+    if (left < 0 || top < 0 || right >= prepared->width ||
+        bottom >= prepared->height) {
+        return 0;
+    }
+
+    // Start from the finest level whose blocks are larger than the box, where
+    // it overlaps at most two blocks each way
+    int extent = right - left > bottom - top ? right - left : bottom - top;
+    int level = 0;
+    while (level < prepared->levels && (extent >> level) != 0) {
+        level++;
+    }
+    for (int block_y = top >> level; block_y <= bottom >> level; block_y++) {
+        for (int block_x = left >> level; block_x <= right >> level; block_x++) {
+            if (block_occupied(prepared, level, block_x, block_y, left, top,
+                               right, bottom)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Index of the lowest and highest set bit of a nonzero word.
+static int lowest_bit(uint64_t word) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int bit = 0;
+    while (!(word & 1)) {
+        word >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static int highest_bit(uint64_t word) {
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(word);
+#else
+    int bit = 63;
+    while (!(word >> 63)) {
+        word <<= 1;
+        bit--;
+    }
+    return bit;
+#endif
+}
+
+/*
+ * Returns the first set bit of `bits` met walking from bit `from` to bit `to`
+ * (either way, both included, both within `count` bits), or -1 if there is
+ * none. Whole words are tested at once, with the ends masked off.
+ */
+static int first_set_bit(const uint64_t* bits, int from, int to) {
+    if (from <= to) {
+        for (int word = from / 64; word <= to / 64; word++) {
+            uint64_t value = bits[word];
+            if (word == from / 64) {
+                value &= ~(uint64_t)0 << (from % 64);
+            }
+            if (word == to / 64) {
+                value &= ~(uint64_t)0 >> (63 - to % 64);
+            }
+            if (value != 0) {
+                return word * 64 + lowest_bit(value);
+            }
+        }
+        return -1;
+    }
+    for (int word = from / 64; word >= to / 64; word--) {
+        uint64_t value = bits[word];
+        if (word == from / 64) {
+            value &= ~(uint64_t)0 >> (63 - from % 64);
+        }
+        if (word == to / 64) {
+            value &= ~(uint64_t)0 << (to % 64);
+        }
+        if (value != 0) {
+            return word * 64 + highest_bit(value);
+        }
+    }
+    return -1;
+}
+
+/*
+ * Clip the walk from `*from` to `*to` to [0, `count`), keeping its direction.
+ * Returns 0 if no part of it is inside.
+ */
+static int clip_walk(int* from, int* to, int count) {
+    int low = *from < *to ? *from : *to;
+    int high = *from < *to ? *to : *from;
+    if (high < 0 || low >= count) {
+        return 0;
+    }
+    low = low < 0 ? 0 : low;
+    high = high >= count ? count - 1 : high;
+    *from = *from < *to ? low : high;
+    *to = *from == low ? high : low;
+    return 1;
+}
+
+int scene_row_obstacle(const PreparedScene* prepared, int y, int from, int to) {
+    int window_y = y - prepared->origin_y;
+    from -= prepared->origin_x;
+    to -= prepared->origin_x;
+    if (window_y < 0 || window_y >= prepared->height ||
+        !clip_walk(&from, &to, prepared->width)) {
+        return -1;
+    }
+    int found = first_set_bit(
+        prepared->row_mask + (size_t)window_y * prepared->row_words, from, to);
+    return found < 0 ? -1 : found + prepared->origin_x;
+}
+
+int scene_column_obstacle(const PreparedScene* prepared, int x, int from,
+                          int to) {
+    int window_x = x - prepared->origin_x;
+    from -= prepared->origin_y;
+    to -= prepared->origin_y;
+    if (window_x < 0 || window_x >= prepared->width ||
+        !clip_walk(&from, &to, prepared->height)) {
+        return -1;
+    }
+    int found = first_set_bit(
+        prepared->column_mask + (size_t)window_x * prepared->column_words, from, to);
+    return found < 0 ? -1 : found + prepared->origin_y;
+}
+
+// Culling arrays `build_arrays` may leave out. Obstacles, masks and the
+// pyramid are always built: tracing needs them.
+#define BUILD_CLEARANCE 0x1
+#define BUILD_REGIONS 0x2
+#define BUILD_CELLS 0x4
+#define BUILD_ALL (BUILD_CLEARANCE | BUILD_REGIONS | BUILD_CELLS)
+
+// `scene_build`, leaving out the culling arrays not in `build`.
+static void build_arrays(PreparedScene* prepared, int build) {
+    size_t pixel_count = (size_t)prepared->width * prepared->height;
+
+    if (prepared->obstacles == NULL) {
+        prepared->obstacles = (uint8_t*)raycast_malloc(sizeof(uint8_t) * pixel_count);
+        for (size_t i = 0; i < pixel_count; i++) {
+            prepared->obstacles[i] = is_obstacle(prepared->image->pixels[i]);
+        }
+    }
+    if (prepared->clearance == NULL && (build & BUILD_CLEARANCE)) {
+        prepared->clearance =
+            (uint16_t*)raycast_malloc(sizeof(uint16_t) * pixel_count);
+        build_clearance(prepared);
+    }
+    prepared->row_words = (prepared->width + 63) / 64;
+    prepared->column_words = (prepared->height + 63) / 64;
+    if (prepared->row_mask == NULL) {
+        prepared->row_mask = (uint64_t*)raycast_calloc(
+            (size_t)prepared->height * prepared->row_words, sizeof(uint64_t));
+        prepared->column_mask = (uint64_t*)raycast_calloc(
+            (size_t)prepared->width * prepared->column_words, sizeof(uint64_t));
+        build_masks(prepared);
+    }
+    if (prepared->regions == NULL && (build & BUILD_REGIONS)) {
+        prepared->regions =
+            (uint32_t*)raycast_malloc(sizeof(uint32_t) * pixel_count);
+        build_regions(prepared);
+    }
+    if (prepared->cell_of == NULL && (build & BUILD_CELLS)) {
+        prepared->cell_of =
+            (uint32_t*)raycast_calloc(pixel_count, sizeof(uint32_t));
+        build_cells(prepared);
+    }
+    if (prepared->occupancy[0] == NULL) {
+        build_occupancy(prepared);
+    }
+}
+
+void scene_build(PreparedScene* prepared) {
+    build_arrays(prepared, BUILD_ALL);
+}
+
+PreparedScene* scene_prepare_window(Image* window, int origin_x, int origin_y,
+                                    int scene_width, int scene_height) {
+    PreparedScene* prepared = (PreparedScene*)raycast_calloc(1, sizeof(PreparedScene));
+    prepared->image = window;
+    prepared->width = window->width;
+    prepared->height = window->height;
+    prepared->origin_x = origin_x;
+    prepared->origin_y = origin_y;
+    prepared->scene_width = scene_width;
+    prepared->scene_height = scene_height;
+    TraceSpan span = trace_begin("prepare");
+    build_arrays(prepared, BUILD_CLEARANCE | BUILD_REGIONS);
+    trace_end(span);
+    return prepared;
+}
+
+size_t scene_window_bytes(int width, int height) {
+    size_t pixel_count = (size_t)width * height;
+    size_t kept = sizeof(PreparedScene) +
+                  pixel_count * (sizeof(uint8_t) + sizeof(uint16_t) +
+                                 sizeof(uint32_t)) +
+                  sizeof(uint64_t) * ((size_t)height * ((width + 63) / 64) +
+                                      (size_t)width * ((height + 63) / 64));
+
+    // Labelling regions needs one union-find entry per label, and a new label
+    // starts only where an open pixel has no open neighbour to its left, so
+    // there are at most ceil(width / 2) to a row
+    size_t labels = (size_t)(width + 1) / 2 * height;
+    size_t capacity = 64;
+    while (capacity <= labels) {
+        capacity *= 2;
+    }
+    size_t parent_bytes = sizeof(uint32_t) * capacity;
+
+    // The pyramid is allocated once the forest is freed
+    size_t pyramid_bytes = scene_pyramid_bytes(width, height);
+    return kept + (parent_bytes > pyramid_bytes ? parent_bytes : pyramid_bytes);
+}
+
+PreparedScene* raycast_prepare(Image* scene) {
+    PreparedScene* prepared = (PreparedScene*)raycast_calloc(1, sizeof(PreparedScene));
+    prepared->image = scene;
+    prepared->width = scene->width;
+    prepared->height = scene->height;
+    prepared->scene_width = scene->width;
+    prepared->scene_height = scene->height;
+    TraceSpan span = trace_begin("prepare");
+    scene_build(prepared);
+    trace_end(span);
+    return prepared;
+}
+
+PreparedScene* scene_prepare_once(Image* scene) {
+    PreparedScene* prepared = (PreparedScene*)raycast_calloc(1, sizeof(PreparedScene));
+    prepared->image = scene;
+    prepared->width = scene->width;
+    prepared->height = scene->height;
+    prepared->scene_width = scene->width;
+    prepared->scene_height = scene->height;
+    TraceSpan span = trace_begin("prepare");
+    build_arrays(prepared, 0);
+    trace_end(span);
+    return prepared;
+}
+
+int raycast_update_scene(PreparedScene* prepared, int x, int y, int width,
+                         int height) {
+    int x0 = x - prepared->origin_x;
+    int y0 = y - prepared->origin_y;
+    if (prepared->mapping != NULL || x0 < 0 || y0 < 0 || width < 0 ||
+        height < 0 || width > prepared->width - x0 ||
+        height > prepared->height - y0) {
+        return -1;
+    }
+    if (width == 0 || height == 0) {
+        return 0;
+    }
+    int x1 = x0 + width - 1;
+    int y1 = y0 + height - 1;
+
+    // The edited pixels' obstacle flags, mask bits and pyramid blocks
+    for (int window_y = y0; window_y <= y1; window_y++) {
+        uint64_t* row = prepared->row_mask + (size_t)window_y * prepared->row_words;
+        for (int window_x = x0; window_x <= x1; window_x++) {
+            size_t index = (size_t)window_y * prepared->width + window_x;
+            uint8_t obstacle = is_obstacle(prepared->image->pixels[index]);
+            prepared->obstacles[index] = obstacle;
+            uint64_t* column = prepared->column_mask +
+                               (size_t)window_x * prepared->column_words;
+            uint64_t row_bit = (uint64_t)1 << (window_x % 64);
+            uint64_t column_bit = (uint64_t)1 << (window_y % 64);
+            if (obstacle) {
+                row[window_x / 64] |= row_bit;
+                column[window_y / 64] |= column_bit;
+            }
+            else {
+                row[window_x / 64] &= ~row_bit;
+                column[window_y / 64] &= ~column_bit;
+            }
+        }
+    }
+    refresh_occupancy(prepared, x0, y0, x1, y1);
+
+    // An edit anywhere can change clearance, regions and rectangles anywhere,
+    // so those are rebuilt
+    build_clearance(prepared);
+    build_regions(prepared);
+    if (prepared->cell_of != NULL) {
+        memset(prepared->cell_of, 0,
+               sizeof(uint32_t) * (size_t)prepared->width * prepared->height);
+        raycast_free(prepared->cells);
+        build_cells(prepared);
+    }
+    return 0;
+}
+
+Image* prepared_scene_image(const PreparedScene* prepared) {
+    return prepared->image;
+}
+
+// Returns 1 if `data` was allocated by `scene_build` rather than being part
+// of a mapped scene file.
+static int scene_owns(const PreparedScene* prepared, const void* data) {
+    const char* start = (const char*)prepared->mapping;
+    const char* pointer = (const char*)data;
+    return start == NULL || pointer < start ||
+           pointer >= start + prepared->mapping_length;
+}
+
+void free_prepared_scene(PreparedScene* prepared) {
+    if (scene_owns(prepared, prepared->obstacles)) {
+        raycast_free(prepared->obstacles);
+    }
+    if (scene_owns(prepared, prepared->clearance)) {
+        raycast_free(prepared->clearance);
+    }
+    if (scene_owns(prepared, prepared->row_mask)) {
+        raycast_free(prepared->row_mask);
+    }
+    if (scene_owns(prepared, prepared->column_mask)) {
+        raycast_free(prepared->column_mask);
+    }
+    if (scene_owns(prepared, prepared->regions)) {
+        raycast_free(prepared->regions);
+    }
+    if (scene_owns(prepared, prepared->cell_of)) {
+        raycast_free(prepared->cell_of);
+    }
+    if (scene_owns(prepared, prepared->cells)) {
+        raycast_free(prepared->cells);
+    }
+    if (prepared->levels > 0 && scene_owns(prepared, prepared->occupancy[1])) {
+        raycast_free(prepared->occupancy[1]);
+    }
+    if (prepared->mapping != NULL) {
+        munmap(prepared->mapping, prepared->mapping_length);
+        raycast_free(prepared->image);
+    }
+    else if (prepared->owns_image) {
+        free_image(prepared->image);
+    }
+    raycast_free(prepared);
+}
@@ -0,0 +1,237 @@
+#ifndef __SCENE_H__
+#define __SCENE_H__
+
+#include <stdint.h>
+
+#include "image.h"
+#include "raycaster.h"
+
+/*
+ * Largest value stored in `PreparedScene.clearance`. Pixels farther than this
+ * from every obstacle (or in scenes without obstacles) are clamped to it.
+ */
+#define CLEARANCE_MAX UINT16_MAX
+
+/*
+ * Most levels of the occupancy pyramid, counting level 0: enough to reduce
+ * any window an int can index to a single block.
+ */
+#define OCCUPANCY_LEVELS_MAX 32
+
+/*
+ * An obstacle-free rectangle of the prepared window, with inclusive bounds in
+ * window coordinates.
+ */
+typedef struct {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+} SceneCell;
+
+/*
+ * Per-scene data built once by `raycast_prepare` and shared (read-only) by
+ * every render against that scene.
+ *
+ * This layout is private to the raycaster; clients only ever see the opaque
+ * `PreparedScene` handle declared in raycaster.h.
+ */
+struct PreparedScene {
+    // The scene being rendered. Borrowed: the caller keeps it alive.
+    Image* image;
+    int width;
+    int height;
+
+    // Scene coordinates of `image`'s top-left pixel. Normally (0, 0); tiled
+    // renders prepare a window of a larger scene and set this to the window's
+    // position, so that rays and lights keep using whole-scene coordinates.
+    int origin_x;
+    int origin_y;
+
+    // Size of the whole scene, which `image` is a window of. Pixels outside it
+    // are open space: rays towards lights placed beyond the scene may cross them.
+    int scene_width;
+    int scene_height;
+
+    // 1 for obstacle pixels, 0 otherwise, in the same row-major layout as
+    // `image->pixels`.
+    uint8_t* obstacles;
+
+    // Chebyshev distance from each pixel to the nearest obstacle (0 on the
+    // obstacles themselves), clamped to `CLEARANCE_MAX`. Every pixel a ray
+    // visits lies within the bounding box of its start and end, so a ray from
+    // `p` whose light is closer than `clearance[p]` cannot be occluded. NULL
+    // in scenes from `scene_prepare_once`.
+    uint16_t* clearance;
+
+    // `obstacles` again, packed 64 pixels to a word so that runs of pixels
+    // along a row or column can be scanned a word at a time. `row_mask` holds
+    // each row in `row_words` words: bit i of word w is the pixel at x =
+    // 64 w + i. `column_mask` is the transpose: each column in `column_words`
+    // words, bit i of word w being the pixel at y = 64 w + i.
+    uint64_t* row_mask;
+    uint64_t* column_mask;
+    int row_words;
+    int column_words;
+
+    // Connected region of each open pixel, 0 on obstacles: two open pixels
+    // share a label exactly when a chain of open pixels, each one of the eight
+    // neighbours of the last, joins them inside the window. Rays move to one of
+    // those neighbours at every step and stop on or next to their light, so no
+    // pixel sees a light standing on an open pixel of another region. NULL in
+    // scenes from `scene_prepare_once`.
+    uint32_t* regions;
+
+    // Open space split into obstacle-free rectangles, which tile it without
+    // overlapping. `cell_of` gives the index in `cells` of each pixel's
+    // rectangle, and 0 on obstacles, whose cell is empty. Every pixel a ray
+    // visits lies within the bounding box of its start and end, so a ray
+    // between two pixels of one rectangle cannot be occluded. Both are NULL
+    // in windows from `scene_prepare_window` and scenes from
+    // `scene_prepare_once`.
+    uint32_t* cell_of;
+    SceneCell* cells;
+    uint32_t cell_count;
+
+    // Occupancy pyramid over `obstacles`. Level k splits the window into
+    // blocks of 2^k x 2^k pixels, with one byte per block, 1 when any pixel in
+    // the block is an obstacle. `occupancy[k]` holds level k row-major, with
+    // ((width - 1) >> k) + 1 blocks to a row. Level 0 is `obstacles` itself,
+    // and level `levels` is one block covering the whole window.
+    uint8_t* occupancy[OCCUPANCY_LEVELS_MAX];
+    int levels;
+
+    // Non-NULL when the scene was loaded with `map_scene_file`. Any of the
+    // arrays above (and the pixels of `image`, which the prepared scene then
+    // owns) may point into this mapping; it is unmapped with the scene.
+    void* mapping;
+    size_t mapping_length;
+
+    // Set when the prepared scene owns `image` and frees it with the scene.
+    int owns_image;
+};
+
+/*
+ * Build every acceleration array of `prepared` that is still NULL from its
+ * `image`. Used both for fresh scenes and to complete mapped scene files.
+ */
+void scene_build(PreparedScene* prepared);
+
+/*
+ * Prepare `window`, the part of a `scene_width` x `scene_height` scene whose
+ * top-left pixel is (origin_x, origin_y), for rendering tiles of it. The
+ * rectangle split is left out: its size depends on the window's content, so
+ * tiled renders could not budget for it.
+ */
+PreparedScene* scene_prepare_window(Image* window, int origin_x, int origin_y,
+                                    int scene_width, int scene_height);
+
+/*
+ * Prepare `scene` for a single render. Only what tracing needs is built: the
+ * clearance, regions and rectangle split cost more to build than one render
+ * saves with them, and are left NULL.
+ */
+PreparedScene* scene_prepare_once(Image* scene);
+
+/*
+ * Returns the size of the occupancy pyramid's levels above level 0 for a
+ * `width` x `height` window, which `scene_build` allocates in one block.
+ */
+size_t scene_pyramid_bytes(int width, int height);
+
+/*
+ * Returns the most bytes `scene_prepare_window` allocates for a `width` x
+ * `height` window, whatever its content.
+ */
+size_t scene_window_bytes(int width, int height);
+
+/*
+ * Render the `width` x `height` rectangle of the scene whose top-left pixel is
+ * (x, y), in scene coordinates, into `out` (`out_stride` pixels per row). Pixels
+ * follow the sequential engine's rules. Rows are split over up to
+ * `max_threads` threads.
+ */
+void render_region(const PreparedScene* prepared, Light* lights,
+                   int light_count, int x, int y, int width, int height,
+                   Color* out, int out_stride, int max_threads);
+
+/*
+ * Returns the most bytes `render_region` allocates while rendering on up to
+ * `max_threads` threads.
+ */
+size_t render_region_bytes(int max_threads);
+
+/*
+ * Returns the index of scene pixel (x, y) in the prepared scene's arrays.
+ */
+static inline size_t scene_index(const PreparedScene* prepared, int x, int y) {
+    return (size_t)(y - prepared->origin_y) * prepared->width +
+           (x - prepared->origin_x);
+}
+
+/*
+ * Returns 1 if the scene pixel at (x, y) is an obstacle, and 0 otherwise.
+ */
+static inline int scene_obstacle(const PreparedScene* prepared, int x, int y) {
+    return prepared->obstacles[scene_index(prepared, x, y)];
+}
+
+/*
+ * Returns the region of the scene pixel at `pixel`, or 0 if it is an obstacle,
+ * outside the prepared window or the scene has no regions.
+ */
+static inline uint32_t scene_region(const PreparedScene* prepared,
+                                    PixelLocation pixel) {
+    if (prepared->regions == NULL || pixel.x < (unsigned int)prepared->origin_x ||
+        pixel.y < (unsigned int)prepared->origin_y ||
+        pixel.x - prepared->origin_x >= (unsigned int)prepared->width ||
+        pixel.y - prepared->origin_y >= (unsigned int)prepared->height) {
+        return 0;
+    }
+    return prepared->regions[scene_index(prepared, pixel.x, pixel.y)];
+}
+
+/*
+ * Returns 1 if `pixel` lies in the rectangle of the scene pixel at (x, y),
+ * and 0 otherwise or if the scene has no rectangles.
+ */
+static inline int scene_same_cell(const PreparedScene* prepared, int x, int y,
+                                  PixelLocation pixel) {
+    if (prepared->cell_of == NULL) {
+        return 0;
+    }
+    const SceneCell* cell =
+        &prepared->cells[prepared->cell_of[scene_index(prepared, x, y)]];
+    unsigned int window_x = pixel.x - (unsigned int)prepared->origin_x;
+    unsigned int window_y = pixel.y - (unsigned int)prepared->origin_y;
+    return window_x >= (unsigned int)cell->x0 &&
+           window_x <= (unsigned int)cell->x1 &&
+           window_y >= (unsigned int)cell->y0 &&
+           window_y <= (unsigned int)cell->y1;
+}
+
+/*
+ * Returns 1 if the box with corners (x0, y0) and (x1, y1), in scene
+ * coordinates and both included, holds no obstacle, and 0 if it does or is
+ * not inside the prepared window. Fully empty pyramid blocks are passed over
+ * whole, so the cost grows with the box's perimeter rather than its area.
+ */
+int scene_box_empty(const PreparedScene* prepared, int x0, int y0, int x1,
+                    int y1);
+
+/*
+ * Returns the x of the first obstacle in scene row y met walking from x = from
+ * to x = to (either way, both included), or -1 if there is none. Pixels
+ * outside the prepared window count as open.
+ */
+int scene_row_obstacle(const PreparedScene* prepared, int y, int from, int to);
+
+/*
+ * Returns the y of the first obstacle in scene column x met walking from
+ * y = from to y = to (either way, both included), or -1 if there is none.
+ * Pixels outside the prepared window count as open.
+ */
+int scene_column_obstacle(const PreparedScene* prepared, int x, int from,
+                          int to);
+
+#endif // __SCENE_H__
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "image.h"
+#include "light_file.h"
+#include "raycaster.h"
+#include "scene_file.h"
+
+/*
+ * Convert a PNG scene into a native scene file that `map_scene_file` can load
+ * without decoding.
+ *
+ * Usage: scene_convert [--pixels-only] <input.png> <output.scene>
+ *        scene_convert --lights <input.csv> <output.lights>
+ *
+ * By default the obstacle mask, clearance map, row and column masks, region
+ * labels, occupancy pyramid and rectangle split are precomputed and stored
+ * too; `--pixels-only` writes just the pixels, which makes a smaller file
+ * whose acceleration data is rebuilt at load time.
+ *
+ * `--lights` converts a CSV light list into a native light file instead.
+ */
+
+static int convert_lights(const char* program, const char* input,
+                          const char* output) {
+    LightSet* set = read_light_csv(input);
+    if (set == NULL) {
+        fprintf(stderr, "%s: cannot read lights from %s\n", program, input);
+        return 1;
+    }
+    int error = write_light_file(output, set->lights, set->count);
+    if (error) {
+        fprintf(stderr, "%s: cannot write %s\n", program, output);
+    }
+    free_light_set(set);
+    return error ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+    uint32_t sections = SCENE_SECTION_ALL;
+    int lights = 0;
+    int arg = 1;
+    if (arg < argc && strcmp(argv[arg], "--pixels-only") == 0) {
+        sections = 0;
+        arg++;
+    }
+    else if (arg < argc && strcmp(argv[arg], "--lights") == 0) {
+        lights = 1;
+        arg++;
+    }
+    if (argc - arg != 2) {
+        fprintf(stderr,
+                "usage: %s [--pixels-only] <input.png> <output.scene>\n"
+                "       %s --lights <input.csv> <output.lights>\n",
+                argv[0], argv[0]);
+        return 2;
+    }
+    if (lights) {
+        return convert_lights(argv[0], argv[arg], argv[arg + 1]);
+    }
+
+    Image* scene = read_image(argv[arg]);
+    if (scene == NULL) {
+        fprintf(stderr, "%s: cannot read image %s\n", argv[0], argv[arg]);
+        return 1;
+    }
+    PreparedScene* prepared = raycast_prepare(scene);
+
+    int error = write_scene_file(argv[arg + 1], prepared, sections);
+    if (error) {
+        fprintf(stderr, "%s: cannot write %s\n", argv[0], argv[arg + 1]);
+    }
+
+    free_prepared_scene(prepared);
+    free_image(scene);
+    return error ? 1 : 0;
+}
@@ -0,0 +1,271 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "scene.h"
+#include "scene_file.h"
+
+// Round `offset` up to the next section boundary.
+static uint64_t align_section(uint64_t offset) {
+    return (offset + SCENE_FILE_ALIGNMENT - 1) / SCENE_FILE_ALIGNMENT *
+           SCENE_FILE_ALIGNMENT;
+}
+
+// Write `length` bytes of `data` at `offset`, zero-filling from the current
+// position up to `offset`. Returns 0 on success and -1 on failure.
+static int write_section(FILE* file, uint64_t offset, const void* data,
+                         size_t length) {
+    long position = ftell(file);
+    if (position < 0) {
+        return -1;
+    }
+    for (uint64_t i = position; i < offset; i++) {
+        if (fputc(0, file) == EOF) {
+            return -1;
+        }
+    }
+    return fwrite(data, 1, length, file) == length ? 0 : -1;
+}
+
+// Sizes of the row and column masks of a `width` x `height` scene.
+static uint64_t row_mask_bytes(uint64_t width, uint64_t height) {
+    return sizeof(uint64_t) * height * ((width + 63) / 64);
+}
+
+static uint64_t column_mask_bytes(uint64_t width, uint64_t height) {
+    return sizeof(uint64_t) * width * ((height + 63) / 64);
+}
+
+SceneFileHeader scene_file_header(int width, int height, uint32_t sections) {
+    size_t pixel_count = (size_t)width * height;
+
+    SceneFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic));
+    header.version = SCENE_FILE_VERSION;
+    header.byte_order = SCENE_FILE_BYTE_ORDER;
+    header.width = width;
+    header.height = height;
+    header.sections = sections & SCENE_SECTION_ALL;
+
+    uint64_t end = align_section(sizeof(header));
+    header.pixels_offset = end;
+    end = align_section(end + sizeof(Color) * pixel_count);
+    if (header.sections & SCENE_SECTION_OBSTACLES) {
+        header.obstacles_offset = end;
+        end = align_section(end + sizeof(uint8_t) * pixel_count);
+    }
+    if (header.sections & SCENE_SECTION_CLEARANCE) {
+        header.clearance_offset = end;
+        end = align_section(end + sizeof(uint16_t) * pixel_count);
+    }
+    if (header.sections & SCENE_SECTION_MASKS) {
+        header.row_mask_offset = end;
+        end = align_section(end + row_mask_bytes(width, height));
+        header.column_mask_offset = end;
+        end = align_section(end + column_mask_bytes(width, height));
+    }
+    if (header.sections & SCENE_SECTION_REGIONS) {
+        header.regions_offset = end;
+        end = align_section(end + sizeof(uint32_t) * pixel_count);
+    }
+    if (header.sections & SCENE_SECTION_PYRAMID) {
+        header.pyramid_offset = end;
+        end = align_section(end + scene_pyramid_bytes(width, height));
+    }
+    if (header.sections & SCENE_SECTION_CELLS) {
+        header.cell_of_offset = end;
+        end = align_section(end + sizeof(uint32_t) * pixel_count);
+        header.cells_offset = end;
+    }
+    return header;
+}
+
+int write_scene_file(const char* filename, const PreparedScene* prepared,
+                     uint32_t sections) {
+    size_t pixel_count = (size_t)prepared->width * prepared->height;
+    SceneFileHeader header =
+        scene_file_header(prepared->width, prepared->height, sections);
+    if (header.cells_offset) {
+        header.cell_count = prepared->cell_count;
+    }
+
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+    int error = write_section(file, 0, &header, sizeof(header));
+    error |= write_section(file, header.pixels_offset,
+                           prepared->image->pixels, sizeof(Color) * pixel_count);
+    if (header.obstacles_offset) {
+        error |= write_section(file, header.obstacles_offset,
+                               prepared->obstacles,
+                               sizeof(uint8_t) * pixel_count);
+    }
+    if (header.clearance_offset) {
+        error |= write_section(file, header.clearance_offset,
+                               prepared->clearance,
+                               sizeof(uint16_t) * pixel_count);
+    }
+    if (header.row_mask_offset) {
+        error |= write_section(file, header.row_mask_offset, prepared->row_mask,
+                               row_mask_bytes(prepared->width, prepared->height));
+        error |= write_section(file, header.column_mask_offset,
+                               prepared->column_mask,
+                               column_mask_bytes(prepared->width, prepared->height));
+    }
+    if (header.regions_offset) {
+        error |= write_section(file, header.regions_offset, prepared->regions,
+                               sizeof(uint32_t) * pixel_count);
+    }
+    size_t pyramid_bytes = scene_pyramid_bytes(prepared->width, prepared->height);
+    if (header.pyramid_offset && pyramid_bytes > 0) {
+        error |= write_section(file, header.pyramid_offset,
+                               prepared->occupancy[1], pyramid_bytes);
+    }
+    if (header.cells_offset) {
+        error |= write_section(file, header.cell_of_offset, prepared->cell_of,
+                               sizeof(uint32_t) * pixel_count);
+        error |= write_section(file, header.cells_offset, prepared->cells,
+                               sizeof(SceneCell) * prepared->cell_count);
+    }
+    error |= fclose(file) == 0 ? 0 : -1;
+    return error ? -1 : 0;
+}
+
+// Returns 1 if a section of `length` bytes at `offset` fits in the file.
+static int section_fits(uint64_t offset, uint64_t length, uint64_t file_size) {
+    return offset % SCENE_FILE_ALIGNMENT == 0 && offset <= file_size &&
+           length <= file_size - offset;
+}
+
+int scene_header_valid(const SceneFileHeader* header, uint64_t file_size) {
+    uint64_t pixel_count = (uint64_t)header->width * header->height;
+    return memcmp(header->magic, SCENE_FILE_MAGIC, sizeof(header->magic)) == 0 &&
+           header->version >= 1 && header->version <= SCENE_FILE_VERSION &&
+           header->byte_order == SCENE_FILE_BYTE_ORDER &&
+           header->width > 0 && header->height > 0 &&
+           header->width <= INT32_MAX && header->height <= INT32_MAX &&
+           section_fits(header->pixels_offset, sizeof(Color) * pixel_count,
+                        file_size) &&
+           (!(header->sections & SCENE_SECTION_OBSTACLES) ||
+            section_fits(header->obstacles_offset,
+                         sizeof(uint8_t) * pixel_count, file_size)) &&
+           (!(header->sections & SCENE_SECTION_CLEARANCE) ||
+            section_fits(header->clearance_offset,
+                         sizeof(uint16_t) * pixel_count, file_size)) &&
+           (!(header->sections & SCENE_SECTION_MASKS) ||
+            (section_fits(header->row_mask_offset,
+                          row_mask_bytes(header->width, header->height),
+                          file_size) &&
+             section_fits(header->column_mask_offset,
+                          column_mask_bytes(header->width, header->height),
+                          file_size))) &&
+           (!(header->sections & SCENE_SECTION_REGIONS) ||
+            section_fits(header->regions_offset,
+                         sizeof(uint32_t) * pixel_count, file_size)) &&
+           (!(header->sections & SCENE_SECTION_PYRAMID) ||
+            section_fits(header->pyramid_offset,
+                         scene_pyramid_bytes(header->width, header->height),
+                         file_size)) &&
+           (!(header->sections & SCENE_SECTION_CELLS) ||
+            (header->cell_count >= 1 && header->cell_count <= pixel_count + 1 &&
+             section_fits(header->cell_of_offset,
+                          sizeof(uint32_t) * pixel_count, file_size) &&
+             section_fits(header->cells_offset,
+                          sizeof(SceneCell) * header->cell_count, file_size)));
+}
+
+PreparedScene* map_scene_file(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SceneFileHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size_t length = info.st_size;
+    char* mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    SceneFileHeader header;
+    memcpy(&header, mapping, sizeof(header));
+    if (!scene_header_valid(&header, length)) {
+        munmap(mapping, length);
+        return NULL;
+    }
+
+    Image* image = (Image*)raycast_malloc(sizeof(Image));
+    image->pixels = (Color*)(mapping + header.pixels_offset);
+    image->width = header.width;
+    image->height = header.height;
+
+    PreparedScene* prepared = (PreparedScene*)raycast_calloc(1, sizeof(PreparedScene));
+    prepared->image = image;
+    prepared->width = image->width;
+    prepared->height = image->height;
+    prepared->scene_width = image->width;
+    prepared->scene_height = image->height;
+    prepared->mapping = mapping;
+    prepared->mapping_length = length;
+    if (header.sections & SCENE_SECTION_OBSTACLES) {
+        prepared->obstacles = (uint8_t*)(mapping + header.obstacles_offset);
+    }
+    if (header.sections & SCENE_SECTION_CLEARANCE) {
+        prepared->clearance = (uint16_t*)(mapping + header.clearance_offset);
+    }
+    if (header.sections & SCENE_SECTION_MASKS) {
+        prepared->row_mask = (uint64_t*)(mapping + header.row_mask_offset);
+        prepared->column_mask = (uint64_t*)(mapping + header.column_mask_offset);
+    }
+    if (header.sections & SCENE_SECTION_REGIONS) {
+        prepared->regions = (uint32_t*)(mapping + header.regions_offset);
+    }
+    if ((header.sections & SCENE_SECTION_PYRAMID) &&
+        scene_pyramid_bytes(header.width, header.height) > 0) {
+        prepared->occupancy[1] = (uint8_t*)(mapping + header.pyramid_offset);
+    }
+    if (header.sections & SCENE_SECTION_CELLS) {
+        prepared->cell_of = (uint32_t*)(mapping + header.cell_of_offset);
+        prepared->cells = (SceneCell*)(mapping + header.cells_offset);
+        prepared->cell_count = header.cell_count;
+    }
+    scene_build(prepared);
+
+    return prepared;
+}
+
+PreparedScene* load_scene_file(const char* filename) {
+    // Anything that does not start like a scene file is treated as a PNG
+    char magic[sizeof(SCENE_FILE_MAGIC) - 1] = { 0 };
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    size_t count = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    if (count == sizeof(magic) && memcmp(magic, SCENE_FILE_MAGIC, sizeof(magic)) == 0) {
+        return map_scene_file(filename);
+    }
+
+    Image* image = read_image(filename);
+    if (image == NULL) {
+        return NULL;
+    }
+    PreparedScene* prepared = raycast_prepare(image);
+    prepared->owns_image = 1;
+    return prepared;
+}
@@ -0,0 +1,115 @@
+#ifndef __SCENE_FILE_H__
+#define __SCENE_FILE_H__
+
+#include <stdint.h>
+
+#include "raycaster.h"
+
+/*
+ * Native scene files.
+ *
+ * A scene file holds a scene's raw pixels, and optionally its precomputed
+ * acceleration data, in exactly the layout the raycaster uses in memory. That
+ * lets `map_scene_file` map the file and render straight from the mapping:
+ * loading costs no decoding or copying, and processes rendering the same scene
+ * share its pages through the page cache.
+ *
+ * Layout (native byte order, every section aligned to SCENE_FILE_ALIGNMENT):
+ *
+ *   SceneFileHeader
+ *   pixels      width * height `Color`s, row-major
+ *   obstacles   width * height `uint8_t`s (if SCENE_SECTION_OBSTACLES)
+ *   clearance   width * height `uint16_t`s (if SCENE_SECTION_CLEARANCE)
+ *   row mask    height * ((width + 63) / 64) `uint64_t`s (if SCENE_SECTION_MASKS)
+ *   column mask width * ((height + 63) / 64) `uint64_t`s (if SCENE_SECTION_MASKS)
+ *   regions     width * height `uint32_t`s (if SCENE_SECTION_REGIONS)
+ *   pyramid     occupancy pyramid levels 1 and up, each row-major, in one
+ *               block (if SCENE_SECTION_PYRAMID)
+ *   cell of     width * height `uint32_t`s (if SCENE_SECTION_CELLS)
+ *   cells       `cell_count` `SceneCell`s (if SCENE_SECTION_CELLS)
+ *
+ * Version 1 files, which predate the masks, regions, pyramid and rectangle
+ * split, are still read: their header is shorter, and the zero padding after
+ * it reads as absent sections.
+ */
+
+#define SCENE_FILE_MAGIC "RAYSCENE"
+#define SCENE_FILE_VERSION 2
+// Written into every header so files from a different-endian host are refused
+#define SCENE_FILE_BYTE_ORDER 0x01020304
+#define SCENE_FILE_ALIGNMENT 4096
+
+// Flags for `SceneFileHeader.sections`
+#define SCENE_SECTION_OBSTACLES 0x1
+#define SCENE_SECTION_CLEARANCE 0x2
+#define SCENE_SECTION_MASKS 0x4
+#define SCENE_SECTION_REGIONS 0x8
+#define SCENE_SECTION_CELLS 0x10
+#define SCENE_SECTION_PYRAMID 0x20
+#define SCENE_SECTION_ALL                                                      \
+    (SCENE_SECTION_OBSTACLES | SCENE_SECTION_CLEARANCE | SCENE_SECTION_MASKS | \
+     SCENE_SECTION_REGIONS | SCENE_SECTION_CELLS | SCENE_SECTION_PYRAMID)
+
+/*
+ * The fixed header at the start of every scene file. Offsets are in bytes
+ * from the start of the file; absent sections have offset 0.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t width;
+    uint32_t height;
+    uint32_t sections;
+    uint32_t reserved;
+    uint64_t pixels_offset;
+    uint64_t obstacles_offset;
+    uint64_t clearance_offset;
+    uint64_t row_mask_offset;
+    uint64_t column_mask_offset;
+    uint64_t regions_offset;
+    uint64_t cell_of_offset;
+    uint64_t cells_offset;
+    uint64_t cell_count;
+    uint64_t pyramid_offset;
+} SceneFileHeader;
+
+/*
+ * Lay out a scene file for a `width` x `height` scene holding the given
+ * SCENE_SECTION_* sections, returning its header. The cells, whose number
+ * depends on the scene's content, come last; `cell_count` is left 0.
+ */
+SceneFileHeader scene_file_header(int width, int height, uint32_t sections);
+
+/*
+ * Save a prepared scene to a scene file, including the acceleration sections
+ * selected by `sections` (a combination of SCENE_SECTION_* flags).
+ *
+ * Returns 0 on success and -1 if the file could not be written.
+ */
+int write_scene_file(const char* filename, const PreparedScene* prepared,
+                     uint32_t sections);
+
+/*
+ * Returns 1 if `header` describes a well-formed scene file of `file_size`
+ * bytes written on a host with this byte order, and 0 otherwise.
+ */
+int scene_header_valid(const SceneFileHeader* header, uint64_t file_size);
+
+/*
+ * Map a scene file and return it as a prepared scene, ready to render.
+ *
+ * Acceleration data missing from the file is rebuilt in memory. The prepared
+ * scene owns its scene image; `free_prepared_scene` unmaps everything.
+ * Returns NULL if the file is missing, truncated or not a scene file.
+ */
+PreparedScene* map_scene_file(const char* filename);
+
+/*
+ * Load a scene from either a scene file (which is mapped) or a PNG (which is
+ * decoded and prepared), and return it as a prepared scene that owns its
+ * scene image. Returns NULL if the file cannot be loaded.
+ */
+PreparedScene* load_scene_file(const char* filename);
+
+#endif // __SCENE_FILE_H__
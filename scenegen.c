@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "generate.h"
+#include "light_file.h"
+#include "png_writer.h"
+#include "raycaster.h"
+#include "scene_file.h"
+
+/*
+ * Generate a scene, and optionally lights for it, from a seed.
+ *
+ * Usage: scenegen [options] <output>
+ *
+ *   --kind KIND        blobs, maze, rooms or open (default blobs)
+ *   --size WxH         scene size in pixels (default 1024x1024)
+ *   --density D        how much of the scene is obstacle, from 0 to 1; see
+ *                      generate.h for what it means for each kind
+ *                      (default 0.2)
+ *   --seed N           seed for both the scene and the lights (default 1)
+ *   --lights N         number of lights to generate (default 0)
+ *   --layout LAYOUT    uniform, clustered or grid (default uniform)
+ *   --strength S       strength of every light (default 1000)
+ *   --lights-out PATH  where to write the lights (required with --lights)
+ *
+ * A scene output ending in `.scene` is written as a native scene file with its
+ * acceleration data; anything else is written as a PNG. Lights ending in
+ * `.csv` are written as CSV, anything else as a native light file.
+ *
+ * The same arguments always produce the same files, for example:
+ *
+ *   scenegen --kind rooms --size 4096x4096 --density 0.05 --seed 7 \
+ *       --lights 64 --layout clustered --lights-out rooms.lights rooms.scene
+ */
+
+static int ends_with(const char* text, const char* suffix) {
+    size_t length = strlen(text);
+    size_t suffix_length = strlen(suffix);
+    return length >= suffix_length &&
+           strcmp(text + length - suffix_length, suffix) == 0;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [--kind blobs|maze|rooms|open] [--size WxH] [--density D]\n"
+            "       [--seed N] [--lights N] [--layout uniform|clustered|grid]\n"
+            "       [--strength S] [--lights-out PATH] <output>\n",
+            program);
+}
+
+int main(int argc, char** argv) {
+    int kind = SCENE_BLOBS;
+    int width = 1024;
+    int height = 1024;
+    double density = 0.2;
+    unsigned long long seed = 1;
+    int light_count = 0;
+    int layout = LIGHTS_UNIFORM;
+    double strength = 1000;
+    const char* lights_output = NULL;
+    const char* output = NULL;
+
+    for (int arg = 1; arg < argc; arg++) {
+        const char* option = argv[arg];
+        if (option[0] != '-') {
+            if (output != NULL) {
+                usage(argv[0]);
+                return 2;
+            }
+            output = option;
+            continue;
+        }
+        if (arg + 1 >= argc) {
+            usage(argv[0]);
+            return 2;
+        }
+        const char* value = argv[++arg];
+        int valid = 1;
+        if (strcmp(option, "--kind") == 0) {
+            kind = scene_kind_parse(value);
+            valid = kind >= 0;
+        }
+        else if (strcmp(option, "--size") == 0) {
+            valid = sscanf(value, "%dx%d", &width, &height) == 2;
+        }
+        else if (strcmp(option, "--density") == 0) {
+            density = atof(value);
+        }
+        else if (strcmp(option, "--seed") == 0) {
+            seed = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(option, "--lights") == 0) {
+            light_count = atoi(value);
+            valid = light_count >= 0;
+        }
+        else if (strcmp(option, "--layout") == 0) {
+            layout = light_layout_parse(value);
+            valid = layout >= 0;
+        }
+        else if (strcmp(option, "--strength") == 0) {
+            strength = atof(value);
+        }
+        else if (strcmp(option, "--lights-out") == 0) {
+            lights_output = value;
+        }
+        else {
+            valid = 0;
+        }
+        if (!valid) {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (output == NULL || (light_count > 0 && lights_output == NULL)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    Image* scene = generate_scene(kind, width, height, density, seed);
+    if (scene == NULL) {
+        fprintf(stderr, "%s: invalid size or density\n", argv[0]);
+        return 2;
+    }
+
+    int error;
+    if (ends_with(output, ".scene")) {
+        PreparedScene* prepared = raycast_prepare(scene);
+        error = write_scene_file(output, prepared, SCENE_SECTION_ALL);
+        free_prepared_scene(prepared);
+    }
+    else {
+        error = write_image_parallel(output, scene, PNG_LEVEL_DEFAULT, 1);
+    }
+    if (error) {
+        fprintf(stderr, "%s: cannot write %s\n", argv[0], output);
+    }
+
+    if (!error && lights_output != NULL) {
+        Light* lights = generate_lights(scene, layout, light_count, strength, seed);
+        if (lights == NULL) {
+            fprintf(stderr, "%s: no open pixels to place %s lights on\n",
+                    argv[0], light_layout_name(layout));
+            error = 1;
+        }
+        else {
+            error = ends_with(lights_output, ".csv")
+                        ? write_light_csv(lights_output, lights, light_count)
+                        : write_light_file(lights_output, lights, light_count);
+            if (error) {
+                fprintf(stderr, "%s: cannot write %s\n", argv[0], lights_output);
+            }
+        }
+        raycast_free(lights);
+    }
+
+    free_image(scene);
+    return error ? 1 : 0;
+}
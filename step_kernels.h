@@ -0,0 +1,223 @@
+#ifndef __STEP_KERNELS_H__
+#define __STEP_KERNELS_H__
+
+#include <math.h>
+
+#include "raycaster_util.h"
+
+/*
+ * Traversal kernels: `step`, specialized for one kind of direction.
+ *
+ * `step` works out the signs of the direction on every call, checks both
+ * components for being near zero, and picks floor or ceil for each boundary.
+ * Along one ray all of that is the same on every step, so each kernel below
+ * fixes it at compile time instead and keeps only the arithmetic that moves
+ * `pos`. That arithmetic is exactly `step`'s, so a kernel returns the same
+ * pixel and leaves `pos` with the same bits as `step` would, whenever the
+ * kernel applies to the direction (see `step_kernel`).
+ *
+ * Image y grows downwards, so north is -y and south is +y.
+ */
+
+typedef enum {
+    STEP_GENERIC, // no specialization applies: use `step`
+    STEP_EAST,    // along an axis: the other component is below EPS
+    STEP_WEST,
+    STEP_SOUTH,
+    STEP_NORTH,
+    STEP_SOUTH_EAST, // both components at least EPS in size
+    STEP_SOUTH_WEST,
+    STEP_NORTH_EAST,
+    STEP_NORTH_WEST,
+    STEP_DIAGONAL_SOUTH_EAST, // exact diagonals walked from a pixel corner
+    STEP_DIAGONAL_SOUTH_WEST,
+    STEP_DIAGONAL_NORTH_EAST,
+    STEP_DIAGONAL_NORTH_WEST,
+    STEP_KERNEL_COUNT,
+} StepKernel;
+
+typedef PixelLocation (*StepFunction)(Pair* pos, Pair direction);
+
+// Below this in both coordinates, `pos` has enough precision for `step`'s
+// nudges off a pixel corner to stay far inside its snapping tolerance, so a
+// ray from a corner along an axis or an exact diagonal always lands on the
+// next corner
+#define STEP_CORNER_LIMIT (1u << 20)
+
+/*
+ * `step` along the x axis (SX is 1 or -1) for a direction whose y component is
+ * smaller than EPS and whose x component is not.
+ */
+#define DEFINE_STEP_HORIZONTAL(name, SX)                                       \
+    static inline PixelLocation name(Pair* pos, Pair direction) {             \
+        (void)direction;                                                       \
+        double x_adjust = pos->x;                                              \
+        if (fabs(x_adjust - round(x_adjust)) < EPS) {                          \
+            x_adjust += (SX) * (EPS * 2);                                      \
+        }                                                                      \
+        int x_bound = (SX) < 0 ? floor(x_adjust) : ceil(x_adjust);             \
+        pos->x = x_bound;                                                      \
+        return (PixelLocation){ pos->x, (int)pos->y };                         \
+    }
+
+/*
+ * `step` along the y axis (SY is 1 or -1) for a direction whose x component is
+ * smaller than EPS.
+ */
+#define DEFINE_STEP_VERTICAL(name, SY)                                         \
+    static inline PixelLocation name(Pair* pos, Pair direction) {             \
+        (void)direction;                                                       \
+        double y_adjust = pos->y;                                              \
+        if (fabs(y_adjust - round(y_adjust)) < EPS) {                          \
+            y_adjust += (SY) * (EPS * 2);                                      \
+        }                                                                      \
+        int y_bound = (SY) < 0 ? floor(y_adjust) : ceil(y_adjust);             \
+        pos->y = y_bound;                                                      \
+        return (PixelLocation){ (int)pos->x, pos->y };                         \
+    }
+
+/*
+ * `step` for a direction whose components have signs SX and SY and are both
+ * at least EPS in size. Which boundary comes first still depends on `pos`, so
+ * the octants that share a quadrant share a kernel.
+ */
+#define DEFINE_STEP_QUADRANT(name, SX, SY)                                     \
+    static inline PixelLocation name(Pair* pos, Pair direction) {             \
+        double x_adjust = pos->x;                                              \
+        double y_adjust = pos->y;                                              \
+        if (fabs(x_adjust - round(x_adjust)) < EPS) {                          \
+            x_adjust += (SX) * (EPS * 2);                                      \
+        }                                                                      \
+        if (fabs(y_adjust - round(y_adjust)) < EPS) {                          \
+            y_adjust += (SY) * (EPS * 2);                                      \
+        }                                                                      \
+        int x_bound = (SX) < 0 ? floor(x_adjust) : ceil(x_adjust);             \
+        double x_gap = x_bound - x_adjust;                                     \
+        int y_bound = (SY) < 0 ? floor(y_adjust) : ceil(y_adjust);             \
+        double y_gap = y_bound - y_adjust;                                     \
+        if (fabs(x_gap / direction.x) < fabs(y_gap / direction.y)) {           \
+            pos->x = x_bound;                                                  \
+            pos->y += direction.y * fabs(x_gap / direction.x);                 \
+            if (fabs(pos->y - round(pos->y)) < EPS * 8) {                      \
+                pos->y = y_bound;                                              \
+                return (PixelLocation){ pos->x, pos->y };                      \
+            }                                                                  \
+            return (PixelLocation){ pos->x, y_bound - (SY) };                  \
+        }                                                                      \
+        pos->x += direction.x * fabs(y_gap / direction.y);                     \
+        pos->y = y_bound;                                                      \
+        if (fabs(pos->x - round(pos->x)) < EPS * 8) {                          \
+            pos->x = x_bound;                                                  \
+            return (PixelLocation){ pos->x, pos->y };                          \
+        }                                                                      \
+        return (PixelLocation){ x_bound - (SX), pos->y };                      \
+    }
+
+/*
+ * `step` along an exact diagonal (|dx| == |dy|) with signs SX and SY, from a
+ * pixel corner. `step` crosses both boundaries at once there, snaps `pos` to
+ * the next corner and returns it, so the kernel just moves to that corner.
+ */
+#define DEFINE_STEP_DIAGONAL(name, SX, SY)                                     \
+    static inline PixelLocation name(Pair* pos, Pair direction) {             \
+        (void)direction;                                                       \
+        pos->x += (SX);                                                        \
+        pos->y += (SY);                                                        \
+        return (PixelLocation){ pos->x, pos->y };                              \
+    }
+
+DEFINE_STEP_HORIZONTAL(step_east, 1)
+DEFINE_STEP_HORIZONTAL(step_west, -1)
+DEFINE_STEP_VERTICAL(step_south, 1)
+DEFINE_STEP_VERTICAL(step_north, -1)
+DEFINE_STEP_QUADRANT(step_south_east, 1, 1)
+DEFINE_STEP_QUADRANT(step_south_west, -1, 1)
+DEFINE_STEP_QUADRANT(step_north_east, 1, -1)
+DEFINE_STEP_QUADRANT(step_north_west, -1, -1)
+DEFINE_STEP_DIAGONAL(step_diagonal_south_east, 1, 1)
+DEFINE_STEP_DIAGONAL(step_diagonal_south_west, -1, 1)
+DEFINE_STEP_DIAGONAL(step_diagonal_north_east, 1, -1)
+DEFINE_STEP_DIAGONAL(step_diagonal_north_west, -1, -1)
+
+/*
+ * Returns the kernel that matches `step` for `direction` from any position:
+ * an axis kernel if either component is below EPS in size, and a quadrant
+ * kernel otherwise.
+ */
+static inline StepKernel step_kernel(Pair direction) {
+    if (fabs(direction.x) < EPS) {
+        return direction.y < 0 ? STEP_NORTH : STEP_SOUTH;
+    }
+    if (fabs(direction.y) < EPS) {
+        return direction.x < 0 ? STEP_WEST : STEP_EAST;
+    }
+    if (direction.y > 0) {
+        return direction.x > 0 ? STEP_SOUTH_EAST : STEP_SOUTH_WEST;
+    }
+    return direction.x > 0 ? STEP_NORTH_EAST : STEP_NORTH_WEST;
+}
+
+/*
+ * Returns the kernel for a ray walked from the corner `pos = (start.x,
+ * start.y)` towards `end`, where `direction = direction_pair(start, end)`:
+ * `step_kernel`, or a diagonal kernel for exact diagonals.
+ *
+ * Axis kernels are only returned for directions exactly along the axis, so
+ * that callers can take the other component to be zero, as it is for rays
+ * between pixels in the same row or column. Rays so steep that a component is
+ * below EPS without being zero get STEP_GENERIC.
+ */
+static inline StepKernel ray_step_kernel(PixelLocation start, PixelLocation end,
+                                         Pair direction) {
+    StepKernel kernel = step_kernel(direction);
+    if ((kernel == STEP_NORTH || kernel == STEP_SOUTH) && direction.x != 0) {
+        return STEP_GENERIC;
+    }
+    if ((kernel == STEP_EAST || kernel == STEP_WEST) && direction.y != 0) {
+        return STEP_GENERIC;
+    }
+    unsigned int x_dist = start.x > end.x ? start.x - end.x : end.x - start.x;
+    unsigned int y_dist = start.y > end.y ? start.y - end.y : end.y - start.y;
+    if (kernel < STEP_SOUTH_EAST || x_dist != y_dist || start.x >= STEP_CORNER_LIMIT ||
+        start.y >= STEP_CORNER_LIMIT || end.x >= STEP_CORNER_LIMIT ||
+        end.y >= STEP_CORNER_LIMIT) {
+        return kernel;
+    }
+    return kernel + (STEP_DIAGONAL_SOUTH_EAST - STEP_SOUTH_EAST);
+}
+
+/*
+ * Returns the step function of a kernel; `step` itself for STEP_GENERIC.
+ */
+static inline StepFunction step_kernel_function(StepKernel kernel) {
+    switch (kernel) {
+    case STEP_EAST:
+        return step_east;
+    case STEP_WEST:
+        return step_west;
+    case STEP_SOUTH:
+        return step_south;
+    case STEP_NORTH:
+        return step_north;
+    case STEP_SOUTH_EAST:
+        return step_south_east;
+    case STEP_SOUTH_WEST:
+        return step_south_west;
+    case STEP_NORTH_EAST:
+        return step_north_east;
+    case STEP_NORTH_WEST:
+        return step_north_west;
+    case STEP_DIAGONAL_SOUTH_EAST:
+        return step_diagonal_south_east;
+    case STEP_DIAGONAL_SOUTH_WEST:
+        return step_diagonal_south_west;
+    case STEP_DIAGONAL_NORTH_EAST:
+        return step_diagonal_north_east;
+    case STEP_DIAGONAL_NORTH_WEST:
+        return step_diagonal_north_west;
+    default:
+        return step;
+    }
+}
+
+#endif // __STEP_KERNELS_H__
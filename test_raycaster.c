@@ -1,9 +1,24 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
+#include "alloc.h"
 #include "image.h"
+#include "generate.h"
+#include "light_file.h"
+#include "out_of_core.h"
+#include "png_writer.h"
+#include "raycastd.h"
+#include "trace.h"
 #include "raycaster.h"
 #include "raycaster_util.h"
+#include "scene_file.h"
 
 // Color definitions
 
@@ -382,7 +397,1371 @@ int test_raycast_parallel_row(void) {
     return errors;
 }
 
-// Run all three test suites.
+/*
+ * Helper function for accumulating prepared-scene cases
+ * Renders `info` against an already prepared scene with every engine
+ */
+char raycast_prepared_check(int test, RaycastTest* info,
+    PreparedScene* prepared, int thread_count) {
+    char error = 0;
+    const char* engines[] = { "sequential", "parallel_lights", "parallel_rows" };
+    for (int engine = 0; engine < 3; engine++) {
+        Image* out;
+        if (engine == 0) {
+            out = raycast_prepared_sequential(prepared, info->lights,
+                info->light_count);
+        }
+        else if (engine == 1) {
+            out = raycast_prepared_parallel_lights(prepared, info->lights,
+                info->light_count, thread_count);
+        }
+        else {
+            out = raycast_prepared_parallel_rows(prepared, info->lights,
+                info->light_count, thread_count);
+        }
+        error |= image_almost_equal(info, test, out, engines[engine]);
+        free_image(out);
+    }
+
+    free_test(info);
+
+    if (!error) {
+        printf("raycast_prepared test %d passed\n", test);
+    }
+
+    return error;
+}
+
+/*
+ * Test rendering several light sets against a single prepared scene
+ */
+int test_raycast_prepared(void) {
+    int errors = 0;
+
+    Image* small = read_image("images/small.png");
+    PreparedScene* prepared = raycast_prepare(small);
+    errors += raycast_prepared_check(0, test_small(), prepared, 1);
+    errors += raycast_prepared_check(1, test_small_2_light(), prepared, 2);
+    errors += raycast_prepared_check(2, test_small_4_light(), prepared, 4);
+    errors += raycast_prepared_check(3, test_no_lights(), prepared, 2);
+    free_prepared_scene(prepared);
+    free_image(small);
+
+    Image* long_image = read_image("images/long.png");
+    prepared = raycast_prepare(long_image);
+    errors += raycast_prepared_check(4, test_long(), prepared, 4);
+    free_prepared_scene(prepared);
+    free_image(long_image);
+
+    return errors;
+}
+
+/*
+ * Test rendering scenes loaded from native scene files, with and without
+ * precomputed acceleration sections
+ */
+int test_scene_file(void) {
+    int errors = 0;
+    const char* path = "images/small_test.scene";
+
+    Image* small = read_image("images/small.png");
+    PreparedScene* prepared = raycast_prepare(small);
+    uint32_t sections[] = { SCENE_SECTION_ALL, 0 };
+    for (int i = 0; i < 2; i++) {
+        if (write_scene_file(path, prepared, sections[i]) != 0) {
+            printf("Test %d: cannot write %s\n", i, path);
+            errors++;
+            continue;
+        }
+        PreparedScene* mapped = map_scene_file(path);
+        if (mapped == NULL) {
+            printf("Test %d: cannot map %s\n", i, path);
+            errors++;
+            continue;
+        }
+        errors += raycast_prepared_check(i, test_small_4_light(), mapped, 2);
+        free_prepared_scene(mapped);
+    }
+    free_prepared_scene(prepared);
+    free_image(small);
+
+    // Sections stored in the file are mapped, not rebuilt: with all of them,
+    // only the scene's handles are allocated
+    Image* large = read_image("images/large.png");
+    prepared = raycast_prepare(large);
+    write_scene_file(path, prepared, SCENE_SECTION_ALL);
+    RaycastAllocStats before;
+    RaycastAllocStats after;
+    raycast_alloc_stats(&before);
+    PreparedScene* mapped = map_scene_file(path);
+    raycast_alloc_stats(&after);
+    uint64_t map_bytes = after.bytes_allocated - before.bytes_allocated;
+    if (mapped == NULL || map_bytes > 4096) {
+        printf("Test 3: mapping every section of a %dx%d scene allocated %llu "
+               "bytes\n", large->width, large->height,
+               (unsigned long long)map_bytes);
+        errors++;
+    }
+    if (mapped != NULL) {
+        free_prepared_scene(mapped);
+    }
+    remove(path);
+    free_prepared_scene(prepared);
+    free_image(large);
+
+    if (map_scene_file("images/small.png") != NULL) {
+        printf("Test 2: mapped a PNG as a scene file\n");
+        errors++;
+    }
+
+    return errors;
+}
+
+/*
+ * Test out-of-core rendering: a scene split into many tiles under a small
+ * memory budget must match the in-memory sequential render exactly
+ */
+int test_out_of_core(void) {
+    int errors = 0;
+    const char* scene_path = "images/large_test.scene";
+    const char* out_path = "images/large_test_out.scene";
+
+    Image* large = read_image("images/large.png");
+    PreparedScene* prepared = raycast_prepare(large);
+    write_scene_file(scene_path, prepared, 0);
+    free_prepared_scene(prepared);
+
+    Light lights[4];
+    lights[0] = (Light){ WHITE, 100.0, (PixelLocation) { 10, 10 } };
+    lights[1] = (Light){ YELLOW, 400.0, (PixelLocation) { 200, 150 } };
+    lights[2] = (Light){ BLUE, 50.0, (PixelLocation) { 390, 20 } };
+    lights[3] = (Light){ MAGENTA, 250.0, (PixelLocation) { 100, 350 } };
+    Image* expected = raycast_sequential(large, lights, 4);
+
+    // 256 KiB and 1 MiB force tiles far smaller than the 400x400 scene, and
+    // the render must never hold more than its budget
+    size_t budgets[2] = { 256 * 1024, 1024 * 1024 };
+    for (int test = 0; test < 2; test++) {
+        RaycastAllocStats before;
+        RaycastAllocStats after;
+        raycast_alloc_stats_reset();
+        raycast_alloc_stats(&before);
+        if (raycast_out_of_core(scene_path, out_path, lights, 4, budgets[test], 2) != 0) {
+            printf("Test %d: out-of-core render failed\n", test);
+            errors++;
+            continue;
+        }
+        raycast_alloc_stats(&after);
+        uint64_t peak = after.peak_bytes - before.live_bytes;
+
+        PreparedScene* mapped = map_scene_file(out_path);
+        Image* actual = prepared_scene_image(mapped);
+        unsigned long mismatch_count = 0;
+        for (int i = 0; i < expected->width * expected->height; i++) {
+            Color e = expected->pixels[i];
+            Color a = actual->pixels[i];
+            mismatch_count += e.red != a.red || e.green != a.green || e.blue != a.blue;
+        }
+        if (mismatch_count > 0 || peak > budgets[test]) {
+            printf("Test %d failed: %ld pixels differ from raycast_sequential, "
+                "peak %llu of %zu bytes\n", test, mismatch_count,
+                (unsigned long long)peak, budgets[test]);
+            errors++;
+        }
+        else {
+            printf("raycast_out_of_core test %d passed\n", test);
+        }
+        free_prepared_scene(mapped);
+    }
+
+    // A budget too small for even one pixel and its halo must fail cleanly
+    if (raycast_out_of_core(scene_path, out_path, lights, 4, 64 * 1024, 2) != -1) {
+        printf("Test 2: expected failure for a tiny memory budget\n");
+        errors++;
+    }
+    else {
+        printf("raycast_out_of_core test 2 passed\n");
+    }
+
+    remove(scene_path);
+    remove(out_path);
+    free_image(expected);
+    free_image(large);
+
+    return errors;
+}
+
+/*
+ * Test the parallel PNG writer: every level and thread count must round-trip
+ * a rendered image exactly
+ */
+int test_write_image_parallel(void) {
+    int errors = 0;
+    const char* path = "images/parallel_png_test.png";
+
+    RaycastTest* info = test_long();
+    Image* rendered = raycast_sequential(info->image, info->lights, info->light_count);
+    free_test(info);
+
+    int levels[] = { PNG_LEVEL_STORE, PNG_LEVEL_FAST, PNG_LEVEL_DEFAULT, PNG_LEVEL_BEST };
+    int threads[] = { 1, 3, 8 };
+    int test = 0;
+    for (int l = 0; l < 4; l++) {
+        for (int t = 0; t < 3; t++, test++) {
+            Image* decoded = NULL;
+            if (write_image_parallel(path, rendered, levels[l], threads[t]) == 0) {
+                decoded = read_image(path);
+            }
+            int same = decoded != NULL && decoded->width == rendered->width &&
+                decoded->height == rendered->height;
+            for (int i = 0; same && i < rendered->width * rendered->height; i++) {
+                same = decoded->pixels[i].red == rendered->pixels[i].red &&
+                    decoded->pixels[i].green == rendered->pixels[i].green &&
+                    decoded->pixels[i].blue == rendered->pixels[i].blue;
+            }
+            if (same) {
+                printf("write_image_parallel test %d passed\n", test);
+            }
+            else {
+                printf("Test %d failed: level %d with %d threads did not round-trip\n",
+                    test, levels[l], threads[t]);
+                errors++;
+            }
+            if (decoded != NULL) {
+                free_image(decoded);
+            }
+        }
+    }
+
+    remove(path);
+    free_image(rendered);
+    return errors;
+}
+
+/*
+ * Test region rendering: every rectangle must match the same rectangle of a
+ * full sequential render, without writing outside it
+ */
+int test_region(void) {
+    int errors = 0;
+
+    // A weak fifth light that only some of the regions are close enough to see
+    RaycastTest* info = test_long();
+    Light lights[5];
+    memcpy(lights, info->lights, sizeof(Light) * 4);
+    lights[4] = (Light){ WHITE, 10.0, (PixelLocation) { 3, 5 } };
+    Image* scene = info->image;
+    Image* expected = raycast_sequential(scene, lights, 5);
+    PreparedScene* prepared = raycast_prepare(scene);
+
+    int regions[5][4] = {
+        { 0, 0, scene->width, scene->height },
+        { 37, 11, 90, 50 },
+        { 0, 0, 6, 9 },
+        { scene->width - 1, scene->height - 1, 1, 1 },
+        { 5, 60, 1, 40 },
+    };
+    int stride = scene->width + 7;
+    Color* out = malloc(sizeof(Color) * stride * scene->height);
+    Color sentinel = { 1, 2, 3 };
+    for (int test = 0; test < 6; test++) {
+        int* r = regions[test < 5 ? test : 1];
+        for (int i = 0; i < stride * scene->height; i++) {
+            out[i] = sentinel;
+        }
+        int result = test < 5
+            ? raycast_prepared_region(prepared, lights, 5, r[0], r[1], r[2], r[3],
+                out, stride, test % 3 + 1)
+            : raycast_region(scene, lights, 5, r[0], r[1], r[2], r[3], out, stride, 2);
+
+        unsigned long mismatch_count = 0;
+        unsigned long overwritten = 0;
+        for (int row = 0; row < scene->height; row++) {
+            for (int col = 0; col < stride; col++) {
+                Color a = out[row * stride + col];
+                if (row < r[3] && col < r[2]) {
+                    Color e = expected->pixels[(r[1] + row) * scene->width + r[0] + col];
+                    mismatch_count += e.red != a.red || e.green != a.green || e.blue != a.blue;
+                }
+                else {
+                    overwritten += a.red != sentinel.red || a.green != sentinel.green ||
+                        a.blue != sentinel.blue;
+                }
+            }
+        }
+        if (result != 0 || mismatch_count > 0 || overwritten > 0) {
+            printf("Test %d failed: %ld pixels differ, %ld written outside the region\n",
+                test, mismatch_count, overwritten);
+            errors++;
+        }
+        else {
+            printf("raycast_region test %d passed\n", test);
+        }
+    }
+
+    // Rectangles leaving the scene and short strides are refused
+    int bad[3][5] = {
+        { -1, 0, 10, 10, stride },
+        { 0, 0, scene->width + 1, 1, stride },
+        { 10, 10, 20, 20, 19 },
+    };
+    for (int test = 6; test < 9; test++) {
+        int* b = bad[test - 6];
+        if (raycast_prepared_region(prepared, lights, 5, b[0], b[1], b[2], b[3],
+                out, b[4], 1) != -1) {
+            printf("Test %d failed: bad region was accepted\n", test);
+            errors++;
+        }
+        else {
+            printf("raycast_region test %d passed\n", test);
+        }
+    }
+
+    free(out);
+    free_prepared_scene(prepared);
+    free_image(expected);
+    free_test(info);
+    return errors;
+}
+
+/*
+ * Count the pixels of the `width` x `height` region of `expected` at (x, y)
+ * that differ from the row-major pixels in `actual`.
+ */
+unsigned long region_mismatches(const Color* actual, Image* expected, int x,
+    int y, int width, int height) {
+    unsigned long mismatch_count = 0;
+    for (int row = 0; row < height; row++) {
+        for (int col = 0; col < width; col++) {
+            Color e = expected->pixels[(y + row) * expected->width + x + col];
+            Color a = actual[row * width + col];
+            mismatch_count += e.red != a.red || e.green != a.green || e.blue != a.blue;
+        }
+    }
+    return mismatch_count;
+}
+
+static void* run_test_server(void* arg) {
+    raycastd_run((RaycastServer*)arg);
+    return NULL;
+}
+
+/*
+ * Test the render daemon: whole scenes, regions and caller-supplied buffers
+ * must match the engines exactly, and bad requests must be rejected
+ */
+int test_raycastd(void) {
+    int errors = 0;
+    const char* socket_path = "images/raycastd_test.sock";
+    const char* buffer_path = "images/raycastd_test.buffer";
+
+    RaycastTest* info = test_long();
+    Image* sequential = raycast_sequential(info->image, info->lights, info->light_count);
+    Image* by_light = raycast_parallel_lights(info->image, info->lights,
+        info->light_count, 3);
+    Image* unlit = raycast_sequential(info->image, NULL, 0);
+
+    RaycastServer* server = raycastd_create(socket_path, 2, 3);
+    raycastd_add_scene(server, "long", load_scene_file("images/long.png"));
+    pthread_t thread;
+    pthread_create(&thread, NULL, run_test_server, server);
+    int connection = raycastd_connect(socket_path);
+
+    int buffer_fd = open(buffer_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (ftruncate(buffer_fd, sizeof(Color) * info->image->width * info->image->height) != 0) {
+        printf("cannot size %s\n", buffer_path);
+    }
+
+    // Whole scene, region, whole scene into our buffer, lights engine, and a
+    // scene without lights, which must still show its obstacles
+    RenderRequest requests[5] = {
+        { RAYCASTD_MAGIC, ENGINE_PARALLEL_ROWS, 4, info->light_count, 0, 0, 0, 0, "long" },
+        { RAYCASTD_MAGIC, ENGINE_SEQUENTIAL, 1, info->light_count, 37, 11, 90, 50, "long" },
+        { RAYCASTD_MAGIC, ENGINE_PARALLEL_ROWS, 2, info->light_count, 0, 0, 0, 0, "long" },
+        { RAYCASTD_MAGIC, ENGINE_PARALLEL_LIGHTS, 3, info->light_count, 0, 0, 0, 0, "long" },
+        { RAYCASTD_MAGIC, ENGINE_PARALLEL_ROWS, 2, 0, 0, 0, 0, 0, "long" },
+    };
+    int use_buffer[5] = { 0, 0, 1, 0, 0 };
+    Image* expected[5] = { sequential, sequential, sequential, by_light, unlit };
+
+    for (int test = 0; test < 5; test++) {
+        RenderRequest* request = &requests[test];
+        RenderResponse response;
+        int result_fd;
+        int fd = use_buffer[test] ? buffer_fd : -1;
+        if (raycastd_render(connection, request, info->lights, fd, &response,
+                &result_fd) != 0 || response.status != RAYCASTD_OK ||
+            (result_fd < 0) != use_buffer[test]) {
+            printf("Test %d failed: request was not served\n", test);
+            errors++;
+            continue;
+        }
+        if (result_fd >= 0) {
+            fd = result_fd;
+        }
+        Color* pixels = mmap(NULL, response.length, PROT_READ, MAP_SHARED, fd, 0);
+        unsigned long mismatch_count = region_mismatches(pixels, expected[test],
+            request->x, request->y, response.width, response.height);
+        int expected_width = request->width ? request->width : info->image->width;
+        if (response.width != expected_width || mismatch_count > 0) {
+            printf("Test %d failed: %ld pixels differ\n", test, mismatch_count);
+            errors++;
+        }
+        else {
+            printf("raycastd test %d passed\n", test);
+        }
+        munmap(pixels, response.length);
+        if (result_fd >= 0) {
+            close(result_fd);
+        }
+    }
+
+    // Unknown scenes, regions outside the scene and thread counts past the
+    // cap are rejected
+    RenderRequest bad[4] = {
+        { RAYCASTD_MAGIC, ENGINE_SEQUENTIAL, 1, 0, 0, 0, 0, 0, "missing" },
+        { RAYCASTD_MAGIC, ENGINE_SEQUENTIAL, 1, 0, 100, 0, 200, 10, "long" },
+        { RAYCASTD_MAGIC, ENGINE_PARALLEL_ROWS, RAYCASTD_MAX_THREADS + 1, 0, 0, 0, 0, 0, "long" },
+        { RAYCASTD_MAGIC, ENGINE_PARALLEL_ROWS, UINT32_MAX, 0, 0, 0, 0, 0, "long" },
+    };
+    int statuses[4] = { RAYCASTD_UNKNOWN_SCENE, RAYCASTD_BAD_REQUEST,
+                        RAYCASTD_BAD_REQUEST, RAYCASTD_BAD_REQUEST };
+    for (int test = 5; test < 9; test++) {
+        RenderResponse response;
+        int result_fd;
+        if (raycastd_render(connection, &bad[test - 5], NULL, -1, &response,
+                &result_fd) != 0 || response.status != statuses[test - 5] ||
+            result_fd != -1) {
+            printf("Test %d failed: bad request was not rejected\n", test);
+            errors++;
+        }
+        else {
+            printf("raycastd test %d passed\n", test);
+        }
+    }
+
+    close(connection);
+    close(buffer_fd);
+    raycastd_shutdown(server);
+    pthread_join(thread, NULL);
+    raycastd_free(server);
+    remove(buffer_path);
+    free_image(sequential);
+    free_image(by_light);
+    free_image(unlit);
+    free_test(info);
+    return errors;
+}
+
+/*
+ * Count the lights in `actual` that differ from `expected`.
+ */
+int light_mismatches(const Light* actual, const Light* expected, int count) {
+    int mismatch_count = 0;
+    for (int i = 0; i < count; i++) {
+        mismatch_count += actual[i].color.red != expected[i].color.red ||
+            actual[i].color.green != expected[i].color.green ||
+            actual[i].color.blue != expected[i].color.blue ||
+            actual[i].strength != expected[i].strength ||
+            actual[i].pixel.x != expected[i].pixel.x ||
+            actual[i].pixel.y != expected[i].pixel.y;
+    }
+    return mismatch_count;
+}
+
+/*
+ * Test light files: CSV and native files must load the exact lights they
+ * describe, and malformed files must be refused
+ */
+int test_light_file(void) {
+    int errors = 0;
+    const char* csv_path = "images/lights_test.csv";
+    const char* native_path = "images/lights_test.lights";
+
+    RaycastTest* info = test_small_4_light();
+    FILE* csv = fopen(csv_path, "w");
+    fprintf(csv, "x,y,red,green,blue,strength\n# four lights\n\n");
+    for (int i = 0; i < info->light_count; i++) {
+        Light light = info->lights[i];
+        fprintf(csv, "%u, %u,%u,%u,%u,%.17g%s", light.pixel.x, light.pixel.y,
+            light.color.red, light.color.green, light.color.blue, light.strength,
+            i % 2 ? "\r\n" : "\n");
+    }
+    fclose(csv);
+
+    LightSet* sets[3] = { NULL, NULL, NULL };
+    sets[0] = load_light_file(csv_path);
+    if (sets[0] != NULL) {
+        write_light_file(native_path, sets[0]->lights, sets[0]->count);
+        sets[1] = map_light_file(native_path);
+        sets[2] = load_light_file(native_path);
+    }
+    for (int test = 0; test < 3; test++) {
+        if (sets[test] == NULL || sets[test]->count != info->light_count ||
+            light_mismatches(sets[test]->lights, info->lights, info->light_count) > 0) {
+            printf("Test %d failed: lights did not load exactly\n", test);
+            errors++;
+        }
+        else {
+            printf("light file test %d passed\n", test);
+        }
+    }
+
+    // Loaded lights render like the originals
+    if (sets[2] != NULL) {
+        Image* out = raycast_sequential(info->image, sets[2]->lights, sets[2]->count);
+        if (image_almost_equal(info, 3, out, "light_file_test")) {
+            errors++;
+        }
+        else {
+            printf("light file test 3 passed\n");
+        }
+        free_image(out);
+    }
+
+    // A color out of range, a missing field and a PNG are all refused
+    const char* malformed[2] = { "1,2,256,0,0,10\n", "1,2,3,4,5\n" };
+    for (int test = 4; test < 7; test++) {
+        LightSet* set;
+        if (test < 6) {
+            csv = fopen(csv_path, "w");
+            fputs(malformed[test - 4], csv);
+            fclose(csv);
+            set = read_light_csv(csv_path);
+        }
+        else {
+            set = map_light_file("images/small.png");
+        }
+        if (set != NULL) {
+            printf("Test %d failed: malformed lights were accepted\n", test);
+            free_light_set(set);
+            errors++;
+        }
+        else {
+            printf("light file test %d passed\n", test);
+        }
+    }
+
+    for (int i = 0; i < 3; i++) {
+        if (sets[i] != NULL) {
+            free_light_set(sets[i]);
+        }
+    }
+    remove(csv_path);
+    remove(native_path);
+    free_test(info);
+    return errors;
+}
+
+/*
+ * Progress recorded by `record_progress`
+ */
+typedef struct {
+    int calls;
+    int steps[8];
+    int stop_after; // stop refining after this many levels (0 never stops)
+    int preview_errors; // preview pixels that do not copy their sample
+} ProgressLog;
+
+int record_progress(const Image* preview, int step, void* context) {
+    ProgressLog* log = (ProgressLog*)context;
+    if (log->calls < 8) {
+        log->steps[log->calls] = step;
+    }
+    log->calls++;
+    for (int y = 0; y < preview->height; y++) {
+        for (int x = 0; x < preview->width; x++) {
+            Color p = preview->pixels[y * preview->width + x];
+            Color s = preview->pixels[(y - y % step) * preview->width + x - x % step];
+            log->preview_errors += p.red != s.red || p.green != s.green || p.blue != s.blue;
+        }
+    }
+    return log->stop_after != 0 && log->calls >= log->stop_after;
+}
+
+/*
+ * Test progressive rendering: previews must be filled from their samples, the
+ * levels must refine 8, 4, 2, 1, and the final image must match the
+ * sequential render exactly
+ */
+int test_progressive(void) {
+    int errors = 0;
+    // A thread count below one renders on a single thread
+    RaycastTest* tests[3] = { test_long(), test_small_4_light(), test_long() };
+    int threads[3] = { 1, 3, -2 };
+
+    for (int test = 0; test < 3; test++) {
+        RaycastTest* info = tests[test];
+        Image* expected = raycast_sequential(info->image, info->lights, info->light_count);
+        PreparedScene* prepared = raycast_prepare(info->image);
+        ProgressLog log = { 0 };
+        Image* out = raycast_prepared_progressive(prepared, info->lights,
+            info->light_count, threads[test], record_progress, &log);
+
+        unsigned long mismatch_count = region_mismatches(out->pixels, expected, 0, 0,
+            expected->width, expected->height);
+        int levels_ok = log.calls == 4 && log.steps[0] == 8 && log.steps[1] == 4 &&
+            log.steps[2] == 2 && log.steps[3] == 1;
+        if (mismatch_count > 0 || !levels_ok || log.preview_errors > 0) {
+            printf("Test %d failed: %ld pixels differ, %d levels, %d bad preview pixels\n",
+                test, mismatch_count, log.calls, log.preview_errors);
+            errors++;
+        }
+        else {
+            printf("raycast_prepared_progressive test %d passed\n", test);
+        }
+        free_image(out);
+        free_prepared_scene(prepared);
+        free_image(expected);
+    }
+
+    // A callback can stop refinement early
+    PreparedScene* prepared = raycast_prepare(tests[0]->image);
+    ProgressLog log = { .stop_after = 2 };
+    Image* out = raycast_prepared_progressive(prepared, tests[0]->lights,
+        tests[0]->light_count, 2, record_progress, &log);
+    if (log.calls != 2) {
+        printf("Test 3 failed: refinement continued after the callback stopped it\n");
+        errors++;
+    }
+    else {
+        printf("raycast_prepared_progressive test 3 passed\n");
+    }
+    free_image(out);
+    free_prepared_scene(prepared);
+
+    free_test(tests[0]);
+    free_test(tests[1]);
+    free_test(tests[2]);
+    return errors;
+}
+
+/*
+ * Test the traversal counters. Built without them, they must read as zero;
+ * built with them, every open pixel must account for every light exactly once
+ * and the row engine must count exactly what the sequential engine does
+ */
+int test_stats(void) {
+    int errors = 0;
+    RaycastStats stats;
+    raycast_stats_reset();
+    if (raycast_stats(&stats) != 0) {
+        int zero = stats.rays_traced == 0 && stats.steps == 0 && stats.obstacle_pixels == 0;
+        if (!zero) {
+            printf("Test 0 failed: counters compiled out but not zero\n");
+            errors++;
+        }
+        else {
+            printf("raycast_stats test 0 passed (counters compiled out)\n");
+        }
+        return errors;
+    }
+
+    RaycastTest* info = test_small_4_light();
+    PreparedScene* prepared = raycast_prepare(info->image);
+    Image* out = raycast_prepared_sequential(prepared, info->lights, info->light_count);
+    free_image(out);
+    RaycastStats sequential;
+    raycast_stats(&sequential);
+
+    unsigned long obstacle_count = 0;
+    for (int i = 0; i < info->image->width * info->image->height; i++) {
+        obstacle_count += is_obstacle(info->image->pixels[i]);
+    }
+    uint64_t open_pixel_lights = (info->image->width * info->image->height - obstacle_count) *
+        (uint64_t)info->light_count;
+    if (sequential.obstacle_pixels != obstacle_count ||
+        sequential.self_light_hits + sequential.clearance_hits + sequential.cell_hits +
+                sequential.region_culls + sequential.rays_traced !=
+            open_pixel_lights ||
+        sequential.rays_blocked + sequential.rays_reached != sequential.rays_traced ||
+        sequential.steps < sequential.rays_traced) {
+        printf("Test 0 failed: sequential counters do not add up\n");
+        errors++;
+    }
+    else {
+        printf("raycast_stats test 0 passed\n");
+    }
+
+    raycast_stats_reset();
+    out = raycast_prepared_parallel_rows(prepared, info->lights, info->light_count, 3);
+    free_image(out);
+    raycast_stats(&stats);
+    if (memcmp(&stats, &sequential, sizeof(stats)) != 0) {
+        printf("Test 1 failed: row engine counted differently\n");
+        errors++;
+    }
+    else {
+        printf("raycast_stats test 1 passed\n");
+    }
+
+    free_prepared_scene(prepared);
+    free_test(info);
+    return errors;
+}
+
+/*
+ * Test per-pixel cost rendering. The image must match the sequential engine,
+ * obstacles must cost nothing, and with counters built in the costs must sum to
+ * the steps counted. The heatmap must put the most expensive pixel at white
+ */
+int test_cost(void) {
+    int errors = 0;
+    RaycastTest* info = test_small_4_light();
+    int width = info->image->width;
+    int height = info->image->height;
+    Image* expected = raycast_sequential(info->image, info->lights, info->light_count);
+    PreparedScene* prepared = raycast_prepare(info->image);
+    uint32_t* cost = malloc(sizeof(uint32_t) * width * height);
+    raycast_stats_reset();
+    Image* out = raycast_prepared_cost(prepared, info->lights, info->light_count, 3, cost);
+    RaycastStats stats;
+    int counted = raycast_stats(&stats) == 0;
+
+    unsigned long mismatch_count = region_mismatches(out->pixels, expected, 0, 0,
+        width, height);
+    uint64_t total = 0;
+    int obstacle_costs = 0;
+    for (int i = 0; i < width * height; i++) {
+        total += cost[i];
+        obstacle_costs += is_obstacle(info->image->pixels[i]) && cost[i] != 0;
+    }
+    if (mismatch_count > 0 || obstacle_costs > 0 || total == 0 ||
+        (counted && total != stats.steps)) {
+        printf("Test 0 failed: %ld pixels differ, %d obstacles cost steps, %lu steps\n",
+            mismatch_count, obstacle_costs, (unsigned long)total);
+        errors++;
+    }
+    else {
+        printf("raycast_prepared_cost test 0 passed\n");
+    }
+
+    Image* heatmap = cost_heatmap(cost, width, height);
+    int hottest = 0;
+    for (int i = 0; i < width * height; i++) {
+        hottest = cost[i] > cost[hottest] ? i : hottest;
+    }
+    Color hot = heatmap->pixels[hottest];
+    Color cold = heatmap->pixels[0];
+    int cold_ok = cost[0] != 0 || (cold.red == 0 && cold.green == 0 && cold.blue == 0);
+    if (hot.red != 255 || hot.green != 255 || hot.blue != 255 || !cold_ok) {
+        printf("Test 1 failed: heatmap does not span black to white\n");
+        errors++;
+    }
+    else {
+        printf("cost_heatmap test 1 passed\n");
+    }
+
+    free_image(heatmap);
+    free_image(out);
+    free(cost);
+    free_prepared_scene(prepared);
+    free_image(expected);
+    free_test(info);
+    return errors;
+}
+
+/*
+ * Test rays along rows and columns. In a scene one pixel tall or wide every
+ * ray runs along the scene, so each pixel's expected color follows from the
+ * obstacles between it and each light alone. The scenes span several 64-pixel
+ * mask words, and one light lies beyond the scene's end.
+ */
+int test_axis_rays(void) {
+    int errors = 0;
+    int length = 300;
+    uint64_t state = 99;
+    for (int test = 0; test < 2; test++) {
+        int horizontal = test == 0;
+        Image* scene = horizontal ? new_image(length, 1) : new_image(1, length);
+        for (int i = 0; i < length; i++) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            scene->pixels[i] = (state >> 33) % 23 == 0 ? (Color){ 0, 0, 0 } : WHITE;
+        }
+        Light lights[4];
+        unsigned int positions[4] = { 3, 150, 280, length + 20 };
+        for (int l = 0; l < 4; l++) {
+            PixelLocation pixel = horizontal ? (PixelLocation){ positions[l], 0 }
+                                             : (PixelLocation){ 0, positions[l] };
+            lights[l] = (Light){ WHITE, 20000., pixel };
+        }
+
+        PreparedScene* prepared = raycast_prepare(scene);
+        Image* sequential = raycast_prepared_sequential(prepared, lights, 4);
+        Image* rows = raycast_prepared_parallel_rows(prepared, lights, 4, 2);
+        int mismatches = 0;
+        for (int i = 0; i < length; i++) {
+            Color orig = scene->pixels[i];
+            int x = horizontal ? i : 0;
+            int y = horizontal ? 0 : i;
+            Color total = (Color){ 0, 0, 0 };
+            for (int l = 0; l < 4 && !is_obstacle(orig); l++) {
+                int to = positions[l];
+                int sign = to > i ? 1 : -1;
+                int at = i;
+                while (at != to) {
+                    at += sign;
+                    if (at != to && at < length && is_obstacle(scene->pixels[at])) {
+                        break;
+                    }
+                }
+                if (at == to) {
+                    total = add_colors(total, illuminate(lights[l], x, y));
+                }
+            }
+            Color expected = is_obstacle(orig) ? orig : mul_colors(total, orig);
+            Color results[2] = { sequential->pixels[i], rows->pixels[i] };
+            for (int r = 0; r < 2; r++) {
+                if (results[r].red != expected.red || results[r].green != expected.green ||
+                    results[r].blue != expected.blue) {
+                    mismatches++;
+                }
+            }
+        }
+        if (mismatches > 0) {
+            printf("Test %d failed: %d pixels differ along a %s\n", test, mismatches,
+                horizontal ? "row" : "column");
+            errors++;
+        }
+        else {
+            printf("axis ray test %d passed\n", test);
+        }
+
+        free_image(sequential);
+        free_image(rows);
+        free_prepared_scene(prepared);
+        free_image(scene);
+    }
+    return errors;
+}
+
+/*
+ * Test culling between regions of open space. Two rooms sealed by a wall must
+ * each be lit by their own light alone, every pixel of a room seeing it. A
+ * wall whose halves only meet at a corner leaks: rays cross it diagonally, so
+ * the light beyond it must still reach the pixels across the gap.
+ */
+int test_regions(void) {
+    int errors = 0;
+    for (int test = 0; test < 2; test++) {
+        int width = 40;
+        int height = 20;
+        Image* scene = new_image(width, height);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                int wall = test == 0 ? x == 20 : (y < 10 ? x == 20 : x == 21);
+                scene->pixels[y * width + x] = wall ? (Color){ 0, 0, 0 } : WHITE;
+            }
+        }
+        Light lights[2] = {
+            { (Color){ 255, 0, 0 }, 500., (PixelLocation){ 5, 15 } },
+            { (Color){ 0, 0, 255 }, 500., (PixelLocation){ 22, 8 } },
+        };
+
+        PreparedScene* prepared = raycast_prepare(scene);
+        Image* out = raycast_prepared_sequential(prepared, lights, 2);
+        int mismatches = 0;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                Color orig = scene->pixels[y * width + x];
+                Color expected = orig;
+                if (test == 0 && !is_obstacle(orig)) {
+                    expected = mul_colors(illuminate(lights[x > 20], x, y), orig);
+                }
+                else if (test == 1 && x == 19 && y == 11) {
+                    expected = mul_colors(add_colors(illuminate(lights[0], x, y),
+                                                     illuminate(lights[1], x, y)),
+                                          orig);
+                }
+                else {
+                    continue;
+                }
+                Color result = out->pixels[y * width + x];
+                if (result.red != expected.red || result.green != expected.green ||
+                    result.blue != expected.blue) {
+                    mismatches++;
+                }
+            }
+        }
+        if (mismatches > 0) {
+            printf("Test %d failed: %d pixels lit wrongly %s\n", test, mismatches,
+                test == 0 ? "across a sealed wall" : "through a diagonal gap");
+            errors++;
+        }
+        else {
+            printf("region test %d passed\n", test);
+        }
+
+        free_image(out);
+        free_prepared_scene(prepared);
+        free_image(scene);
+    }
+    return errors;
+}
+
+/*
+ * Returns 1 if the light at `end` is visible from pixel (x, y) of `scene`, by
+ * walking the ray with `step` until it reaches or passes the light, exactly as
+ * the sequential engine does but with none of its shortcuts.
+ */
+static int reference_visible(Image* scene, int x, int y, PixelLocation end) {
+    Pair pos = { x, y };
+    Pair direction = direction_pair((PixelLocation){ x, y }, end);
+    while (1) {
+        PixelLocation next = step(&pos, direction);
+        if ((next.x == end.x && next.y == end.y) ||
+            (direction.x > 0 && next.x > end.x) || (direction.x < 0 && next.x < end.x) ||
+            (direction.y > 0 && next.y > end.y) || (direction.y < 0 && next.y < end.y)) {
+            return 1;
+        }
+        if (next.x < (unsigned int)scene->width && next.y < (unsigned int)scene->height &&
+            is_obstacle(scene->pixels[next.y * scene->width + next.x])) {
+            return 0;
+        }
+    }
+}
+
+/*
+ * Test the traversal shortcuts (clearance, same-row and same-column scans,
+ * obstacle-free rectangles, connected regions and the occupancy pyramid's
+ * empty-space checks) against plain ray walking,
+ * on generated scenes of every kind. Lights stand on open pixels, on grid
+ * points that may be obstacles, and beyond the scene's edge.
+ */
+int test_shortcuts(void) {
+    int errors = 0;
+    for (int kind = 0; kind < SCENE_KIND_COUNT; kind++) {
+        Image* scene = generate_scene(kind, 150, 100, 0.1, kind + 1);
+        Light* uniform = generate_lights(scene, LIGHTS_UNIFORM, 4, 300., kind + 1);
+        Light* grid = generate_lights(scene, LIGHTS_GRID, 4, 300., kind + 1);
+        Light lights[9];
+        for (int l = 0; l < 4; l++) {
+            lights[l] = uniform[l];
+            lights[l + 4] = grid[l];
+        }
+        lights[8] = (Light){ WHITE, 300., (PixelLocation){ 155, 20 } };
+
+        Image* expected = new_image(scene->width, scene->height);
+        for (int y = 0; y < scene->height; y++) {
+            for (int x = 0; x < scene->width; x++) {
+                Color orig = scene->pixels[y * scene->width + x];
+                Color total = (Color){ 0, 0, 0 };
+                for (int l = 0; l < 9 && !is_obstacle(orig); l++) {
+                    PixelLocation light = lights[l].pixel;
+                    if ((light.x == (unsigned int)x && light.y == (unsigned int)y) ||
+                        reference_visible(scene, x, y, light)) {
+                        total = add_colors(total, illuminate(lights[l], x, y));
+                    }
+                }
+                expected->pixels[y * scene->width + x] =
+                    is_obstacle(orig) ? orig : mul_colors(total, orig);
+            }
+        }
+
+        PreparedScene* prepared = raycast_prepare(scene);
+        Image* results[3] = {
+            raycast_prepared_sequential(prepared, lights, 9),
+            raycast_prepared_parallel_rows(prepared, lights, 9, 3),
+            raycast_prepared_progressive(prepared, lights, 9, 2, NULL, NULL),
+        };
+        for (int r = 0; r < 3; r++) {
+            int same = memcmp(results[r]->pixels, expected->pixels,
+                              sizeof(Color) * scene->width * scene->height) == 0;
+            if (!same) {
+                printf("Test %d failed: engine %d differs from ray walking on a %s scene\n",
+                    kind * 3 + r, r, scene_kind_name(kind));
+                errors++;
+            }
+            else {
+                printf("shortcut test %d passed\n", kind * 3 + r);
+            }
+            free_image(results[r]);
+        }
+
+        free_prepared_scene(prepared);
+        free_image(expected);
+        raycast_free(uniform);
+        raycast_free(grid);
+        free_image(scene);
+    }
+    return errors;
+}
+
+/*
+ * Test ending rays early across empty space. In an open field, pixels far from
+ * a light see it over rays long enough to check the space left ahead of them.
+ * An obstacle placed on each pixel along such a ray in turn (every pixel near
+ * the light, where checks look, and a sample of the rest) must hide the light
+ * exactly when plain ray walking says it does. The obstacles are placed with
+ * `raycast_update_scene`.
+ */
+int test_empty_space(void) {
+    int errors = 0;
+    Image* scene = new_image(200, 150);
+    for (int i = 0; i < scene->width * scene->height; i++) {
+        scene->pixels[i] = WHITE;
+    }
+    Light light = { WHITE, 100000., (PixelLocation){ 120, 90 } };
+    PixelLocation starts[5] = { { 0, 0 }, { 3, 40 }, { 60, 0 }, { 199, 0 }, { 0, 149 } };
+    PreparedScene* prepared = raycast_prepare(scene);
+    for (int test = 0; test < 5; test++) {
+        PixelLocation start = starts[test];
+        Pair pos = { start.x, start.y };
+        Pair direction = direction_pair(start, light.pixel);
+        PixelLocation path[512];
+        int length = 0;
+        while (length < 512) {
+            PixelLocation next = step(&pos, direction);
+            if (next.x == light.pixel.x && next.y == light.pixel.y) {
+                break;
+            }
+            path[length++] = next;
+        }
+
+        int mismatches = 0;
+        for (int p = -1; p < length; p++) {
+            if (p >= 0 && p < length - 24 && p % 7 != 0) {
+                continue;
+            }
+            Color* pixel = p < 0 ? NULL : &scene->pixels[path[p].y * scene->width + path[p].x];
+            if (pixel != NULL) {
+                *pixel = (Color){ 0, 0, 0 };
+                raycast_update_scene(prepared, path[p].x, path[p].y, 1, 1);
+            }
+            Color expected = (Color){ 0, 0, 0 };
+            if (reference_visible(scene, start.x, start.y, light.pixel)) {
+                expected = mul_colors(illuminate(light, start.x, start.y), WHITE);
+            }
+            Color result;
+            raycast_prepared_region(prepared, &light, 1, start.x, start.y, 1, 1, &result, 1, 1);
+            if (result.red != expected.red || result.green != expected.green ||
+                result.blue != expected.blue) {
+                mismatches++;
+            }
+            if (pixel != NULL) {
+                *pixel = WHITE;
+                raycast_update_scene(prepared, path[p].x, path[p].y, 1, 1);
+            }
+        }
+        if (mismatches > 0) {
+            printf("Test %d failed: %d obstacles along the ray misjudged\n", test, mismatches);
+            errors++;
+        }
+        else {
+            printf("empty space test %d passed\n", test);
+        }
+    }
+
+    free_prepared_scene(prepared);
+    free_image(scene);
+    return errors;
+}
+
+/*
+ * Test updating a prepared scene after its image is edited: adding a wall and
+ * then clearing space, each render must match a scene prepared afresh from
+ * the edited image. Rectangles outside the image must be rejected.
+ */
+int test_update_scene(void) {
+    int errors = 0;
+    Image* scene = generate_scene(SCENE_ROOMS, 90, 70, 0.1, 4);
+    Light* lights = generate_lights(scene, LIGHTS_UNIFORM, 6, 300., 4);
+    PreparedScene* prepared = raycast_prepare(scene);
+    free_image(raycast_prepared_sequential(prepared, lights, 6));
+
+    int edits[2][4] = { { 10, 30, 40, 4 }, { 20, 5, 60, 20 } };
+    for (int test = 0; test < 2; test++) {
+        int* edit = edits[test];
+        for (int y = edit[1]; y < edit[1] + edit[3]; y++) {
+            for (int x = edit[0]; x < edit[0] + edit[2]; x++) {
+                scene->pixels[y * scene->width + x] = test == 0 ? (Color){ 0, 0, 0 } : WHITE;
+            }
+        }
+        int result = raycast_update_scene(prepared, edit[0], edit[1], edit[2], edit[3]);
+        Image* updated = raycast_prepared_sequential(prepared, lights, 6);
+        PreparedScene* fresh = raycast_prepare(scene);
+        Image* expected = raycast_prepared_sequential(fresh, lights, 6);
+        int same = memcmp(updated->pixels, expected->pixels,
+                          sizeof(Color) * scene->width * scene->height) == 0;
+        if (result != 0 || !same) {
+            printf("Test %d failed: updated scene renders differently from a fresh one\n", test);
+            errors++;
+        }
+        else {
+            printf("update test %d passed\n", test);
+        }
+        free_image(updated);
+        free_image(expected);
+        free_prepared_scene(fresh);
+    }
+
+    if (raycast_update_scene(prepared, 80, 0, 20, 1) != -1 ||
+        raycast_update_scene(prepared, 0, 0, -1, 1) != -1 ||
+        raycast_update_scene(prepared, 0, -1, 1, 1) != -1) {
+        printf("Test 2 failed: rectangles outside the image accepted\n");
+        errors++;
+    }
+    else {
+        printf("update test 2 passed\n");
+    }
+
+    free_prepared_scene(prepared);
+    raycast_free(lights);
+    free_image(scene);
+    return errors;
+}
+
+/*
+ * Test allocation accounting. The light-parallel engine holds a frame per
+ * thread plus the combined frame at once, and everything it allocates apart
+ * from its result must be freed by the time it returns. The hooks themselves
+ * must behave like the functions they wrap
+ */
+int test_alloc(void) {
+    int errors = 0;
+    RaycastTest* info = test_small_4_light();
+    PreparedScene* prepared = raycast_prepare(info->image);
+    uint64_t frame = sizeof(Color) * info->image->width * info->image->height;
+    int threads = 3;
+
+    RaycastAllocStats before;
+    RaycastAllocStats after;
+    raycast_alloc_stats_reset();
+    raycast_alloc_stats(&before);
+    Image* out = raycast_prepared_parallel_lights(prepared, info->lights,
+        info->light_count, threads);
+    raycast_alloc_stats(&after);
+    uint64_t peak = after.peak_bytes - before.live_bytes;
+    uint64_t kept = after.live_bytes - before.live_bytes;
+    free_image(out);
+    RaycastAllocStats freed;
+    raycast_alloc_stats(&freed);
+    if (peak < (threads + 1) * frame || after.bytes_allocated < (threads + 2) * frame ||
+        after.allocations < (uint64_t)threads + 2 || kept < frame ||
+        kept > frame + sizeof(Image) || freed.live_bytes != before.live_bytes) {
+        printf("Test 0 failed: %llu allocations, %llu bytes, peak %llu, kept %llu\n",
+            (unsigned long long)after.allocations,
+            (unsigned long long)after.bytes_allocated, (unsigned long long)peak,
+            (unsigned long long)kept);
+        errors++;
+    }
+    else {
+        printf("raycast_alloc_stats test 0 passed\n");
+    }
+
+    raycast_alloc_stats_reset();
+    uint8_t* zeroed = raycast_calloc(100, 3);
+    int all_zero = 1;
+    for (int i = 0; i < 300; i++) {
+        all_zero &= zeroed[i] == 0;
+        zeroed[i] = i % 251;
+    }
+    uint8_t* grown = raycast_realloc(zeroed, 5000);
+    int kept_contents = 1;
+    for (int i = 0; i < 300; i++) {
+        kept_contents &= grown[i] == i % 251;
+    }
+    raycast_alloc_stats(&after);
+    raycast_free(grown);
+    raycast_free(NULL);
+    raycast_alloc_stats(&freed);
+    if (!all_zero || !kept_contents || after.allocations != 2 ||
+        after.bytes_allocated != 5300 || after.live_bytes != freed.live_bytes + 5000 ||
+        freed.peak_bytes < freed.live_bytes + 5000) {
+        printf("Test 1 failed: hooks lost contents or miscounted\n");
+        errors++;
+    }
+    else {
+        printf("raycast_alloc_stats test 1 passed\n");
+    }
+
+    // Freeing a prepared scene releases everything preparing it allocated,
+    // whatever its shape
+    int sizes[4][2] = { { 1, 1 }, { 1, 5 }, { 7, 1 }, { 33, 17 } };
+    int leaked = 0;
+    for (int i = 0; i < 4; i++) {
+        Image* scene = new_image(sizes[i][0], sizes[i][1]);
+        raycast_alloc_stats(&before);
+        free_prepared_scene(raycast_prepare(scene));
+        raycast_alloc_stats(&freed);
+        leaked += freed.live_bytes != before.live_bytes;
+        free_image(scene);
+    }
+    if (leaked > 0) {
+        printf("Test 2 failed: %d prepared scenes leaked\n", leaked);
+        errors++;
+    }
+    else {
+        printf("raycast_alloc_stats test 2 passed\n");
+    }
+
+    free_prepared_scene(prepared);
+    free_test(info);
+    return errors;
+}
+
+/*
+ * Test the procedural generators. The same seed must reproduce a scene
+ * exactly, densities must be close to what was asked for, and lights must be
+ * in bounds, on open pixels where the layout promises it, and survive a CSV
+ * round trip
+ */
+int test_generate(void) {
+    int errors = 0;
+    int width = 200;
+    int height = 120;
+    for (int kind = 0; kind < SCENE_KIND_COUNT; kind++) {
+        Image* first = generate_scene(kind, width, height, 0.25, 11);
+        Image* again = generate_scene(kind, width, height, 0.25, 11);
+        Image* other = generate_scene(kind, width, height, 0.25, 12);
+        size_t bytes = sizeof(Color) * width * height;
+        unsigned long obstacle_count = 0;
+        for (int i = 0; i < width * height; i++) {
+            obstacle_count += is_obstacle(first->pixels[i]);
+        }
+        double density = (double)obstacle_count / (width * height);
+        int density_ok = kind == SCENE_BLOBS || kind == SCENE_OPEN
+                             ? density > 0.22 && density < 0.28
+                             : density > 0.01 && density < 0.9;
+        if (memcmp(first->pixels, again->pixels, bytes) != 0 ||
+            memcmp(first->pixels, other->pixels, bytes) == 0 || !density_ok) {
+            printf("Test %d failed: %s scene not reproducible or density %.3f\n",
+                kind, scene_kind_name(kind), density);
+            errors++;
+        }
+        else {
+            printf("generate_scene test %d passed\n", kind);
+        }
+        free_image(first);
+        free_image(again);
+        free_image(other);
+    }
+
+    Image* scene = generate_scene(SCENE_ROOMS, width, height, 0.2, 5);
+    int count = 50;
+    for (int layout = 0; layout < LIGHT_LAYOUT_COUNT; layout++) {
+        int test = SCENE_KIND_COUNT + layout;
+        Light* lights = generate_lights(scene, layout, count, 300, 5);
+        int misplaced = 0;
+        for (int i = 0; i < count; i++) {
+            PixelLocation pixel = lights[i].pixel;
+            misplaced += pixel.x >= (unsigned int)width || pixel.y >= (unsigned int)height ||
+                (layout != LIGHTS_GRID && is_obstacle(*image_pixel(scene, pixel.x, pixel.y)));
+        }
+
+        int round_trip_errors = 1;
+        if (write_light_csv("images/generated_lights.csv", lights, count) == 0) {
+            LightSet* set = read_light_csv("images/generated_lights.csv");
+            if (set != NULL) {
+                round_trip_errors = set->count != count ||
+                    light_mismatches(set->lights, lights, count) > 0;
+                free_light_set(set);
+            }
+        }
+        remove("images/generated_lights.csv");
+
+        if (misplaced > 0 || round_trip_errors) {
+            printf("Test %d failed: %s layout put %d lights out of place\n", test,
+                light_layout_name(layout), misplaced);
+            errors++;
+        }
+        else {
+            printf("generate_lights test %d passed\n", test);
+        }
+        raycast_free(lights);
+    }
+
+    // With one open pixel every placed light lands on it; with none, only grid
+    // lights can be placed
+    for (int i = 0; i < width * height; i++) {
+        scene->pixels[i] = (Color){ 0, 0, 0 };
+    }
+    *image_pixel(scene, width - 1, 0) = (Color){ 255, 255, 255 };
+    Light* lone = generate_lights(scene, LIGHTS_UNIFORM, 8, 300, 6);
+    int lone_misplaced = lone == NULL;
+    for (int i = 0; lone != NULL && i < 8; i++) {
+        lone_misplaced += lone[i].pixel.x != (unsigned int)width - 1 || lone[i].pixel.y != 0;
+    }
+    *image_pixel(scene, width - 1, 0) = (Color){ 0, 0, 0 };
+    Light* none = generate_lights(scene, LIGHTS_CLUSTERED, 8, 300, 6);
+    Light* grid = generate_lights(scene, LIGHTS_GRID, 8, 300, 6);
+    if (lone_misplaced > 0 || none != NULL || grid == NULL) {
+        printf("Test %d failed: lights placed wrongly on a walled-in scene\n",
+            SCENE_KIND_COUNT + LIGHT_LAYOUT_COUNT);
+        errors++;
+    }
+    else {
+        printf("generate_lights test %d passed\n", SCENE_KIND_COUNT + LIGHT_LAYOUT_COUNT);
+    }
+    raycast_free(lone);
+    raycast_free(grid);
+    free_image(scene);
+    return errors;
+}
+
+/*
+ * Count the spans called `name` in a written trace. Returns -1 if the file
+ * cannot be read.
+ */
+int count_trace_spans(const char* path, const char* name) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "{\"name\": \"%s\", \"cat\"", name);
+    char line[512];
+    int count = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        count += strstr(line, pattern) != NULL;
+    }
+    fclose(file);
+    return count;
+}
+
+/*
+ * Test timeline tracing. Nothing is recorded until tracing starts; after that
+ * each engine records its phases and one span per worker
+ */
+int test_trace(void) {
+    int errors = 0;
+    const char* path = "images/trace_test.json";
+    RaycastTest* info = test_small_4_light();
+    PreparedScene* prepared = raycast_prepare(info->image);
+
+    // Rendered before tracing starts, so absent from the trace
+    Image* out = raycast_prepared_parallel_rows(prepared, info->lights, info->light_count, 2);
+    free_image(out);
+
+    trace_start();
+    out = raycast_prepared_parallel_rows(prepared, info->lights, info->light_count, 3);
+    free_image(out);
+    out = raycast_prepared_parallel_lights(prepared, info->lights, info->light_count, 2);
+    free_image(out);
+    trace_stop();
+    // Rendered after tracing stops, so also absent
+    out = raycast_prepared_sequential(prepared, info->lights, info->light_count);
+    free_image(out);
+
+    if (trace_write(path) != 0 || count_trace_spans(path, "trace") != 5 ||
+        count_trace_spans(path, "allocate") != 2 ||
+        count_trace_spans(path, "combine") != 1 ||
+        count_trace_spans(path, "multiply") != 1) {
+        printf("Test 0 failed: trace has %d worker spans\n",
+            count_trace_spans(path, "trace"));
+        errors++;
+    }
+    else {
+        printf("trace test 0 passed\n");
+    }
+    remove(path);
+
+    free_prepared_scene(prepared);
+    free_test(info);
+    return errors;
+}
+
+// Run all test suites.
 int main(void) {
     int errors;
 
@@ -415,4 +1794,183 @@ int main(void) {
     else {
         printf("failed %d tests\n", errors);
     }
+
+    // Test rendering against prepared scenes.
+    printf("\ntesting raycast_prepared:\n");
+    errors = test_raycast_prepared();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    // Test rendering mapped scene files.
+    printf("\ntesting scene files:\n");
+    errors = test_scene_file();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    // Test tiled out-of-core rendering.
+    printf("\ntesting raycast_out_of_core:\n");
+    errors = test_out_of_core();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    // Test rendering regions of a scene.
+    printf("\ntesting raycast_region:\n");
+    errors = test_region();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    // Test progressive rendering.
+    printf("\ntesting raycast_prepared_progressive:\n");
+    errors = test_progressive();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    // Test the traversal counters.
+    printf("\ntesting raycast_stats:\n");
+    errors = test_stats();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    printf("\ntesting raycast_prepared_cost:\n");
+    errors = test_cost();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    // Test rays along rows and columns.
+    printf("\ntesting axis rays:\n");
+    errors = test_axis_rays();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    // Test culling between regions of open space.
+    printf("\ntesting regions:\n");
+    errors = test_regions();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    // Test the traversal shortcuts against plain ray walking.
+    printf("\ntesting traversal shortcuts:\n");
+    errors = test_shortcuts();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    // Test ending rays early across empty space.
+    printf("\ntesting empty space:\n");
+    errors = test_empty_space();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    // Test updating a prepared scene after edits.
+    printf("\ntesting raycast_update_scene:\n");
+    errors = test_update_scene();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    // Test allocation accounting.
+    printf("\ntesting raycast_alloc_stats:\n");
+    errors = test_alloc();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    // Test timeline tracing.
+    printf("\ntesting trace:\n");
+    errors = test_trace();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    // Test the parallel PNG writer.
+    printf("\ntesting write_image_parallel:\n");
+    errors = test_write_image_parallel();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    // Test loading light files.
+    printf("\ntesting light files:\n");
+    errors = test_light_file();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    // Test the scene and light generators.
+    printf("\ntesting generators:\n");
+    errors = test_generate();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
+
+    // Test the render daemon.
+    printf("\ntesting raycastd:\n");
+    errors = test_raycastd();
+    if (errors == 0) {
+        printf("all tests passed\n");
+    }
+    else {
+        printf("failed %d tests\n", errors);
+    }
 }
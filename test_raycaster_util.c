@@ -1,9 +1,11 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "image.h"
 #include "raycaster_util.h"
+#include "step_kernels.h"
 
 // Utility functions
 
@@ -314,6 +316,108 @@ int test_step(void) {
     return errors;
 }
 
+/*
+ * Walk `steps` steps from `pos` in `direction` with both `step` and `kernel`.
+ * Returns 1 (after printing what differed) unless both return the same pixels
+ * and leave `pos` with the same bits after every step.
+ */
+int step_kernel_check(int test, StepKernel kernel, Pair pos, Pair direction,
+                      int steps) {
+    StepFunction function = step_kernel_function(kernel);
+    Pair expected_pos = pos;
+    for (int i = 0; i < steps; i++) {
+        PixelLocation expected = step(&expected_pos, direction);
+        PixelLocation result = function(&pos, direction);
+        if (expected.x != result.x || expected.y != result.y ||
+            memcmp(&expected_pos, &pos, sizeof(Pair)) != 0) {
+            printf("Test %d for step kernel %d: step %d in direction (%.17g, %.17g) "
+                   "went to (%u, %u) at (%.17g, %.17g), expected (%u, %u) at "
+                   "(%.17g, %.17g)\n",
+                   test, kernel, i, direction.x, direction.y, result.x, result.y,
+                   pos.x, pos.y, expected.x, expected.y, expected_pos.x,
+                   expected_pos.y);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Tests the step kernels against step: every ray from a pixel corner to the
+ * pixels around it, rays from pixel centers, and arbitrary positions and
+ * directions, including ones with components just either side of EPS
+ */
+int test_step_kernels(void) {
+    int errors = 0;
+
+    // Every kind of kernel must be picked, and match step, along rays walked
+    // from a corner the way the engines walk them
+    int picked[STEP_KERNEL_COUNT] = { 0 };
+    int failures = 0;
+    PixelLocation start = { 40, 40 };
+    for (unsigned int y = 0; y <= 80; y++) {
+        for (unsigned int x = 0; x <= 80; x++) {
+            PixelLocation end = { x, y };
+            Pair direction = direction_pair(start, end);
+            StepKernel kernel = ray_step_kernel(start, end, direction);
+            picked[kernel]++;
+            failures += step_kernel_check(0, kernel, (Pair){ start.x, start.y },
+                                          direction, 48);
+        }
+    }
+    for (int kernel = STEP_EAST; kernel < STEP_KERNEL_COUNT; kernel++) {
+        if (picked[kernel] == 0) {
+            printf("Test 0 for step kernels: kernel %d never picked\n", kernel);
+            failures++;
+        }
+    }
+    errors += failures > 0;
+
+    // From pixel centers and arbitrary positions, by direction alone
+    failures = 0;
+    uint64_t state = 12345;
+    for (int i = 0; i < 20000; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        double angle = (state >> 11) / 9007199254740992.0 * 2 * 3.14159265358979323846;
+        Pair direction = { cos(angle), sin(angle) };
+        // Every so often, a component on one side of EPS or the other
+        if (i % 4 == 1) {
+            direction.x = (i % 8 == 1 ? 0.5 : 2) * EPS * (direction.x < 0 ? -1 : 1);
+        }
+        if (i % 4 == 2) {
+            direction.y = (i % 8 == 2 ? 0.5 : 2) * EPS * (direction.y < 0 ? -1 : 1);
+        }
+        Pair pos = { 100 + (state >> 40) % 5000 / 100.0,
+                     100 + (state >> 20) % 5000 / 100.0 };
+        if (i % 3 == 0) {
+            pos = center_point(pos.x, pos.y);
+        }
+        failures += step_kernel_check(1, step_kernel(direction), pos, direction, 32);
+    }
+    errors += failures > 0;
+
+    // Rays along rows and columns, and exact diagonals, get their own kernels
+    PixelLocation origin = { 5, 5 };
+    PixelLocation ends[] = { { 9, 5 }, { 0, 5 }, { 5, 9 }, { 5, 0 },
+                             { 8, 8 }, { 2, 8 }, { 8, 2 }, { 2, 2 }, { 9, 6 } };
+    StepKernel expected[] = { STEP_EAST, STEP_WEST, STEP_SOUTH, STEP_NORTH,
+                              STEP_DIAGONAL_SOUTH_EAST, STEP_DIAGONAL_SOUTH_WEST,
+                              STEP_DIAGONAL_NORTH_EAST, STEP_DIAGONAL_NORTH_WEST,
+                              STEP_SOUTH_EAST };
+    for (int i = 0; i < 9; i++) {
+        StepKernel kernel =
+            ray_step_kernel(origin, ends[i], direction_pair(origin, ends[i]));
+        if (kernel != expected[i]) {
+            printf("Test 2 for step kernels: ray to (%u, %u) got kernel %d, "
+                   "expected %d\n", ends[i].x, ends[i].y, kernel, expected[i]);
+            errors++;
+            break;
+        }
+    }
+
+    return errors;
+}
+
 /*
  * Helper function to make error counting easier for direction
  */
@@ -374,6 +478,76 @@ int test_illuminate(void) {
     return errors;
 }
 
+/*
+ * Helper function to make error counting easier for light_radius
+ * Checks that the light contributes nothing just outside its radius, along an
+ * axis and along a diagonal
+ */
+int light_radius_check(int test, Light light) {
+    unsigned int radius = light_radius(light);
+    int x = light.pixel.x;
+    int y = light.pixel.y;
+    // the first diagonal offset whose squared distance exceeds radius^2
+    int diagonal = (int)(radius / sqrt(2.0)) + 1;
+    Color outside[] = {
+        illuminate(light, x + radius + 1, y),
+        illuminate(light, x, y + radius + 1),
+        illuminate(light, x + diagonal, y + diagonal),
+    };
+    for (int i = 0; i < 3; i++) {
+        if (outside[i].red || outside[i].green || outside[i].blue) {
+            printf("Test %d for light_radius: light visible beyond radius %u\n",
+                   test, radius);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Tests light_radius
+ */
+int test_light_radius(void) {
+    int errors = 0;
+
+    errors += light_radius_check(
+        0, (Light){(Color){255, 255, 255}, 100., (PixelLocation){100, 100}});
+    errors += light_radius_check(
+        1, (Light){(Color){1, 0, 0}, 5000., (PixelLocation){0, 0}});
+    errors += light_radius_check(
+        2, (Light){(Color){0, 2, 0}, 0.5, (PixelLocation){10, 20}});
+    errors += light_radius_check(
+        3, (Light){(Color){100, 100, 255}, 100000., (PixelLocation){500, 5}});
+
+    // A black light never contributes anything
+    if (light_radius((Light){(Color){0, 0, 0}, 100., (PixelLocation){0, 0}}) != 0) {
+        printf("Test 4 for light_radius: expected 0 for a black light\n");
+        errors++;
+    }
+
+    return errors;
+}
+
+/*
+ * Tests axis_gap
+ */
+int test_axis_gap(void) {
+    int errors = 0;
+    unsigned int values[5] = { 3, 10, 15, 19, 25 };
+    double expected[5] = { 7, 0, 0, 0, 6 };
+
+    // Before, at the start of, inside, at the end of and past [10, 20)
+    for (int test = 0; test < 5; test++) {
+        double gap = axis_gap(values[test], 10, 20);
+        if (gap != expected[test]) {
+            printf("Test %d for axis_gap: expected %g, got %g\n", test,
+                   expected[test], gap);
+            errors++;
+        }
+    }
+    return errors;
+}
+
 int main(void) {
     int errors;
     errors = test_is_obstacle();
@@ -401,9 +575,24 @@ int main(void) {
     printf("test_step %s with %d failing tests\n",
            errors == 0 ? "passed" : "failed", errors);
     printf("\n");
+    errors = test_step_kernels();
+    printf("\n");
+    printf("test_step_kernels %s with %d failing tests\n",
+           errors == 0 ? "passed" : "failed", errors);
+    printf("\n");
     errors = test_illuminate();
     printf("\n");
     printf("test_illuminate %s with %d failing tests\n",
            errors == 0 ? "passed" : "failed", errors);
     printf("\n");
+    errors = test_light_radius();
+    printf("\n");
+    printf("test_light_radius %s with %d failing tests\n",
+           errors == 0 ? "passed" : "failed", errors);
+    printf("\n");
+    errors = test_axis_gap();
+    printf("\n");
+    printf("test_axis_gap %s with %d failing tests\n",
+           errors == 0 ? "passed" : "failed", errors);
+    printf("\n");
 }
@@ -1,46 +1,143 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
 #include <stdio.h>
-#include <sys/time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "alloc.h"
 #include "image.h"
 #include "raycaster.h"
+#include "scene_file.h"
+#include "trace.h"
 
-// Constants for timing
-// How many times to iterate while timing
-#define ITERATIONS 8
-// How many lights to be raycast against, placed regularly around the image
-#define LIGHT_COUNT 4
-// How many threads to use
-#define THREAD_COUNT 8
-// Name of the image to read from
-#define FILENAME (const char*)"images/small.png"
-
-// The function to measure. Uncomment the call you want to benchmark.
-void timed_function(Image* image, Light* lights) {
-    // raycast_sequential(image, lights, LIGHT_COUNT);
-    raycast_parallel_lights(image, lights, LIGHT_COUNT, THREAD_COUNT);
-    // raycast_parallel_rows(image, lights, LIGHT_COUNT, THREAD_COUNT);
-}
+/*
+ * Benchmark sweep.
+ *
+ * Usage: timing [options]
+ *
+ *   --engines LIST     engines to time (default sequential,lights,rows)
+ *   --scenes LIST      scenes to render, PNGs or scene files
+ *                      (default images/small.png)
+ *   --lights LIST      light counts (default 4)
+ *   --threads LIST     thread counts (default 1); the sequential engine only
+ *                      runs single-threaded
+ *   --iterations N     timed renders per case (default 8)
+ *   --warmup N         untimed renders before them (default 1)
+ *   --cold             time the Image-based entry points, which prepare the
+ *                      scene on every call, instead of prepared renders
+ *   --format FORMAT    text, csv or json (default text)
+ *   --output PATH      write the results there instead of stdout
+ *   --trace PATH       also record a timeline of every render's phases and
+ *                      workers, written to PATH as Chrome trace JSON
+ *   --scaling MODE     report how the parallel engines scale instead; MODE is
+ *                      strong or weak (see below)
+ *
+ * Lists are comma-separated. Every combination of engine, scene, light count
+ * and thread count is one case; each is timed with a monotonic clock and
+ * reported as its minimum, median and 95th percentile render time, the median
+ * absolute deviation of its times from their median, and as throughput in
+ * pixel-lights (pixels times lights) per second at the median.
+ *
+ * Every case also reports the memory one render takes: how many allocations
+ * it makes, how many bytes they add up to, and its peak, the most bytes it had
+ * live at once beyond what was live before it started (the prepared scene and
+ * lights). Peak RSS is the process's high-water mark so far, as reported by
+ * the OS, so it only grows from case to case.
+ *
+ * Built with -DRAYCAST_STATS (`make timing_stats`), it also reports the
+ * engines' traversal counters, averaged per timed render.
+ *
+ * With --scaling, every parallel engine is timed at each thread count (by
+ * default 1, 2, 4, ... up to the number of CPUs) and compared with itself on
+ * one thread. Strong scaling keeps the problem fixed; weak scaling gives each
+ * thread a fixed share by multiplying the light count by the thread count.
+ * Each row reports the speedup S (scaled speedup, p * T1 / Tp, for weak
+ * scaling), the efficiency S / p, and the Karp-Flatt serial fraction
+ * (1/S - 1/p) / (1 - 1/p), which stays flat when a fixed serial part limits
+ * scaling and grows when overhead grows with the thread count.
+ */
 
 // Constants for lights, strength and color shouldn't matter for timing
 #define WHITE (Color){255, 255, 255}
 #define STRENGTH 42.0
 
-const unsigned int SECONDS_TO_MICRO = 1000000;
+#define MIB (1024.0 * 1024.0)
+
+static char default_scene[] = "images/small.png";
+static char* default_scenes[] = { default_scene };
+static int default_light_counts[] = { 4 };
+static int default_thread_counts[] = { 1 };
+
+typedef enum {
+    FORMAT_TEXT,
+    FORMAT_CSV,
+    FORMAT_JSON,
+} OutputFormat;
+
+typedef enum {
+    SCALING_NONE,
+    SCALING_STRONG,
+    SCALING_WEAK,
+} ScalingMode;
+
+typedef struct {
+    int engines[ENGINE_COUNT];
+    int engine_count;
+    char** scenes;
+    int scene_count;
+    int* light_counts;
+    int light_count_count;
+    int* thread_counts;
+    int thread_count_count;
+    int iterations;
+    int warmup;
+    int cold;
+    OutputFormat format;
+    const char* output;
+    const char* trace;
+    ScalingMode scaling;
+} BenchOptions;
+
+typedef struct {
+    RaycastEngine engine;
+    const char* scene;
+    int width;
+    int height;
+    int light_count;
+    int threads;
+    int iterations;
+    double min_ms;
+    double median_ms;
+    double p95_ms;
+    double mad_ms; // median absolute deviation from `median_ms`
+    double mean_ms;
+    double pixel_lights_per_second;
+    // Counters per timed render; all zero unless the engines count
+    RaycastStats stats;
+    // Allocations of the last timed render; `peak_bytes` is its peak above
+    // what was live before it
+    RaycastAllocStats memory;
+    uint64_t peak_rss_bytes;
+} BenchResult;
 
 /*
- * Helper function to build an array of `X` lights
+ * Helper function to build an array of `light_count` lights for a scene of
+ * the given size: two columns of lights, plus one more at the bottom middle
+ * for odd counts.
  */
-Light* build_lights(unsigned int light_count, const char* filename) {
-    // Technically inefficient, but it makes our life easier
-    Image* image = read_image(filename);
-
-    Light* lights = malloc(sizeof(Light) * light_count);
+Light* build_lights(unsigned int light_count, unsigned int width,
+                    unsigned int height) {
+    Light* lights = malloc(sizeof(Light) * (light_count + 1));
 
     PixelLocation position;
 
     // special case of 1
     if (light_count == 1) {
-        position = (PixelLocation){ image->width / 2, image->height / 2 };
+        position = (PixelLocation){ width / 2, height / 2 };
         lights[0] = (Light){ WHITE, STRENGTH, position };
         return lights;
     }
@@ -48,73 +145,647 @@ Light* build_lights(unsigned int light_count, const char* filename) {
     // Grid out the image with two columns of lights
     unsigned int row_count = light_count / 2;
     // we want to round up on odd numbers
-    unsigned int row_size = image->height / ((light_count + 1) / 2);
+    unsigned int row_size = height / ((light_count + 1) / 2);
 
     for (unsigned int i = 0; i < row_count; i++) {
         unsigned int index = i * 2;
         // add the row_size / 2 so we go in the "middle" of the grid
         unsigned int row = i * row_size + row_size / 2;
 
-        position = (PixelLocation){ image->width / 4, row };
+        position = (PixelLocation){ width / 4, row };
         lights[index] = (Light){ WHITE, STRENGTH, position };
 
-        position = (PixelLocation){ 3 * image->width / 4, row };
+        position = (PixelLocation){ 3 * width / 4, row };
         lights[index + 1] = (Light){ WHITE, STRENGTH, position };
     }
 
     // Add an extra light in the middle-bottom on odd light count
     if (light_count % 2 == 1) {
         unsigned int row = row_count * row_size + row_size / 2;
-        position = (PixelLocation){ image->width / 2, row };
+        position = (PixelLocation){ width / 2, row };
         lights[light_count - 1] = (Light){ WHITE, STRENGTH, position };
     }
 
     return lights;
 }
 
-int main(void) {
-    // Setup the lights
-    Light* lights = build_lights(LIGHT_COUNT, FILENAME);
+// Returns 1 if the engines were built with traversal counters.
+static int stats_enabled(void) {
+    RaycastStats stats;
+    return raycast_stats(&stats) == 0;
+}
+
+static double now_ms(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e3 + time.tv_nsec / 1e6;
+}
+
+// The process's peak resident set size so far, in bytes.
+static uint64_t peak_rss_bytes(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+/*
+ * Render once with the given engine, returning the time taken in ms. The
+ * render's allocations are stored in `memory`.
+ */
+static double time_render(const BenchOptions* options, PreparedScene* prepared,
+                          RaycastEngine engine, Light* lights, int light_count,
+                          int threads, RaycastAllocStats* memory) {
+    Image* scene = prepared_scene_image(prepared);
+    RaycastAllocStats before;
+    raycast_alloc_stats_reset();
+    raycast_alloc_stats(&before);
+    double start = now_ms();
+    Image* result;
+    if (!options->cold) {
+        result = raycast_prepared(prepared, engine, lights, light_count, threads);
+    }
+    else if (engine == ENGINE_PARALLEL_LIGHTS) {
+        result = raycast_parallel_lights(scene, lights, light_count, threads);
+    }
+    else if (engine == ENGINE_PARALLEL_ROWS) {
+        result = raycast_parallel_rows(scene, lights, light_count, threads);
+    }
+    else {
+        result = raycast_sequential(scene, lights, light_count);
+    }
+    double elapsed = now_ms() - start;
+    raycast_alloc_stats(memory);
+    memory->peak_bytes -= before.live_bytes;
+    free_image(result);
+    return elapsed;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Time one case and summarize it.
+static BenchResult run_case(const BenchOptions* options, const char* scene_path,
+                            PreparedScene* prepared, RaycastEngine engine,
+                            int light_count, int threads) {
+    Image* scene = prepared_scene_image(prepared);
+    Light* lights = build_lights(light_count, scene->width, scene->height);
+
+    RaycastAllocStats memory = { 0 };
+    for (int i = 0; i < options->warmup; i++) {
+        time_render(options, prepared, engine, lights, light_count, threads,
+                    &memory);
+    }
+    double* times = malloc(sizeof(double) * options->iterations);
+    double total = 0;
+    raycast_stats_reset();
+    for (int i = 0; i < options->iterations; i++) {
+        times[i] = time_render(options, prepared, engine, lights, light_count,
+                               threads, &memory);
+        total += times[i];
+    }
+    qsort(times, options->iterations, sizeof(double), compare_doubles);
+
+    // Percentiles use the nearest-rank method
+    int n = options->iterations;
+    BenchResult result = {
+        .engine = engine,
+        .scene = scene_path,
+        .width = scene->width,
+        .height = scene->height,
+        .light_count = light_count,
+        .threads = threads,
+        .iterations = n,
+        .min_ms = times[0],
+        .median_ms = times[(n - 1) / 2],
+        .p95_ms = times[(95 * n + 99) / 100 - 1],
+        .mean_ms = total / n,
+        .memory = memory,
+        .peak_rss_bytes = peak_rss_bytes(),
+    };
+    result.pixel_lights_per_second = (double)scene->width * scene->height *
+                                     light_count / (result.median_ms / 1e3);
+    for (int i = 0; i < n; i++) {
+        times[i] = fabs(times[i] - result.median_ms);
+    }
+    qsort(times, n, sizeof(double), compare_doubles);
+    result.mad_ms = times[(n - 1) / 2];
+    RaycastStats totals;
+    raycast_stats(&totals);
+    result.stats = (RaycastStats){
+        .obstacle_pixels = totals.obstacle_pixels / n,
+        .self_light_hits = totals.self_light_hits / n,
+        .clearance_hits = totals.clearance_hits / n,
+        .cell_hits = totals.cell_hits / n,
+        .region_culls = totals.region_culls / n,
+        .rays_traced = totals.rays_traced / n,
+        .steps = totals.steps / n,
+        .rays_blocked = totals.rays_blocked / n,
+        .rays_reached = totals.rays_reached / n,
+        .space_skips = totals.space_skips / n,
+    };
+
+    free(times);
+    free(lights);
+    return result;
+}
+
+static void print_header(FILE* out, OutputFormat format) {
+    int stats = stats_enabled();
+    if (format == FORMAT_TEXT) {
+        fprintf(out, "%-10s %-28s %9s %6s %7s %10s %10s %10s %14s %7s %10s %10s %8s",
+                "engine", "scene", "size", "lights", "threads", "min ms",
+                "median ms", "p95 ms", "pixel-lights/s", "allocs", "alloc MiB",
+                "peak MiB", "RSS MiB");
+        if (stats) {
+            fprintf(out, " %12s %9s %9s", "rays/render", "steps/ray", "blocked %");
+        }
+        fprintf(out, "\n");
+    }
+    else if (format == FORMAT_CSV) {
+        fprintf(out, "engine,scene,width,height,lights,threads,iterations,"
+                     "min_ms,median_ms,p95_ms,mean_ms,pixel_lights_per_s,"
+                     "allocations,bytes_allocated,peak_bytes,peak_rss_bytes,"
+                     "mad_ms");
+        if (stats) {
+            fprintf(out, ",obstacle_pixels,self_light_hits,clearance_hits,"
+                         "cell_hits,region_culls,rays_traced,steps,"
+                         "rays_blocked,rays_reached,space_skips");
+        }
+        fprintf(out, "\n");
+    }
+    else {
+        fprintf(out, "{\"benchmarks\": [");
+    }
+}
+
+// Print a string as a JSON string literal.
+static void print_json_string(FILE* out, const char* text) {
+    fputc('"', out);
+    for (; *text != '\0'; text++) {
+        if (*text == '"' || *text == '\\') {
+            fputc('\\', out);
+        }
+        if ((unsigned char)*text < 0x20) {
+            fprintf(out, "\\u%04x", *text);
+        }
+        else {
+            fputc(*text, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void print_result(FILE* out, OutputFormat format,
+                         const BenchResult* result, int first) {
+    const char* engine = raycast_engine_name(result->engine);
+    const RaycastStats* stats = stats_enabled() ? &result->stats : NULL;
+    if (format == FORMAT_TEXT) {
+        char size[32];
+        snprintf(size, sizeof(size), "%dx%d", result->width, result->height);
+        fprintf(out,
+                "%-10s %-28s %9s %6d %7d %10.3f %10.3f %10.3f %14.4g %7llu "
+                "%10.2f %10.2f %8.1f",
+                engine, result->scene, size, result->light_count,
+                result->threads, result->min_ms, result->median_ms,
+                result->p95_ms, result->pixel_lights_per_second,
+                (unsigned long long)result->memory.allocations,
+                result->memory.bytes_allocated / MIB,
+                result->memory.peak_bytes / MIB, result->peak_rss_bytes / MIB);
+        if (stats != NULL) {
+            uint64_t rays = stats->rays_traced ? stats->rays_traced : 1;
+            fprintf(out, " %12llu %9.2f %9.2f",
+                    (unsigned long long)stats->rays_traced,
+                    (double)stats->steps / rays,
+                    100.0 * stats->rays_blocked / rays);
+        }
+        fprintf(out, "\n");
+    }
+    else if (format == FORMAT_CSV) {
+        fprintf(out,
+                "%s,%s,%d,%d,%d,%d,%d,%.6f,%.6f,%.6f,%.6f,%.6g,%llu,%llu,%llu,"
+                "%llu,%.6f",
+                engine, result->scene, result->width, result->height,
+                result->light_count, result->threads, result->iterations,
+                result->min_ms, result->median_ms, result->p95_ms,
+                result->mean_ms, result->pixel_lights_per_second,
+                (unsigned long long)result->memory.allocations,
+                (unsigned long long)result->memory.bytes_allocated,
+                (unsigned long long)result->memory.peak_bytes,
+                (unsigned long long)result->peak_rss_bytes, result->mad_ms);
+        if (stats != NULL) {
+            fprintf(out, ",%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu",
+                    (unsigned long long)stats->obstacle_pixels,
+                    (unsigned long long)stats->self_light_hits,
+                    (unsigned long long)stats->clearance_hits,
+                    (unsigned long long)stats->cell_hits,
+                    (unsigned long long)stats->region_culls,
+                    (unsigned long long)stats->rays_traced,
+                    (unsigned long long)stats->steps,
+                    (unsigned long long)stats->rays_blocked,
+                    (unsigned long long)stats->rays_reached,
+                    (unsigned long long)stats->space_skips);
+        }
+        fprintf(out, "\n");
+    }
+    else {
+        fprintf(out, "%s\n  {\"engine\": \"%s\", \"scene\": ", first ? "" : ",",
+                engine);
+        print_json_string(out, result->scene);
+        fprintf(out,
+                ", \"width\": %d, \"height\": %d, \"lights\": %d, "
+                "\"threads\": %d, \"iterations\": %d, \"min_ms\": %.6f, "
+                "\"median_ms\": %.6f, \"p95_ms\": %.6f, \"mad_ms\": %.6f, "
+                "\"mean_ms\": %.6f, "
+                "\"pixel_lights_per_s\": %.6g, \"allocations\": %llu, "
+                "\"bytes_allocated\": %llu, \"peak_bytes\": %llu, "
+                "\"peak_rss_bytes\": %llu",
+                result->width, result->height, result->light_count,
+                result->threads, result->iterations, result->min_ms,
+                result->median_ms, result->p95_ms, result->mad_ms,
+                result->mean_ms, result->pixel_lights_per_second,
+                (unsigned long long)result->memory.allocations,
+                (unsigned long long)result->memory.bytes_allocated,
+                (unsigned long long)result->memory.peak_bytes,
+                (unsigned long long)result->peak_rss_bytes);
+        if (stats != NULL) {
+            fprintf(out,
+                    ", \"stats\": {\"obstacle_pixels\": %llu, "
+                    "\"self_light_hits\": %llu, \"clearance_hits\": %llu, "
+                    "\"cell_hits\": %llu, \"region_culls\": %llu, "
+                    "\"rays_traced\": %llu, \"steps\": %llu, "
+                    "\"rays_blocked\": %llu, \"rays_reached\": %llu, "
+                    "\"space_skips\": %llu}",
+                    (unsigned long long)stats->obstacle_pixels,
+                    (unsigned long long)stats->self_light_hits,
+                    (unsigned long long)stats->clearance_hits,
+                    (unsigned long long)stats->cell_hits,
+                    (unsigned long long)stats->region_culls,
+                    (unsigned long long)stats->rays_traced,
+                    (unsigned long long)stats->steps,
+                    (unsigned long long)stats->rays_blocked,
+                    (unsigned long long)stats->rays_reached,
+                    (unsigned long long)stats->space_skips);
+        }
+        fprintf(out, "}");
+    }
+}
+
+static void print_footer(FILE* out, OutputFormat format) {
+    if (format == FORMAT_JSON) {
+        fprintf(out, "\n]}\n");
+    }
+}
+
+/*
+ * Thread counts for a scaling report when none are given: powers of two up to
+ * the number of CPUs, and the CPU count itself.
+ */
+static int default_scaling_threads(int** values) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpus = cpus > 1 ? cpus : 1;
+    int count = 0;
+    *values = malloc(sizeof(int) * 34);
+    for (long threads = 1; threads < cpus; threads *= 2) {
+        (*values)[count++] = threads;
+    }
+    (*values)[count++] = cpus;
+    return count;
+}
 
-    // Setup the structs we need for timing
-    struct timeval start;
-    struct timeval end;
+static void print_scaling_header(FILE* out, OutputFormat format) {
+    if (format == FORMAT_TEXT) {
+        fprintf(out, "%-6s %-10s %-28s %6s %7s %10s %9s %10s %10s\n", "mode",
+                "engine", "scene", "lights", "threads", "median ms", "speedup",
+                "efficiency", "serial");
+    }
+    else if (format == FORMAT_CSV) {
+        fprintf(out, "mode,engine,scene,width,height,lights,threads,iterations,"
+                     "median_ms,speedup,efficiency,serial_fraction\n");
+    }
+    else {
+        fprintf(out, "{\"scaling\": [");
+    }
+}
+
+/*
+ * Print one row of a scaling report. The serial fraction is undefined on one
+ * thread and printed as empty (or null).
+ */
+static void print_scaling_row(FILE* out, OutputFormat format, ScalingMode mode,
+                              const BenchResult* result, double speedup,
+                              int first) {
+    const char* mode_name = mode == SCALING_STRONG ? "strong" : "weak";
+    const char* engine = raycast_engine_name(result->engine);
+    int p = result->threads;
+    double efficiency = speedup / p;
+    double serial = p > 1 ? (1 / speedup - 1.0 / p) / (1 - 1.0 / p) : 0;
+    if (format == FORMAT_TEXT) {
+        fprintf(out, "%-6s %-10s %-28s %6d %7d %10.3f %9.2f %10.2f ", mode_name,
+                engine, result->scene, result->light_count, p, result->median_ms,
+                speedup, efficiency);
+        if (p > 1) {
+            fprintf(out, "%10.3f\n", serial);
+        }
+        else {
+            fprintf(out, "%10s\n", "-");
+        }
+    }
+    else if (format == FORMAT_CSV) {
+        fprintf(out, "%s,%s,%s,%d,%d,%d,%d,%d,%.6f,%.4f,%.4f,", mode_name, engine,
+                result->scene, result->width, result->height, result->light_count,
+                p, result->iterations, result->median_ms, speedup, efficiency);
+        if (p > 1) {
+            fprintf(out, "%.4f", serial);
+        }
+        fprintf(out, "\n");
+    }
+    else {
+        fprintf(out, "%s\n  {\"mode\": \"%s\", \"engine\": \"%s\", \"scene\": ",
+                first ? "" : ",", mode_name, engine);
+        print_json_string(out, result->scene);
+        fprintf(out,
+                ", \"width\": %d, \"height\": %d, \"lights\": %d, "
+                "\"threads\": %d, \"iterations\": %d, \"median_ms\": %.6f, "
+                "\"speedup\": %.4f, \"efficiency\": %.4f, \"serial_fraction\": ",
+                result->width, result->height, result->light_count, p,
+                result->iterations, result->median_ms, speedup, efficiency);
+        if (p > 1) {
+            fprintf(out, "%.4f}", serial);
+        }
+        else {
+            fprintf(out, "null}");
+        }
+    }
+}
+
+/*
+ * Time one engine on one scene at every thread count, printing a scaling
+ * report against its single-threaded time.
+ */
+static void run_scaling(FILE* out, const BenchOptions* options,
+                        const char* scene_path, PreparedScene* prepared,
+                        RaycastEngine engine, int light_count, int* first) {
+    BenchResult base = run_case(options, scene_path, prepared, engine,
+                                light_count, 1);
+    for (int t = 0; t < options->thread_count_count; t++) {
+        int threads = options->thread_counts[t];
+        int lights = options->scaling == SCALING_WEAK ? light_count * threads
+                                                      : light_count;
+        BenchResult result = threads == 1 ? base
+                                          : run_case(options, scene_path, prepared,
+                                                     engine, lights, threads);
+        double speedup = base.median_ms / result.median_ms;
+        if (options->scaling == SCALING_WEAK) {
+            speedup *= threads;
+        }
+        print_scaling_row(out, options->format, options->scaling, &result,
+                          speedup, *first);
+        *first = 0;
+        fflush(out);
+    }
+}
 
-    struct timeval total_difference;
-    total_difference.tv_sec = 0;
-    total_difference.tv_usec = 0;
+// Split a comma-separated list in place. Returns the number of items.
+static int split_list(char* text, char*** items) {
+    int count = 0;
+    *items = NULL;
+    for (char* item = strtok(text, ","); item != NULL; item = strtok(NULL, ",")) {
+        *items = realloc(*items, sizeof(char*) * (count + 1));
+        (*items)[count++] = item;
+    }
+    return count;
+}
 
-    for (unsigned int iteration = 0; iteration < ITERATIONS; iteration++) {
-        Image* image = read_image(FILENAME);
+// Parse a list of positive integers. Returns the count, or -1 if malformed.
+static int parse_int_list(char* text, int** values) {
+    char** items;
+    int count = split_list(text, &items);
+    *values = malloc(sizeof(int) * (count + 1));
+    for (int i = 0; i < count; i++) {
+        char* end;
+        long value = strtol(items[i], &end, 10);
+        if (*end != '\0' || value < 1 || value > 1 << 24) {
+            count = -1;
+            break;
+        }
+        (*values)[i] = value;
+    }
+    free(items);
+    return count;
+}
 
-        // Print to see partial output during long iterations
-        printf("Iteration %d\n", iteration);
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [--engines LIST] [--scenes LIST] [--lights LIST] "
+            "[--threads LIST]\n"
+            "       [--iterations N] [--warmup N] [--cold] "
+            "[--format text|csv|json] [--output PATH]\n"
+            "       [--trace PATH] [--scaling strong|weak]\n",
+            program);
+}
 
-        // We need to get a fresh image each loop because we modify it
-        image = read_image(FILENAME);
+// Parse the command line into `options`. Returns 0 on success, -1 otherwise.
+static int parse_options(int argc, char** argv, BenchOptions* options) {
+    *options = (BenchOptions){
+        .engines = { ENGINE_SEQUENTIAL, ENGINE_PARALLEL_LIGHTS, ENGINE_PARALLEL_ROWS },
+        .engine_count = ENGINE_COUNT,
+        .scenes = default_scenes,
+        .scene_count = 1,
+        .light_counts = default_light_counts,
+        .light_count_count = 1,
+        .thread_counts = default_thread_counts,
+        .thread_count_count = 1,
+        .iterations = 8,
+        .warmup = 1,
+        .format = FORMAT_TEXT,
+    };
 
-        // Start time
-        gettimeofday(&start, NULL);
+    for (int arg = 1; arg < argc; arg++) {
+        const char* option = argv[arg];
+        if (strcmp(option, "--cold") == 0) {
+            options->cold = 1;
+            continue;
+        }
+        if (arg + 1 >= argc) {
+            return -1;
+        }
+        char* value = argv[++arg];
 
-        timed_function(image, lights);
+        if (strcmp(option, "--engines") == 0) {
+            char** names;
+            int count = split_list(value, &names);
+            options->engine_count = 0;
+            for (int i = 0; i < count; i++) {
+                int engine = raycast_engine_parse(names[i]);
+                if (engine < 0 || options->engine_count == ENGINE_COUNT) {
+                    free(names);
+                    return -1;
+                }
+                options->engines[options->engine_count++] = engine;
+            }
+            free(names);
+        }
+        else if (strcmp(option, "--scenes") == 0) {
+            options->scene_count = split_list(value, &options->scenes);
+        }
+        else if (strcmp(option, "--lights") == 0) {
+            options->light_count_count = parse_int_list(value, &options->light_counts);
+        }
+        else if (strcmp(option, "--threads") == 0) {
+            options->thread_count_count = parse_int_list(value, &options->thread_counts);
+        }
+        else if (strcmp(option, "--iterations") == 0) {
+            options->iterations = atoi(value);
+        }
+        else if (strcmp(option, "--warmup") == 0) {
+            options->warmup = atoi(value);
+        }
+        else if (strcmp(option, "--format") == 0) {
+            if (strcmp(value, "text") == 0) {
+                options->format = FORMAT_TEXT;
+            }
+            else if (strcmp(value, "csv") == 0) {
+                options->format = FORMAT_CSV;
+            }
+            else if (strcmp(value, "json") == 0) {
+                options->format = FORMAT_JSON;
+            }
+            else {
+                return -1;
+            }
+        }
+        else if (strcmp(option, "--output") == 0) {
+            options->output = value;
+        }
+        else if (strcmp(option, "--trace") == 0) {
+            options->trace = value;
+        }
+        else if (strcmp(option, "--scaling") == 0) {
+            if (strcmp(value, "strong") == 0) {
+                options->scaling = SCALING_STRONG;
+            }
+            else if (strcmp(value, "weak") == 0) {
+                options->scaling = SCALING_WEAK;
+            }
+            else {
+                return -1;
+            }
+        }
+        else {
+            return -1;
+        }
+    }
 
-        // End time
-        gettimeofday(&end, NULL);
+    return options->engine_count > 0 && options->scene_count > 0 &&
+                   options->light_count_count > 0 &&
+                   options->thread_count_count > 0 && options->iterations > 0 &&
+                   options->warmup >= 0
+               ? 0
+               : -1;
+}
 
-        // Record time
-        total_difference.tv_sec += end.tv_sec - start.tv_sec;
-        total_difference.tv_usec += end.tv_usec - start.tv_usec;
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (parse_options(argc, argv, &options) != 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    FILE* out = options.output != NULL ? fopen(options.output, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "%s: cannot open %s\n", argv[0], options.output);
+        return 1;
+    }
 
-        // Clean up at end of loop
-        free_image(image);
+    if (options.scaling != SCALING_NONE &&
+        options.thread_counts == default_thread_counts) {
+        options.thread_count_count = default_scaling_threads(&options.thread_counts);
     }
 
-    // Print the results of timing
-    printf("Timing %s with %d iterations.  Average time in seconds:\n",
-        FILENAME, ITERATIONS);
-    long double micro =
-        (SECONDS_TO_MICRO * total_difference.tv_sec + total_difference.tv_usec);
-    printf("%Lf\n", micro / (ITERATIONS * SECONDS_TO_MICRO));
+    int error = 0;
+    int first = 1;
+    if (options.trace != NULL) {
+        trace_start();
+    }
+    if (options.scaling != SCALING_NONE) {
+        print_scaling_header(out, options.format);
+    }
+    else {
+        print_header(out, options.format);
+    }
+    for (int s = 0; s < options.scene_count && !error; s++) {
+        PreparedScene* prepared = load_scene_file(options.scenes[s]);
+        if (prepared == NULL) {
+            fprintf(stderr, "%s: cannot load scene %s\n", argv[0], options.scenes[s]);
+            error = 1;
+            break;
+        }
+        for (int e = 0; e < options.engine_count; e++) {
+            RaycastEngine engine = options.engines[e];
+            // Only engines that take a thread count can scale
+            if (options.scaling != SCALING_NONE && engine == ENGINE_SEQUENTIAL) {
+                continue;
+            }
+            for (int l = 0; l < options.light_count_count; l++) {
+                if (options.scaling != SCALING_NONE) {
+                    run_scaling(out, &options, options.scenes[s], prepared,
+                                engine, options.light_counts[l], &first);
+                    continue;
+                }
+                for (int t = 0; t < options.thread_count_count; t++) {
+                    int threads = options.thread_counts[t];
+                    // The sequential engine ignores the thread count
+                    if (engine == ENGINE_SEQUENTIAL && t > 0) {
+                        break;
+                    }
+                    if (engine == ENGINE_SEQUENTIAL) {
+                        threads = 1;
+                    }
+                    BenchResult result = run_case(&options, options.scenes[s],
+                                                  prepared, engine,
+                                                  options.light_counts[l],
+                                                  threads);
+                    print_result(out, options.format, &result, first);
+                    first = 0;
+                    fflush(out);
+                }
+            }
+        }
+        free_prepared_scene(prepared);
+    }
+    if (options.scaling != SCALING_NONE && options.format == FORMAT_JSON) {
+        fprintf(out, "\n]}\n");
+    }
+    else {
+        print_footer(out, options.format);
+    }
+    if (options.trace != NULL) {
+        trace_stop();
+        if (trace_write(options.trace) != 0) {
+            fprintf(stderr, "%s: cannot write %s\n", argv[0], options.trace);
+            error = 1;
+        }
+    }
 
-    return 0;
+    if (out != stdout) {
+        error |= fclose(out) != 0;
+    }
+    if (options.scenes != default_scenes) {
+        free(options.scenes);
+    }
+    if (options.light_counts != default_light_counts) {
+        free(options.light_counts);
+    }
+    if (options.thread_counts != default_thread_counts) {
+        free(options.thread_counts);
+    }
+    return error ? 1 : 0;
 }
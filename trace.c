@@ -0,0 +1,129 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "trace.h"
+
+typedef struct {
+    const char* name;
+    int thread;
+    double start;    // microseconds since `trace_start`
+    double duration;
+    // Rectangle covered, if `has_region`
+    int has_region;
+    int x, y, width, height;
+} TraceEvent;
+
+static atomic_int tracing;
+static atomic_int next_thread = 1;
+static _Thread_local int thread_id;
+
+static pthread_mutex_t events_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceEvent* events;
+static size_t event_count;
+static size_t event_capacity;
+static double trace_origin;
+// Threads seen so far; ids are handed out in order, so this is the largest
+static int thread_count;
+
+static double now_us(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+void trace_start(void) {
+    pthread_mutex_lock(&events_lock);
+    event_count = 0;
+    trace_origin = now_us();
+    pthread_mutex_unlock(&events_lock);
+    atomic_store(&tracing, 1);
+}
+
+void trace_stop(void) {
+    atomic_store(&tracing, 0);
+}
+
+int trace_enabled(void) {
+    return atomic_load_explicit(&tracing, memory_order_relaxed);
+}
+
+TraceSpan trace_begin(const char* name) {
+    return (TraceSpan){ name, trace_enabled() ? now_us() : -1 };
+}
+
+static void record(TraceSpan span, const TraceEvent* region) {
+    if (span.start < 0 || !trace_enabled()) {
+        return;
+    }
+    double end = now_us();
+    if (thread_id == 0) {
+        thread_id = atomic_fetch_add(&next_thread, 1);
+    }
+
+    pthread_mutex_lock(&events_lock);
+    if (event_count == event_capacity) {
+        event_capacity = event_capacity ? event_capacity * 2 : 256;
+        events = realloc(events, sizeof(TraceEvent) * event_capacity);
+    }
+    TraceEvent* event = &events[event_count++];
+    *event = region != NULL ? *region : (TraceEvent){ 0 };
+    event->name = span.name;
+    event->thread = thread_id;
+    event->start = span.start - trace_origin;
+    event->duration = end - span.start;
+    if (thread_id > thread_count) {
+        thread_count = thread_id;
+    }
+    pthread_mutex_unlock(&events_lock);
+}
+
+void trace_end(TraceSpan span) {
+    record(span, NULL);
+}
+
+void trace_end_region(TraceSpan span, int x, int y, int width, int height) {
+    TraceEvent region = { .has_region = 1, .x = x, .y = y, .width = width,
+                          .height = height };
+    record(span, &region);
+}
+
+int trace_write(const char* filename) {
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&events_lock);
+    int error = fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [") < 0;
+    for (int thread = 1; thread <= thread_count && !error; thread++) {
+        error = fprintf(file,
+                        "%s\n  {\"name\": \"thread_name\", \"ph\": \"M\", "
+                        "\"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+                        thread == 1 ? "" : ",", thread, thread) < 0;
+    }
+    for (size_t i = 0; i < event_count && !error; i++) {
+        const TraceEvent* event = &events[i];
+        error = fprintf(file,
+                        "%s\n  {\"name\": \"%s\", \"cat\": \"raycast\", \"ph\": \"X\", "
+                        "\"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                        i == 0 && thread_count == 0 ? "" : ",", event->name,
+                        event->thread, event->start, event->duration) < 0;
+        if (!error && event->has_region) {
+            error = fprintf(file,
+                            ", \"args\": {\"x\": %d, \"y\": %d, \"width\": %d, "
+                            "\"height\": %d}",
+                            event->x, event->y, event->width, event->height) < 0;
+        }
+        error |= fprintf(file, "}") < 0;
+    }
+    pthread_mutex_unlock(&events_lock);
+
+    error |= fprintf(file, "\n]}\n") < 0;
+    error |= fclose(file) != 0;
+    return error ? -1 : 0;
+}
@@ -0,0 +1,65 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/*
+ * Timeline tracing.
+ *
+ * While tracing is on, the engines and the PNG writer record spans of what
+ * each thread is doing: every render's phases (allocate, trace, combine,
+ * multiply), each worker's share of the trace, each out-of-core tile and each
+ * encoded PNG band. `trace_write` saves them as Chrome trace event JSON, which
+ * Perfetto (ui.perfetto.dev) and chrome://tracing display as one timeline row
+ * per thread.
+ *
+ * Tracing is off until `trace_start`; until then a span costs one atomic load.
+ * Spans are coarse (per phase, worker or tile, never per pixel), so tracing
+ * barely perturbs the timings it records.
+ */
+
+/*
+ * An open span. `name` must outlive the trace, so use string literals.
+ */
+typedef struct {
+    const char* name;
+    double start;
+} TraceSpan;
+
+/*
+ * Start recording spans, discarding any recorded before.
+ */
+void trace_start(void);
+
+/*
+ * Stop recording spans. Those already recorded are kept for `trace_write`.
+ */
+void trace_stop(void);
+
+/*
+ * Returns 1 if spans are being recorded, and 0 otherwise.
+ */
+int trace_enabled(void);
+
+/*
+ * Open a span on the calling thread.
+ */
+TraceSpan trace_begin(const char* name);
+
+/*
+ * Close a span, recording it if tracing is on.
+ */
+void trace_end(TraceSpan span);
+
+/*
+ * Close a span that covered a rectangle of the image, recording the rectangle
+ * with it.
+ */
+void trace_end_region(TraceSpan span, int x, int y, int width, int height);
+
+/*
+ * Save every recorded span as Chrome trace event JSON.
+ *
+ * Returns 0 on success and -1 if the file could not be written.
+ */
+int trace_write(const char* filename);
+
+#endif // __TRACE_H__